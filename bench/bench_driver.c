@@ -0,0 +1,365 @@
+/*! \file bench_driver.c
+
+\brief throughput and latency of the driver against simulated nodes
+
+Runs the real driver on the host bus model (host/epos_host.h) with
+virtual EPOS2 nodes (host/epos_sim.h) and measures
+
+- SDO reads and writes per second for 1, 6 and 32 nodes
+- PDO setpoints per second and the shortest cycle for all nodes
+- the cost of one received frame in processCANMsg()
+- the time from bringUpEPOS() until all nodes are operational
+- the latency from the end of a move until the driver sees it, by TPDO
+  and by waitForTarget() polling
+- the shortest PDO cycle for 1, 6 and 32 nodes and three PDO mappings,
+  and the bus utilisation when the cycle runs at a fixed SYNC period,
+  with the stuff bits of the actual frames
+- through the fault layer (epos_fault.h): the worst blocking of an SDO
+  read when answers get lost, and how long after a bus-off the first
+  setpoint gets through again
+
+Everything in virtual time (us, ms, per second) is a property of the
+driver and the bus and the same on every run; only the *_ns figures are
+CPU time of the host. The result is JSON on stdout, or in the file
+given with -o, to be compared between versions; -b sets the bitrate of
+the bus model, 1 Mbit/s by default, and -c the SYNC period in us, 1000
+by default.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "epos.h"
+#include "main.h"
+#include "epos_host.h"
+#include "epos_sim.h"
+#include "epos_fault.h"
+
+#ifndef EPOS_BENCH_VERSION
+#define EPOS_BENCH_VERSION "unknown"
+#endif
+
+#define BENCH_SDO_OPS    1000
+#define BENCH_PDO_CYCLES 200
+#define BENCH_DISPATCH   200000
+#define BENCH_CYCLES     500
+#define BENCH_FAULT_OPS  1000
+#define BENCH_DROP       50         ///< lost SDO answers, 1/1000
+#define BENCH_BUSOFF_US  10000
+#define BENCH_MOVE_US    10000000   ///< virtual time a move may take
+
+static uint32_t bitrate = 1000000;
+static uint32_t period = 1000;      ///< SYNC period of benchCycle() [us]
+
+static const uint8_t nodeCounts[] = { 1, 6, 32 };
+#define BENCH_SIZES (sizeof(nodeCounts) / sizeof(nodeCounts[0]))
+
+/* a fresh bus with 'num' nodes, pre-operational */
+static void setup(uint8_t num) {
+    int i;
+
+    for (i = 0; i < epos_num; i++) free(epos[i]);
+    hostReset();
+    hostSetBitrate(bitrate);
+    setEPOSBitrate(bitrate);
+    removeEPOSSims();
+    for (i = 0; i < num; i++) {
+        addEPOSSim(i + 1);
+        epos[i] = openEPOS(&hcan1, i + 1);
+    }
+    epos_num = num;
+    hostAdvance(5000);
+    resetEPOSBusStats();
+}
+
+static void benchSDO(FILE *out, uint8_t num) {
+    uint64_t t0, c0, readUs, writeUs, readNs;
+    WORD w;
+    int k;
+
+    setup(num);
+    t0 = hostTimeUs();
+    c0 = hostCPUNs();
+    for (k = 0; k < BENCH_SDO_OPS; k++) readStatusword(epos[k % num], &w);
+    readNs = hostCPUNs() - c0;
+    readUs = hostTimeUs() - t0;
+
+    t0 = hostTimeUs();
+    for (k = 0; k < BENCH_SDO_OPS; k++) writePositionWindow(epos[k % num], 100 + k);
+    writeUs = hostTimeUs() - t0;
+
+    fprintf(out, "    { \"nodes\": %d, \"reads_per_s\": %.1f, \"writes_per_s\": %.1f, "
+            "\"read_cpu_ns\": %.0f }",
+            num, BENCH_SDO_OPS * 1e6 / readUs, BENCH_SDO_OPS * 1e6 / writeUs,
+            (double)readNs / BENCH_SDO_OPS);
+}
+
+static void benchPDO(FILE *out, uint8_t num) {
+    uint64_t t0;
+    eposBusStats_t bs;
+    int i, k;
+
+    setup(num);
+    bringUpEPOS(epos, num, 5000);
+    resetEPOSBusStats();
+    t0 = hostTimeUs();
+    for (k = 0; k < BENCH_PDO_CYCLES; k++)
+        for (i = 0; i < num; i++) PDOSetVelocity(epos[i], k);
+    t0 = hostTimeUs() - t0;
+    getEPOSBusStats(&bs);
+
+    fprintf(out, "    { \"nodes\": %d, \"setpoints_per_s\": %.1f, \"cycle_us\": %.1f, "
+            "\"bus_load_permille\": %d, \"bus_load_max_permille\": %d }",
+            num, (double)BENCH_PDO_CYCLES * num * 1e6 / t0,
+            (double)t0 / BENCH_PDO_CYCLES, bs.Load, bs.LoadMax);
+}
+
+static void benchDispatch(FILE *out, uint8_t num) {
+    CanRxMsgTypeDef msg;
+    uint64_t c0, first, last;
+    int k;
+
+    setup(num);
+    memset(&msg, 0, sizeof(msg));
+    msg.DLC = 2;
+    msg.Data[0] = 0x40;
+    msg.Data[1] = 0x01;
+
+    // the statusword TPDO of the first and of the last node of the array
+    msg.StdId = 0x181;
+    c0 = hostCPUNs();
+    for (k = 0; k < BENCH_DISPATCH; k++) receiveEPOSFrame(&msg, 0);
+    first = hostCPUNs() - c0;
+    msg.StdId = 0x180 + num;
+    c0 = hostCPUNs();
+    for (k = 0; k < BENCH_DISPATCH; k++) receiveEPOSFrame(&msg, 0);
+    last = hostCPUNs() - c0;
+
+    fprintf(out, "    { \"nodes\": %d, \"first_node_ns\": %.1f, \"last_node_ns\": %.1f }",
+            num, (double)first / BENCH_DISPATCH, (double)last / BENCH_DISPATCH);
+}
+
+static void benchBringUp(FILE *out, uint8_t num) {
+    uint32_t worst = 0;
+    eposBusStats_t bs;
+    int i, r;
+
+    setup(num);
+    r = bringUpEPOS(epos, num, 5000);
+    getEPOSBusStats(&bs);
+    for (i = 0; i < num; i++)
+        if (epos[i]->OpTime != EPOS_NOT_OPERATIONAL && epos[i]->OpTime > worst)
+            worst = epos[i]->OpTime;
+
+    fprintf(out, "    { \"nodes\": %d, \"ok\": %s, \"time_ms\": %lu, \"frames\": %lu }",
+            num, r == 0 ? "true" : "false", (unsigned long)worst,
+            (unsigned long)(bs.TxFrames + bs.RxFrames));
+}
+
+/* first time the node reached its target after 'watching' was set */
+static bool watching;
+static uint64_t arrived;
+
+static void watch(void *ctx) {
+    eposSim_t *s = (eposSim_t *)ctx;
+
+    if (watching && !arrived && s->reached) arrived = hostTimeUs();
+}
+
+static void benchMoveDone(FILE *out) {
+    uint64_t t0, tpdo = 0, poll = 0;
+    bool ok;
+
+    setup(1);
+    bringUpEPOS(epos, 1, 5000);
+    hostAddTimer(watch, getEPOSSim(1), 10);
+
+    // the statusword TPDO with 'target reached'
+    moveAbsolute(epos[0], 4000);
+    arrived = 0;
+    watching = true;
+    t0 = hostTimeUs();
+    while ((!arrived || !(epos[0]->Statusword & 0x0400)) && hostTimeUs() - t0 < BENCH_MOVE_US)
+        hostAdvance(10);
+    ok = arrived && (epos[0]->Statusword & 0x0400);
+    if (ok) tpdo = hostTimeUs() - arrived;
+
+    // polling the statusword by SDO, 50 ms per try
+    if (ok) {
+        moveAbsolute(epos[0], 0);
+        arrived = 0;
+        ok = waitForTarget(epos[0], BENCH_MOVE_US / 50000) == 0 && arrived;
+        if (ok) poll = hostTimeUs() - arrived;
+    }
+    watching = false;
+
+    fprintf(out, "  \"move_done\": { \"ok\": %s, \"tpdo_us\": %lu, \"sdo_poll_us\": %lu }\n",
+            ok ? "true" : "false", (unsigned long)tpdo, (unsigned long)poll);
+}
+
+/* PDO mappings of one cycle: the velocity setpoint by RPDO4 to every
+   node and the TPDOs every node answers with */
+static const struct {
+    const char *name;
+    uint8_t tpdo;       ///< EPOS_SIM_TPDO*
+} mappings[] = {
+    { "rpdo4", 0 },
+    { "rpdo4+tpdo1", EPOS_SIM_TPDO1 },
+    { "rpdo4+tpdo1,3,4", EPOS_SIM_TPDO1 | EPOS_SIM_TPDO3 | EPOS_SIM_TPDO4 },
+};
+#define BENCH_MAPPINGS (sizeof(mappings) / sizeof(mappings[0]))
+
+static uint32_t lcg = 1;
+
+static uint32_t rnd(void) {
+    lcg = lcg * 1103515245 + 12345;
+    return lcg >> 8;
+}
+
+/* the TPDOs of a cycle are sent by the test, with varying content, all
+   at the start of the cycle like after a SYNC; the nodes themselves are
+   quiet, so the mapping alone decides the load. A cycle starts every
+   'period' us, or as soon as the last one is done if it took longer,
+   so the utilisation is that of the bus at this SYNC period */
+static void benchCycle(FILE *out, uint8_t num) {
+    hostCANStats_t s0, s1;
+    uint64_t start, t0, t1, total, worst;
+    uint32_t frames, overruns;
+    uint8_t d[6];
+    unsigned m;
+    int i, k;
+
+    setup(num);
+    bringUpEPOS(epos, num, 5000);
+    for (i = 0; i < num; i++) getEPOSSim(i + 1)->TPDOMask = 0;
+    hostIdle();
+
+    fprintf(out, "    { \"nodes\": %d, \"mappings\": [\n", num);
+    for (m = 0; m < BENCH_MAPPINGS; m++) {
+        total = worst = 0;
+        overruns = 0;
+        hostGetCANStats(&s0);
+        start = hostTimeUs();
+        for (k = 0; k < BENCH_CYCLES; k++) {
+            t0 = hostTimeUs();
+            for (i = 0; i < num; i++) {
+                uint32_t pos = rnd(), vel = rnd() & 0x1FFF;
+
+                d[0] = 0x37;
+                d[1] = 0x04 | (rnd() & 0x02);
+                memcpy(&d[2], &pos, 4);
+                if (mappings[m].tpdo & EPOS_SIM_TPDO1) hostCANSend(0x180 + i + 1, 2, d, 0);
+                if (mappings[m].tpdo & EPOS_SIM_TPDO3) hostCANSend(0x380 + i + 1, 6, d, 0);
+                memcpy(&d[2], &vel, 4);
+                if (mappings[m].tpdo & EPOS_SIM_TPDO4) hostCANSend(0x480 + i + 1, 6, d, 0);
+            }
+            for (i = 0; i < num; i++) PDOSetVelocity(epos[i], (int32_t)(rnd() & 0x1FFF) - 0x1000);
+            hostIdle();
+            t1 = hostTimeUs() - t0;
+            total += t1;
+            if (t1 > worst) worst = t1;
+            if (t1 < period) hostAdvance(period - t1);
+            else overruns++;
+        }
+        hostGetCANStats(&s1);
+        frames = s1.TxFrames + s1.NodeFrames - s0.TxFrames - s0.NodeFrames;
+
+        fprintf(out, "      { \"mapping\": \"%s\", \"frames\": %lu, \"cycle_us\": %.1f, "
+                "\"worst_cycle_us\": %lu, \"period_us\": %lu, \"overruns\": %lu, "
+                "\"utilisation_permille\": %lu, \"stuff_bits_per_frame\": %.2f }%s\n",
+                mappings[m].name, (unsigned long)frames / BENCH_CYCLES,
+                (double)total / BENCH_CYCLES, (unsigned long)worst,
+                (unsigned long)period, (unsigned long)overruns,
+                (unsigned long)((s1.BusyUs - s0.BusyUs) * 1000 / (hostTimeUs() - start)),
+                (double)(s1.StuffBits - s0.StuffBits) / frames,
+                m + 1 < BENCH_MAPPINGS ? "," : "");
+    }
+    fprintf(out, "    ] }");
+}
+
+static void benchFaults(FILE *out) {
+    eposFaultRandom_t p = { 1, EPOS_FAULT_RX, 0x580, 0x780, { 0 }, 0, 0, 0 };
+    eposFaultRule_t busOff = { EPOS_FAULT_TX, 0x500, 0x780, 0, 1, EPOS_FAULT_BUSOFF, BENCH_BUSOFF_US };
+    uint64_t t0, t, total = 0, worst = 0, recovery;
+    int k, failed = 0;
+    WORD w;
+
+    setup(6);
+    bringUpEPOS(epos, 6, 5000);
+    setEPOSTransport(openEPOSFault(NULL, NULL));
+
+    // SDO path: answers lost at random
+    p.Rate[EPOS_FAULT_DROP] = BENCH_DROP;
+    setEPOSFaultRandom(&p);
+    for (k = 0; k < BENCH_FAULT_OPS; k++) {
+        t0 = hostTimeUs();
+        if (readStatusword(epos[k % 6], &w) < 0) failed++;
+        t = hostTimeUs() - t0;
+        total += t;
+        if (t > worst) worst = t;
+    }
+    setEPOSFaultRandom(NULL);
+
+    // PDO path: a setpoint every ms until one gets through after the bus-off
+    addEPOSFaultRule(&busOff);
+    t0 = hostTimeUs();
+    for (k = 0; PDOSetVelocity(epos[0], k) <= 0; k++) HAL_Delay(1);
+    recovery = hostTimeUs() - t0;
+    closeEPOSFault();
+
+    fprintf(out, "  \"faults\": { \"sdo_drop_permille\": %d, \"sdo_mean_us\": %.1f, "
+            "\"sdo_worst_us\": %lu, \"sdo_failed\": %d, \"busoff_us\": %d, "
+            "\"pdo_recovery_us\": %lu },\n",
+            BENCH_DROP, (double)total / BENCH_FAULT_OPS, (unsigned long)worst, failed,
+            BENCH_BUSOFF_US, (unsigned long)recovery);
+}
+
+#define SECTION(name, fn) do {                          \
+        fprintf(out, "  \"%s\": [\n", name);            \
+        for (i = 0; i < BENCH_SIZES; i++) {             \
+            fn(out, nodeCounts[i]);                     \
+            fprintf(out, i + 1 < BENCH_SIZES ? ",\n" : "\n"); \
+        }                                               \
+        fprintf(out, "  ],\n");                         \
+    } while (0)
+
+int main(int argc, char **argv) {
+    FILE *out = stdout;
+    unsigned int i;
+
+    int a;
+
+    for (a = 1; a < argc; a++) {
+        if (a + 1 < argc && strcmp(argv[a], "-o") == 0) {
+            if (!(out = fopen(argv[++a], "w"))) {
+                perror(argv[a]);
+                return 1;
+            }
+        } else if (a + 1 < argc && strcmp(argv[a], "-b") == 0 && atoi(argv[a + 1]) > 0) {
+            bitrate = atoi(argv[++a]);
+        } else if (a + 1 < argc && strcmp(argv[a], "-c") == 0 && atoi(argv[a + 1]) > 0) {
+            period = atoi(argv[++a]);
+        } else {
+            fprintf(stderr, "usage: %s [-o result.json] [-b bitrate] [-c period_us]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    fprintf(out, "{\n  \"benchmark\": \"libEPOS driver\",\n");
+    fprintf(out, "  \"version\": \"%s\",\n", EPOS_BENCH_VERSION);
+    fprintf(out, "  \"bitrate\": %lu,\n", (unsigned long)bitrate);
+    SECTION("sdo", benchSDO);
+    SECTION("pdo", benchPDO);
+    SECTION("dispatch", benchDispatch);
+    SECTION("bringup", benchBringUp);
+    SECTION("cycle", benchCycle);
+    benchFaults(out);
+    benchMoveDone(out);
+    fprintf(out, "}\n");
+
+    for (i = 0; i < epos_num; i++) free(epos[i]);
+    removeEPOSSims();
+    if (out != stdout) fclose(out);
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*! \file bench_ramp.c
+
+\brief cycle cost of tickEPOSRamps() for N axes
+
+Runs every axis through an acceleration / cruise / deceleration cycle
+with a 1 kHz tick and reports the cost of one tick for all axes and the
+number of setpoints that had to be sent. PDOSetVelocity() is replaced by
+a counter, so only the ramp itself is measured.
+
+On Cortex-M the DWT cycle counter is used, elsewhere clock_gettime() and
+the result is in ns.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "epos_ramp.h"
+
+#if defined(__arm__)
+#define BENCH_UNIT "cycles"
+static void benchInit(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+static uint32_t benchNow(void) { return DWT->CYCCNT; }
+#else
+#include <time.h>
+#define BENCH_UNIT "ns"
+static void benchInit(void) { }
+static uint32_t benchNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+#endif
+
+#define BENCH_MAXAXES  64
+#define BENCH_TICKS    3000   ///< 3s at 1 kHz
+
+static unsigned long frames = 0;
+
+/* the ramp only is measured, no CAN traffic */
+int PDOSetVelocity(epos_t *epos, int32_t velocity) {
+    (void)epos;
+    (void)velocity;
+    frames++;
+    return 1;
+}
+
+static void benchAxes(uint8_t num) {
+    static eposRamp_t ramps[BENCH_MAXAXES];
+    uint32_t t, dt, worst = 0;
+    unsigned long long sum = 0;
+    int i, k;
+
+    frames = 0;
+    for (i = 0; i < num; i++) {
+        initEPOSRamp(&ramps[i], NULL, 0.001f, 10000.0f, 200000.0f);
+        setEPOSRampTarget(&ramps[i], 3000 + 10 * i);
+    }
+
+    for (k = 0; k < BENCH_TICKS; k++) {
+        if (k == 2 * BENCH_TICKS / 3) {
+            for (i = 0; i < num; i++) setEPOSRampTarget(&ramps[i], 0);
+        }
+        t = benchNow();
+        tickEPOSRamps(ramps, num);
+        dt = benchNow() - t;
+        sum += dt;
+        if (dt > worst) worst = dt;
+    }
+
+    printf("%3d axes: %8.1f %s/tick mean, %8lu %s/tick worst, %6.2f %s/axis, %5.2f frames/tick\n",
+           num, (double)sum / BENCH_TICKS, BENCH_UNIT,
+           (unsigned long)worst, BENCH_UNIT,
+           (double)sum / BENCH_TICKS / num, BENCH_UNIT,
+           (double)frames / BENCH_TICKS);
+}
+
+int main(int argc, char **argv) {
+    static const uint8_t axes[] = { 1, 6, 12, 32, 64 };
+    unsigned int i;
+
+    benchInit();
+    if (argc > 1) {
+        benchAxes((uint8_t)atoi(argv[1]));
+        return 0;
+    }
+    for (i = 0; i < sizeof(axes) / sizeof(axes[0]); i++)
+        benchAxes(axes[i]);
+    return 0;
+}
@@ -40,6 +40,9 @@ NOT work with other EPOS variants.
 #include <math.h>
 #include "SEGGER_RTT.h"
 #include "epos.h"
+#include "epos_log.h"
+#include "epos_prof.h"
+#include "epos_trace.h"
 #include "main.h"
 
 
@@ -104,23 +107,6 @@ NOT work with other EPOS variants.
 #define E_NSERV         0x0F00FFBC   ///< Error code: device not in service mode
 #define E_NODEID        0x0F00FFB9   ///< Error code: error in Node-ID
 
-/* EPOS Device Error */
-#define EP_NOERR 0x0000
-#define EP_GENERR 0x1000
-#define EP_OCERR 0x2310
-#define EP_OVERR 0x3210
-#define EP_UVERR 0x3220
-#define EP_OTERR 0x4210
-#define EP_SUPVOLLOW 0x5113
-#define EP_OUTVOLLOW 0x5114
-#define EP_INTSOFT 0x6100
-#define EP_SOFTPAR 0x6320
-#define EP_POSSENS 0x7320
-#define EP_OBJLOST 0x8110
-#define EP_CANOVRUN 0x8111
-#define EP_CANPASS 0x8120
-#define EP_HEARTBEAT 0x8130
-
 /* EPOS Statusword -- singe bits, see firmware spec 14.1.58 */
 #define E_BIT15        0x8000      ///< bit code: position referenced to home position
 #define E_BIT14        0x4000      ///< bit code: refresh cycle of power stage
@@ -178,8 +164,41 @@ static int sendCom(epos_t *epos);
 /*! \brief  int readAnswer(WORD **ptr) - read an answer frame from EPOS */
 static int readAnswer(epos_t *epos);
 
-/*! \brief compare two 16bit bitmasks, return 1 (true) or 0 (false) */
-static int bitcmp(WORD a, WORD b);
+static int transmitFrame(epos_t *epos);
+static int waitAnswer(epos_t *epos);
+
+/*! \brief send an SDO request, but do not wait for the answer */
+static int requestSDO(epos_t *epos, BYTE cmd, WORD index, BYTE subindex, DWORD value);
+/*! \brief send an SDO upload request, but do not wait for the answer */
+static int requestObject(epos_t *epos, WORD index, BYTE subindex);
+
+/*! \brief non-blocking readAnswer(): 0 if nothing arrived yet, 1 if the
+   answer was placed in 'answer' */
+static int pollAnswer(epos_t *epos, DWORD *answer);
+
+/*! \brief send an NMT command to node 'ID' (0 == all nodes) */
+static int sendNMT(epos_t *epos, BYTE cmd, BYTE ID);
+
+/*! \brief count a frame in the bus statistics */
+static void countFrame(uint32_t DLC, bool tx);
+
+/*! \brief put an SDO round trip time into the statistics */
+static void countSDO(epos_t *epos);
+
+/*! \brief write the controlword through RPDO1 */
+static int PDOWriteControlword(epos_t *epos, WORD cw);
+
+/*! \brief pack 4 data bytes for a log dump, so that %08x shows them in
+   the order they are on the bus */
+static inline uint32_t dump32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/*! \brief the 4 bytes at p as a little endian value, the order of
+   all CANopen data */
+static inline uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
 
 /* Global Varibles */
 bool SDOBusy = false;
@@ -188,8 +207,109 @@ bool CAN_TxReady = false;
 static bool isPDO = false;
 
 CanRxMsgTypeDef CANMsgBuf[16];
+static uint32_t CANMsgStamp[16];   ///< receive time of the frames in CANMsgBuf
 uint8_t pCANMsg = 0;
 
+static int bxcanSend(void *ctx, CAN_HandleTypeDef *dev, const CanTxMsgTypeDef *msg);
+
+/* the default transport: the bxCAN through the HAL, frames are received
+   in HAL_CAN_RxCpltCallback() and filtered by the application's
+   HAL_CAN_ConfigFilter() */
+static const eposTransport_t bxcan = { "bxCAN", bxcanSend, NULL, NULL, NULL, NULL };
+static const eposTransport_t *transport = &bxcan;
+static uint8_t openNodes[16];      ///< bit n: node n was opened
+static epos_t *nodeTable[128];     ///< the EPOS object of each opened Node_ID
+static uint8_t nodeSlot[128];      ///< its index in the array of processCANMsg()
+
+static eposBusStats_t busStats;
+static uint32_t busStatsStart = 0;
+static uint32_t busStatsStartUs = 0;   ///< getEPOSTimeUs() at the reset
+static uint32_t busBitrate = 1000000;
+
+/* pre-built frames of the emergency stop, see armEPOSQuickStop() */
+static struct {
+    epos_t *epos[EPOS_QUICKSTOP_NODES];
+    CanTxMsgTypeDef frame[EPOS_QUICKSTOP_NODES];
+    uint8_t num;
+    volatile uint8_t next;      ///< frames already put into a mailbox
+    volatile bool active;       ///< triggered, not all axes confirmed
+    bool missed;                ///< ended without all axes confirming
+    uint8_t stopped;            ///< axes that confirmed
+    uint32_t start;             ///< HAL_GetTick() at the trigger
+    uint32_t time;              ///< ms until the last axis confirmed
+} quickStop;
+
+static void pumpQuickStop(void);
+static void confirmQuickStop(epos_t *epos, int state);
+static void expireQuickStop(void);
+
+static eposEvent_t eventQueue[EPOS_EVENT_QUEUE];
+static volatile uint16_t eventHead = 0;
+static volatile uint16_t eventTail = 0;
+static uint32_t eventLost = 0;
+static eposEventCallback eventCallback = NULL;
+
+/*! EPOS state of a statusword, firmware spec 8.1.1
+
+Only bits 0-6, 8 and 14 tell the states apart, all other bits are don't
+care. They make the 9 bit index STATE_INDEX(), so decodeEPOSstate() is
+one table read for any statusword. The states by their patterns:
+
+      fedc ba98  7654 3210
+      x0xx xxx0  x000 0000  0 start
+      x0xx xxx1  x000 0000  1 not ready to switch on
+      x0xx xxx1  x100 0000  2 switch on disabled
+      x0xx xxx1  x010 0001  3 ready to switch on
+      x0xx xxx1  x010 0011  4 switched on
+      x1xx xxx1  x010 0011  5 refresh
+      x1xx xxx1  x011 0011  6 measure init
+      x0xx xxx1  x011 0111  7 operation enable
+      x0xx xxx1  x001 0111  8 quick stop active
+      x0xx xxx1  x000 1111  9 fault reaction active (disabled)
+      x0xx xxx1  x001 1111 10 fault reaction active (enabled)
+      x0xx xxx1  x000 1000 11 fault
+
+Rows are bits 0-3 of the statusword, the comment gives bits 14, 8 and
+6-4.
+*/
+#define STATE_INDEX(w) (((w) & 0x007F) | (((w) >> 1) & 0x0080) | (((w) >> 6) & 0x0100))
+#define XX EPOS_BADSTATE
+static const int8_t stateTable[512] = {
+     0, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 0 0 000 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 0 0 001 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 0 0 010 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 0 0 011 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 0 0 100 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 0 0 101 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 0 0 110 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 0 0 111 */
+     1, XX, XX, XX, XX, XX, XX, XX, 11, XX, XX, XX, XX, XX, XX,  9, /* 0 1 000 */
+    XX, XX, XX, XX, XX, XX, XX,  8, XX, XX, XX, XX, XX, XX, XX, 10, /* 0 1 001 */
+    XX,  3, XX,  4, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 0 1 010 */
+    XX, XX, XX, XX, XX, XX, XX,  7, XX, XX, XX, XX, XX, XX, XX, XX, /* 0 1 011 */
+     2, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 0 1 100 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 0 1 101 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 0 1 110 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 0 1 111 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 0 000 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 0 001 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 0 010 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 0 011 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 0 100 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 0 101 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 0 110 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 0 111 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 1 000 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 1 001 */
+    XX, XX, XX,  5, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 1 010 */
+    XX, XX, XX,  6, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 1 011 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 1 100 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 1 101 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 1 110 */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, /* 1 1 111 */
+};
+#undef XX
+
 /************************************************************/
 /*           implementation of functions are following      */
 /************************************************************/
@@ -229,10 +349,33 @@ epos_t* openEPOS(CAN_HandleTypeDef *dev, uint8_t ID) {
         epos->PDO3RcvFlag = false;
         epos->PDO4RcvFlag = false;
         epos->SDORcvFlag = false;
+        epos->Statusword = 0;
+        epos->State = EPOS_NOSTATE;
+        epos->StateTick = 0;
+        epos->StatusCount = 0;
+        epos->StopTime = EPOS_NOT_STOPPED;
+        epos->ErrFlag = false;
+        epos->Dev_Err = EP_NOERR;
+        epos->EmcyCount = 0;
+        epos->NMTState = EPOS_NMT_UNKNOWN;
+        epos->Lost = false;
+        epos->HBDeadline = 0;
+        epos->HBTick = 0;
+        epos->RxPosition = 0;
+        epos->RxVelocity = 0;
+        epos->RxCurrent = 0;
+        epos->RxStamp = 0;
+        resetEPOSStats(epos);
+        // the SDO statistics are timed with the cycle counter
+        EPOS_CYCLES_INIT();
         if(HAL_CAN_Receive_IT(epos->dev, CAN_FIFO0) != HAL_OK)
         {
           //Error Handler
         }
+        openNodes[(ID & 0x7F) / 8] |= 1 << (ID % 8);
+        nodeTable[ID & 0x7F] = epos;
+        nodeSlot[ID & 0x7F] = 0;
+        if(transport->Filter) transport->Filter(transport->Ctx, openNodes);
     }
 
     return epos;
@@ -286,6 +429,7 @@ int readStatusword(epos_t *epos, WORD *status) {
     SEGGER_RTT_printf(0, "==> EPOS status word: %#06x\n", answer);
 #endif
     *status = answer & 0xFFFF;
+    if (epos->E_error == E_NOERR) observeEPOSstatus(epos, *status);
 
     return (0);
 }
@@ -416,122 +560,340 @@ int checkEPOSstate(epos_t *epos) {
         return (-1);
     }
 
-    /* state 'start' (0)
-         fedc ba98  7654 3210
-    w == x0xx xxx0  x000 0000 */
-    if (!bitcmp(w, E_BIT00) && !bitcmp(w, E_BIT01)
-        && !bitcmp(w, E_BIT02) && !bitcmp(w, E_BIT03)
-        && !bitcmp(w, E_BIT04) && !bitcmp(w, E_BIT05)
-        && !bitcmp(w, E_BIT06) && !bitcmp(w, E_BIT08)
-        && !bitcmp(w, E_BIT14)) return (0);
-
-    /* state 'not ready to switch on' (1)
-            fedc ba98  7654 3210
-       w == x0xx xxx1  x000 0000 */
-    if (!bitcmp(w, E_BIT00) && !bitcmp(w, E_BIT01)
-        && !bitcmp(w, E_BIT02) && !bitcmp(w, E_BIT03)
-        && !bitcmp(w, E_BIT04) && !bitcmp(w, E_BIT05)
-        && !bitcmp(w, E_BIT06) && bitcmp(w, E_BIT08)
-        && !bitcmp(w, E_BIT14)) return (1);
-
-
-    /* state 'switch on disabled' (2)
-            fedc ba98  7654 3210
-       w == x0xx xxx1  x100 0000 */
-    if (!bitcmp(w, E_BIT00) && !bitcmp(w, E_BIT01)
-        && !bitcmp(w, E_BIT02) && !bitcmp(w, E_BIT03)
-        && !bitcmp(w, E_BIT04) && !bitcmp(w, E_BIT05)
-        && bitcmp(w, E_BIT06) && bitcmp(w, E_BIT08)
-        && !bitcmp(w, E_BIT14)) return (2);
-
-    /* state 'ready to switch on' (3)
-            fedc ba98  7654 3210
-       w == x0xx xxx1  x010 0001 */
-    if (bitcmp(w, E_BIT00) && !bitcmp(w, E_BIT01)
-        && !bitcmp(w, E_BIT02) && !bitcmp(w, E_BIT03)
-        && !bitcmp(w, E_BIT04) && bitcmp(w, E_BIT05)
-        && !bitcmp(w, E_BIT06) && bitcmp(w, E_BIT08)
-        && !bitcmp(w, E_BIT14)) return (3);
-
-    /* state 'switched on' (4)
-            fedc ba98  7654 3210
-       w == x0xx xxx1  x010 0011 */
-    if (bitcmp(w, E_BIT00) && bitcmp(w, E_BIT01)
-        && !bitcmp(w, E_BIT02) && !bitcmp(w, E_BIT03)
-        && !bitcmp(w, E_BIT04) && bitcmp(w, E_BIT05)
-        && !bitcmp(w, E_BIT06) && bitcmp(w, E_BIT08)
-        && !bitcmp(w, E_BIT14)) return (4);
-
-    /* state 'refresh' (5)
-            fedc ba98  7654 3210
-       w == x1xx xxx1  x010 0011 */
-    if (bitcmp(w, E_BIT00) && bitcmp(w, E_BIT01)
-        && !bitcmp(w, E_BIT02) && !bitcmp(w, E_BIT03)
-        && !bitcmp(w, E_BIT04) && bitcmp(w, E_BIT05)
-        && !bitcmp(w, E_BIT06) && bitcmp(w, E_BIT08)
-        && bitcmp(w, E_BIT14)) return (5);
-
-    /* state 'measure init' (6)
-            fedc ba98  7654 3210
-       w == x1xx xxx1  x011 0011 */
-    if (bitcmp(w, E_BIT00) && bitcmp(w, E_BIT01)
-        && !bitcmp(w, E_BIT02) && !bitcmp(w, E_BIT03)
-        && bitcmp(w, E_BIT04) && bitcmp(w, E_BIT05)
-        && !bitcmp(w, E_BIT06) && bitcmp(w, E_BIT08)
-        && bitcmp(w, E_BIT14)) return (6);
-
-    /* state 'operation enable' (7)
-            fedc ba98  7654 3210
-       w == x0xx xxx1  x011 0111 */
-    if (bitcmp(w, E_BIT00) && bitcmp(w, E_BIT01)
-        && bitcmp(w, E_BIT02) && !bitcmp(w, E_BIT03)
-        && bitcmp(w, E_BIT04) && bitcmp(w, E_BIT05)
-        && !bitcmp(w, E_BIT06) && bitcmp(w, E_BIT08)
-        && !bitcmp(w, E_BIT14)) return (7);
-
-    /* state 'quick stop active' (8)
-            fedc ba98  7654 3210
-       w == x0xx xxx1  x001 0111 */
-    if (bitcmp(w, E_BIT00) && bitcmp(w, E_BIT01)
-        && bitcmp(w, E_BIT02) && !bitcmp(w, E_BIT03)
-        && bitcmp(w, E_BIT04) && !bitcmp(w, E_BIT05)
-        && !bitcmp(w, E_BIT06) && bitcmp(w, E_BIT08)
-        && !bitcmp(w, E_BIT14)) return (8);
-
-    /* state 'fault reaction active (disabled)' (9)
-            fedc ba98  7654 3210
-       w == x0xx xxx1  x000 1111 */
-    if (bitcmp(w, E_BIT00) && bitcmp(w, E_BIT01)
-        && bitcmp(w, E_BIT02) && bitcmp(w, E_BIT03)
-        && !bitcmp(w, E_BIT04) && !bitcmp(w, E_BIT05)
-        && !bitcmp(w, E_BIT06) && bitcmp(w, E_BIT08)
-        && !bitcmp(w, E_BIT14)) return (9);
-
-    /* state 'fault reaction active (enabled)' (10)
-            fedc ba98  7654 3210
-       w == x0xx xxx1  x001 1111 */
-    if (bitcmp(w, E_BIT00) && bitcmp(w, E_BIT01)
-        && bitcmp(w, E_BIT02) && bitcmp(w, E_BIT03)
-        && bitcmp(w, E_BIT04) && !bitcmp(w, E_BIT05)
-        && !bitcmp(w, E_BIT06) && bitcmp(w, E_BIT08)
-        && !bitcmp(w, E_BIT14)) return (10);
-
-    /* state 'fault' (11)
-            fedc ba98  7654 3210
-       w == x0xx xxx1  x000 1000 */
-    if (!bitcmp(w, E_BIT00) && !bitcmp(w, E_BIT01)
-        && !bitcmp(w, E_BIT02) && bitcmp(w, E_BIT03)
-        && !bitcmp(w, E_BIT04) && !bitcmp(w, E_BIT05)
-        && !bitcmp(w, E_BIT06) && bitcmp(w, E_BIT08)
-        && !bitcmp(w, E_BIT14)) return (11);
-
-
-    // if we get down here, statusword has a unknown value!
-    SEGGER_RTT_printf(0, "WARNING: EPOS status word %#06x is an unkown state!\n", w);
-    SEGGER_RTT_printf(0, "(function %s() in file %s, line %d)\n",
-            __func__, __FILE__, __LINE__);
-
-    return (-2);
+    if ((n = decodeEPOSstate(w)) < 0) {
+        SEGGER_RTT_printf(0, "WARNING: EPOS status word %#06x is an unkown state!\n", w);
+        SEGGER_RTT_printf(0, "(function %s() in file %s, line %d)\n",
+                __func__, __FILE__, __LINE__);
+    }
+    return (n);
+}
+
+
+/*! map a statusword to an EPOS state, firmware spec 8.1.1
+
+A pure function of the statusword that takes the same time for any
+value, cheap enough for every TPDO.
+
+\param w the statusword
+\return EPOS state as in checkEPOSstate(), EPOS_BADSTATE if the
+statusword matches no state
+
+*/
+int decodeEPOSstate(WORD w) {
+    return (stateTable[STATE_INDEX(w)]);
+}
+
+
+/* take the next slot of the event queue, interrupts must be disabled;
+   NULL if the queue is full */
+static eposEvent_t *queueEvent(eposEventType type, epos_t *epos) {
+    eposEvent_t *ev;
+
+    if ((uint16_t)(eventHead - eventTail) >= EPOS_EVENT_QUEUE) {
+        eventLost++;
+        return NULL;
+    }
+    ev = &eventQueue[eventHead & (EPOS_EVENT_QUEUE - 1)];
+    eventHead++;
+    ev->type = type;
+    ev->epos = epos;
+    ev->tick = HAL_GetTick();
+    return ev;
+}
+
+
+/*! update the tracked state of EPOS from a statusword
+
+Every statusword the driver sees goes through here: TPDOs in
+processCANMsg() and SDO answers in readStatusword(), so the state is
+tracked without any extra bus traffic. If the state changed, an
+EPOS_EV_STATE event is queued for dispatchEPOSEvents(). This is safe to
+call from the CAN interrupt.
+
+\param epos pointer on the EPOS object.
+\param statusword the statusword as sent by EPOS
+
+\return the decoded state, EPOS_BADSTATE for an unknown statusword (the tracked
+state is not changed then)
+*/
+int observeEPOSstatus(epos_t *epos, WORD statusword) {
+    eposEvent_t *ev;
+    uint32_t primask;
+    int state;
+
+    if (!epos) return -1;
+
+    epos->Statusword = statusword;
+    epos->StatusCount++;
+    state = decodeEPOSstate(statusword);
+    if (quickStop.active) confirmQuickStop(epos, state);
+    if (state < 0 || state == epos->State) return (state);
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    if ((ev = queueEvent(EPOS_EV_STATE, epos))) {
+        ev->from = epos->State;
+        ev->to = state;
+        ev->statusword = statusword;
+    }
+    epos->State = state;
+    epos->StateTick = HAL_GetTick();
+    if (!primask) __enable_irq();
+
+    return (state);
+}
+
+
+void setEPOSEventCallback(eposEventCallback cb) {
+    eventCallback = cb;
+}
+
+
+/*! hand the queued events to the callback set with setEPOSEventCallback()
+
+Events are queued from interrupt context, the callback runs in the
+context of the caller, so it may do blocking SDO transfers.
+
+\return number of events dispatched
+*/
+int dispatchEPOSEvents(void) {
+    eposEvent_t ev;
+    int n = 0;
+
+    if (eventLost) {
+        EPOS_LOG(EVENTS_LOST, eventLost);
+        eventLost = 0;
+    }
+    while (eventTail != eventHead) {
+        ev = eventQueue[eventTail & (EPOS_EVENT_QUEUE - 1)];
+        eventTail++;
+        if (eventCallback) eventCallback(&ev);
+        n++;
+    }
+    return (n);
+}
+
+
+/* store an EMCY frame in the history of EPOS and queue an EPOS_EV_EMCY
+   event, called from the CAN interrupt */
+static void observeEmcy(epos_t *epos, const CanRxMsgTypeDef *msg) {
+    eposEmcy_t *e;
+    eposEvent_t *ev;
+    uint32_t primask;
+
+    // an EMCY message has 8 bytes, the rest of a shorter one would be
+    // left over from an earlier frame
+    if (msg->DLC < 8) {
+        EPOS_LOG(EMCY_SHORT, epos->Node_ID, msg->DLC);
+        return;
+    }
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    e = &epos->Emcy[epos->EmcyCount & (EPOS_EMCY_HISTORY - 1)];
+    e->Code = msg->Data[0] | (msg->Data[1] << 8);
+    e->Register = msg->Data[2];
+    memcpy(e->Data, &msg->Data[3], sizeof(e->Data));
+    e->Tick = HAL_GetTick();
+    epos->EmcyCount++;
+    // the old interface: last error code, EP_NOERR resets all errors
+    epos->Dev_Err = e->Code;
+    epos->ErrFlag = (e->Code != EP_NOERR);
+    if ((ev = queueEvent(EPOS_EV_EMCY, epos))) ev->emcy = *e;
+    if (!primask) __enable_irq();
+    EPOS_LOG(EMCY, epos->Node_ID, e->Code, e->Register);
+}
+
+
+/* note a heartbeat or boot-up frame, called from the CAN interrupt */
+static void observeHeartbeat(epos_t *epos, const CanRxMsgTypeDef *msg) {
+    eposEvent_t *ev;
+    uint32_t primask;
+    uint8_t nmt;
+
+    // the NMT state is the one data byte, without it Data[0] is left over
+    // from an earlier frame
+    if (msg->DLC < 1) {
+        EPOS_LOG(HB_EMPTY, epos->Node_ID);
+        return;
+    }
+    nmt = msg->Data[0] & 0x7F;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    epos->HBTick = HAL_GetTick();
+    // a lost node that is back is reported even in the same NMT state
+    if (nmt != epos->NMTState || epos->Lost) {
+        if ((ev = queueEvent(EPOS_EV_NMT, epos))) {
+            ev->from = epos->NMTState;
+            ev->to = nmt;
+        }
+        epos->NMTState = nmt;
+    }
+    epos->Lost = false;
+    if (!primask) __enable_irq();
+}
+
+
+/*! let EPOS send heartbeats and declare it lost if they stop
+
+The producer heartbeat time (object 0x1017) is written to EPOS. From
+then on every heartbeat refreshes the node, and checkEPOSHeartbeat()
+declares it lost after 'deadline' ms without one. A change of the NMT
+state, including the boot-up of a node that was reset, and the first
+heartbeat of a lost node queue an EPOS_EV_NMT event.
+
+\param epos pointer on the EPOS object.
+\param period heartbeat period in ms, 0 switches the heartbeat off
+\param deadline ms without heartbeat until the node is lost, 0 for
+1.5 times the period
+
+\retval 0 success
+\retval -1 failure
+*/
+int setEPOSHeartbeat(epos_t *epos, uint16_t period, uint16_t deadline) {
+    WORD dw[2] = { 0x0, 0x0 };
+    int n;
+
+    if (!epos) return -1;
+
+    if (deadline == 0) deadline = period + period / 2;
+    // do not declare the node lost while it switches the heartbeat on
+    epos->HBDeadline = 0;
+    epos->HBTick = HAL_GetTick();
+    epos->Lost = false;
+
+    dw[0] = period;
+    n = WriteObject(epos, 0x1017, 0x00, dw);
+    if (n < 0) {
+        SEGGER_RTT_printf(0, "%s: writeObject() returned %d at %s, line %d\n",
+                __func__, n, __FILE__, __LINE__);
+        return (-1);
+    }
+    epos->HBTick = HAL_GetTick();
+    epos->HBDeadline = period ? deadline : 0;
+    return (0);
+}
+
+
+/*! declare nodes lost whose heartbeat is overdue
+
+Call this periodically, e.g. from the main loop or a timer interrupt.
+A node is reported once with an EPOS_EV_NODELOST event; while it is
+lost, SDO transfers to it give up after the first timeout instead of
+retrying. The next heartbeat brings it back.
+
+\param epos array of EPOS objects, NULL entries are skipped
+\param num number of entries in epos
+
+\return number of lost nodes
+*/
+int checkEPOSHeartbeat(epos_t **epos, uint8_t num) {
+    uint32_t primask, now;
+    eposEvent_t *ev;
+    int i, lost = 0;
+
+    if (!epos) return -1;
+
+    now = HAL_GetTick();
+    for (i = 0; i < num; i++) {
+        if (!epos[i] || epos[i]->HBDeadline == 0) continue;
+        primask = __get_PRIMASK();
+        __disable_irq();
+        if (!epos[i]->Lost && now - epos[i]->HBTick > epos[i]->HBDeadline) {
+            epos[i]->Lost = true;
+            if ((ev = queueEvent(EPOS_EV_NODELOST, epos[i])))
+                ev->from = ev->to = epos[i]->NMTState;
+            EPOS_LOG(NODE_LOST, epos[i]->Node_ID, now - epos[i]->HBTick);
+        }
+        if (epos[i]->Lost) lost++;
+        if (!primask) __enable_irq();
+    }
+    return lost;
+}
+
+
+/*! copy the EMCY messages EPOS sent, newest first
+
+Up to EPOS_EMCY_HISTORY messages are kept per node, older ones are
+overwritten.
+
+\param epos pointer on the EPOS object.
+\param emcy array for the messages
+\param max size of emcy
+
+\return number of messages copied, -1 on error
+*/
+int getEPOSEmcy(epos_t *epos, eposEmcy_t *emcy, int max) {
+    uint32_t primask, avail;
+    int n;
+
+    if (!epos || !emcy) return -1;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    avail = epos->EmcyCount < EPOS_EMCY_HISTORY ? epos->EmcyCount : EPOS_EMCY_HISTORY;
+    for (n = 0; n < max && (uint32_t)n < avail; n++)
+        emcy[n] = epos->Emcy[(epos->EmcyCount - 1 - n) & (EPOS_EMCY_HISTORY - 1)];
+    if (!primask) __enable_irq();
+    return n;
+}
+
+
+int clearEPOSEmcy(epos_t *epos) {
+    uint32_t primask;
+
+    if (!epos) return -1;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    epos->EmcyCount = 0;
+    epos->Dev_Err = EP_NOERR;
+    epos->ErrFlag = false;
+    if (!primask) __enable_irq();
+    return 0;
+}
+
+
+/*! describe an EPOS device error code, e.g. eposEmcy_t.Code
+
+Codes this driver does not know are described by their error class.
+
+\return a constant string
+*/
+const char *EPOSErrorText(uint16_t code) {
+    static const struct {
+        uint16_t code;
+        const char *text;
+    } known[] = {
+        { EP_NOERR,     "no error" },
+        { EP_GENERR,    "generic error" },
+        { EP_OCERR,     "over current" },
+        { EP_OVERR,     "over voltage" },
+        { EP_UVERR,     "under voltage" },
+        { EP_OTERR,     "over temperature" },
+        { EP_SUPVOLLOW, "supply voltage (+5V) too low" },
+        { EP_OUTVOLLOW, "supply voltage output stage too low" },
+        { EP_INTSOFT,   "internal software error" },
+        { EP_SOFTPAR,   "software parameter error" },
+        { EP_POSSENS,   "position sensor error" },
+        { EP_OBJLOST,   "CAN overrun, objects lost" },
+        { EP_CANOVRUN,  "CAN overrun" },
+        { EP_CANPASS,   "CAN passive mode" },
+        { EP_HEARTBEAT, "heartbeat error" },
+    };
+    static const char *const cls[16] = {
+        "no error", "generic error", "current error", "voltage error",
+        "temperature error", "device hardware error", "device software error",
+        "additional modules error", "communication error", "external error",
+        "unknown error", "unknown error", "unknown error", "unknown error",
+        "unknown error", "device specific error"
+    };
+    unsigned int i;
+
+    for (i = 0; i < sizeof(known) / sizeof(known[0]); i++)
+        if (known[i].code == code) return known[i].text;
+    return cls[code >> 12];
 }
 
 
@@ -1954,34 +2316,189 @@ int checkEPOSerror(epos_t *epos) {
 /*  send command to EPOS, taking care of all neccessary 'ack' and
    checksum tests*/
 static int sendCom(epos_t *epos) {
+    int n;
 
-    if (!epos) return -1;
+    EPOS_PROF_BEGIN(SENDCOM);
+    n = transmitFrame(epos);
+    EPOS_PROF_END(SENDCOM);
+    return n;
+}
+
+
+/* the work of sendCom(), without the profiling hooks */
+static int transmitFrame(epos_t *epos) {
+
+    int n;
 
+    if (!epos) return -1;
 
+    /* do not take a mailbox away from a pending emergency stop frame;
+       other transports get another try to send those first */
+    if (quickStop.active && quickStop.next < quickStop.num) {
+        if (transport != &bxcan) pumpQuickStop();
+        if (quickStop.active && quickStop.next < quickStop.num) {
+            EPOS_LOG(TX_BLOCKED, epos->Node_ID);
+            return -1;
+        }
+    }
 
     /* sending to EPOS */
-    if (HAL_CAN_Transmit_IT(epos->dev) != HAL_OK) {
-        SEGGER_RTT_printf(0, "\nTransmit Error!\n");
+    if ((n = transport->Send(transport->Ctx, epos->dev, &epos->TxMessage)) <= 0) {
+        if (n < 0) EPOS_LOG(TX_ERROR, epos->Node_ID);
+        else EPOS_LOG(TX_TIMEOUT, epos->Node_ID);
+        epos->Stats.TxStalls++;
         return -1;
     }
+    EPOS_LOG(TX_FRAME, epos->TxMessage.StdId, epos->TxMessage.DLC,
+             dump32(&epos->TxMessage.Data[0]), dump32(&epos->TxMessage.Data[4]));
+    traceEPOSFrame(epos->TxMessage.StdId, epos->TxMessage.DLC, epos->TxMessage.Data, true);
+    if ((epos->TxMessage.StdId & 0x780) == 0x600)
+        epos->SDOStart = EPOS_CYCLES();
+    epos->Stats.TxFrames[(epos->TxMessage.StdId >> 7) & 0x0F]++;
+    countFrame(epos->TxMessage.DLC, true);
+    return 1;
+}
+
+
+
+/* send a frame with the bxCAN through the HAL */
+static int bxcanSend(void *ctx, CAN_HandleTypeDef *dev, const CanTxMsgTypeDef *msg) {
+
+    uint32_t tickstart;
+
+    (void)ctx;
+
+    /* several EPOS may share one CAN handle, so make sure the HAL sends
+       the frame of this EPOS and not the one of the last opened node */
+    dev->pTxMsg = (CanTxMsgTypeDef *)msg;
+
+    if (HAL_CAN_Transmit_IT(dev) != HAL_OK) return -1;
+    /* a frame is on the bus after ~130us, so do not sleep a whole
+       HAL_Delay() tick per frame */
+    tickstart = HAL_GetTick();
     while(CAN_TxReady != true)
     {
-      HAL_Delay(5);
-    }
-#ifdef DEBUG
-    short i;
-    SEGGER_RTT_printf(0, "\n>> Sent Message ID: %04x\n", epos->dev->pTxMsg->StdId);
-    SEGGER_RTT_printf(0, ">> ");
-    for (i = 0; i < epos->dev->pTxMsg->DLC; ++i) {
-        SEGGER_RTT_printf(0, "%02x ", epos->dev->pTxMsg->Data[i]);
+      if ((HAL_GetTick() - tickstart) > EPOS_TX_TIMEOUT) return 0;
     }
-    SEGGER_RTT_printf(0, "\n");
-#endif
     CAN_TxReady = false;
     return 1;
 }
 
 
+/*! use another CAN interface
+
+The filter of the new transport is set up for the nodes opened so far,
+the ones opened later are added by openEPOS().
+
+\param t the transport, NULL for the bxCAN through the HAL
+
+\retval 0 success
+\retval -1 failure, the transport is incomplete or its filter failed
+*/
+int setEPOSTransport(const eposTransport_t *t) {
+
+    if (!t) t = &bxcan;
+    if (!t->Send) return -1;
+    if (t->Filter && t->Filter(t->Ctx, openNodes) < 0) return -1;
+    transport = t;
+    return 0;
+}
+
+const eposTransport_t *getEPOSTransport(void) {
+    return transport;
+}
+
+/*! let the transport deliver the frames it received
+
+Backends without a receive interrupt need this called while the driver
+waits; the HAL port of the system does it from HAL_GetTick(). Calls
+from within a delivery return at once. Quick stop frames the transport
+did not take yet are sent again from here.
+
+\return number of frames delivered, -1 on error
+*/
+int pollEPOSTransport(void) {
+    static bool polling = false;
+    int n = 0;
+
+    if (polling) return 0;
+    if (transport->Poll) {
+        polling = true;
+        n = transport->Poll(transport->Ctx);
+        polling = false;
+    }
+    if (quickStop.active && quickStop.next < quickStop.num) pumpQuickStop();
+    return n;
+}
+
+/*! the time in us, for timestamps
+
+EPOS_CYCLES() wraps after 2^32 cycles, about 25 s at 168 MHz and 4.3 s
+for the ns of host builds, so the cycles are summed up here into a us
+count that wraps after 2^32 us. After a pause of more than half the wrap
+between two calls the cycles are ambiguous, and the count is
+resynchronised with HAL_GetTick() instead. Safe to call from
+interrupts.
+
+\return us since HAL_GetTick() started
+*/
+uint32_t getEPOSTimeUs(void) {
+    static bool started = false;
+    static uint32_t lastCycles, lastTick, us, cycleRest;
+    uint32_t c, t, primask;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    c = EPOS_CYCLES();
+    t = HAL_GetTick();
+    if (!started || t - lastTick > 0x80000000u / EPOS_CYCLES_PER_US / 1000) {
+        us = started ? us + (t - lastTick) * 1000 : t * 1000;
+        cycleRest = 0;
+        started = true;
+    } else {
+        cycleRest += c - lastCycles;
+        us += cycleRest / EPOS_CYCLES_PER_US;
+        cycleRest %= EPOS_CYCLES_PER_US;
+    }
+    lastCycles = c;
+    lastTick = t;
+    t = us;
+    if (!primask) __enable_irq();
+    return t;
+}
+
+/*! hand a received frame to the driver
+
+This is the receive interrupt of the driver: the frame is traced,
+counted and dispatched to the opened nodes by processCANMsg(), unless
+the Receive hook of the transport takes it.
+
+\param msg the frame
+\param stamp receive time [us] on the clock of getEPOSTimeUs(), kept in
+RxStamp of the node
+*/
+void receiveEPOSFrame(const CanRxMsgTypeDef *msg, uint32_t stamp) {
+
+    if (transport->Receive && !transport->Receive(transport->Ctx, msg, stamp)) return;
+    traceEPOSFrame(msg->StdId, msg->DLC, msg->Data, false);
+    countFrame(msg->DLC, false);
+    if(pCANMsg >= sizeof(CANMsgBuf) / sizeof(CANMsgBuf[0]))
+    {
+      EPOS_LOG(RX_OVERFLOW, msg->StdId);
+      busStats.RxOverflows++;
+      return;
+    }
+    memcpy(&CANMsgBuf[pCANMsg], msg, sizeof(CanRxMsgTypeDef));
+    CANMsgStamp[pCANMsg] = stamp;
+
+    EPOS_LOG(RX_FRAME, CANMsgBuf[pCANMsg].StdId, CANMsgBuf[pCANMsg].DLC,
+             dump32(&CANMsgBuf[pCANMsg].Data[0]), dump32(&CANMsgBuf[pCANMsg].Data[4]));
+    pCANMsg ++;
+    CAN_RxReady = true;
+    processCANMsg(epos, EPOS_NUM);
+}
+
+
 
 /*!  int readAnswer(WORD **ptr) - read an answer frame from EPOS
 
@@ -1995,60 +2512,170 @@ static int sendCom(epos_t *epos) {
 
  */
 static int readAnswer(epos_t *epos) {
+    int n;
+
+    EPOS_PROF_BEGIN(READANSWER);
+    n = waitAnswer(epos);
+    EPOS_PROF_END(READANSWER);
+    return n;
+}
+
+
+/* the work of readAnswer(), without the profiling hooks */
+static int waitAnswer(epos_t *epos) {
+    uint32_t tickstart;
+
     if (!epos) return -1;
 
     epos->E_error = 0x00;
 
+    tickstart = HAL_GetTick();
     while(epos->SDORcvFlag != true)
     {
+      if ((HAL_GetTick() - tickstart) > EPOS_SDO_TIMEOUT) {
+        EPOS_LOG(SDO_TIMEOUT, epos->Node_ID, EPOS_SDO_TIMEOUT);
+        epos->Stats.SDOTimeouts++;
+        epos->E_error = E_SDOTOUT;
+        return -1;
+      }
       HAL_Delay(1);
     }
     epos->SDORcvFlag = false;
+    countSDO(epos);
     
-#ifdef DEBUG
-    short i;
-    SEGGER_RTT_printf(0, "\n<< Get SDO Message.\n");
-    SEGGER_RTT_printf(0, "<< ");
-    for (i = 0; i < epos->SDOMsg.DLC; i++) {
-        SEGGER_RTT_printf(0, "%02x ", epos->SDOMsg.Data[i]);
-    }
-    SEGGER_RTT_printf(0, "\n");
-#endif
+    EPOS_LOG(SDO_ANSWER, epos->Node_ID,
+             dump32(&epos->SDOMsg.Data[0]), dump32(&epos->SDOMsg.Data[4]));
     
     /* check for error code */
     if (epos->SDOMsg.Data[0] == 0x80) {
-        epos->E_error = (((int32_t)(epos->SDOMsg.Data[7])) << 24) + (((int32_t)(epos->SDOMsg.Data[6])) << 16) + (((int32_t)(epos->SDOMsg.Data[5])) << 8) + (int32_t)(epos->SDOMsg.Data[4]);
+        epos->E_error = get32(&epos->SDOMsg.Data[4]);
+        EPOS_LOG(SDO_ABORT, epos->Node_ID, epos->E_error,
+                 epos->SDOMsg.Data[1] | (epos->SDOMsg.Data[2] << 8), epos->SDOMsg.Data[3]);
+        epos->Stats.SDOAborts++;
     }
     return 1;
 }
 
 
-static int ReadObject(epos_t *epos, WORD Index, BYTE SubIndex, DWORD *param) {
+static void countSDO(epos_t *epos) {
+    uint32_t us;
+    int bin = 0;
+
+    us = (EPOS_CYCLES() - epos->SDOStart) / EPOS_CYCLES_PER_US;
+    epos->Stats.SDOCount++;
+    epos->Stats.SDOSumUs += us;
+    if (us < epos->Stats.SDOMinUs) epos->Stats.SDOMinUs = us;
+    if (us > epos->Stats.SDOMaxUs) epos->Stats.SDOMaxUs = us;
+    while ((us >>= 1) != 0 && bin < EPOS_HIST_BINS - 1) bin++;
+    epos->Stats.SDOHist[bin]++;
+}
+
+
+/*! send an expedited SDO request, the answer is picked up later with
+pollAnswer(). Many nodes can be asked one after the other this way, so
+their answers are on the way at the same time.
+
+\param cmd SDO command byte, 0x40 for an upload, 0x2F/0x2B/0x23 for a
+download of 1/2/4 bytes
+\param value the data of a download
+
+\retval 1 success
+\retval -1 failure
+*/
+static int requestSDO(epos_t *epos, BYTE cmd, WORD Index, BYTE SubIndex, DWORD value) {
     int n = 0;
-    int ret = -1;
 
     if (!epos) return -1;
-    SDOBusy = true;
+
+    epos->SDORcvFlag = false;
     epos->TxMessage.StdId = 0x600 + epos->Node_ID;
     epos->TxMessage.RTR = CAN_RTR_DATA;
     epos->TxMessage.IDE = CAN_ID_STD;
     epos->TxMessage.DLC = 8;
-    epos->TxMessage.Data[0] = 0x40;
+    epos->TxMessage.Data[0] = cmd;
     epos->TxMessage.Data[1] = Index&0xFF;
     epos->TxMessage.Data[2] = (Index&0xFF00)>>8;
     epos->TxMessage.Data[3]= SubIndex;
-    epos->TxMessage.Data[4]=0x00;
-    epos->TxMessage.Data[5]=0x00;
-    epos->TxMessage.Data[6]=0x00;
-    epos->TxMessage.Data[7]=0x00;
+    epos->TxMessage.Data[4]=value&0xFF;
+    epos->TxMessage.Data[5]=(value>>8)&0xFF;
+    epos->TxMessage.Data[6]=(value>>16)&0xFF;
+    epos->TxMessage.Data[7]=(value>>24)&0xFF;
 
     if ((n = sendCom(epos)) < 0) {
-        SEGGER_RTT_printf(0, " *** %s: problems with sendCom(), return value was %d ***\n ",  __func__, n);
+        EPOS_LOG(SENDCOM_FAILED, epos->Node_ID, epos->TxMessage.StdId);
         return (-1);
     }
-    
-    ret = readAnswer(epos);
-    *param=(((int32_t)(epos->SDOMsg.Data[7]))<<24)+(((int32_t)(epos->SDOMsg.Data[6]))<<16)+(((int32_t)(epos->SDOMsg.Data[5]))<<8) + (int32_t)(epos->SDOMsg.Data[4]);
+    return 1;
+}
+
+
+/* upload request of an object, see requestSDO() */
+static int requestObject(epos_t *epos, WORD Index, BYTE SubIndex) {
+    return requestSDO(epos, 0x40, Index, SubIndex, 0);
+}
+
+
+/*! check for the answer to requestSDO() without blocking
+
+\param epos pointer on the EPOS object.
+\param param the received object value, only valid if 1 is returned
+
+\retval 0 no answer yet
+\retval 1 answer received, E_error holds the abort code if there was one
+*/
+static int pollAnswer(epos_t *epos, DWORD *param) {
+    if (!epos) return -1;
+
+    if (epos->SDORcvFlag != true) return 0;
+    epos->SDORcvFlag = false;
+    countSDO(epos);
+
+    epos->E_error = 0x00;
+    if (epos->SDOMsg.Data[0] == 0x80) {
+        epos->E_error = get32(&epos->SDOMsg.Data[4]);
+        epos->Stats.SDOAborts++;
+    }
+    *param = get32(&epos->SDOMsg.Data[4]);
+    return 1;
+}
+
+
+static int ReadObject(epos_t *epos, WORD Index, BYTE SubIndex, DWORD *param) {
+    int n = 0;
+    int ret = -1;
+    int i;
+
+    if (!epos) return -1;
+    SDOBusy = true;
+    // send the request again if EPOS did not answer in time
+    for (i = 0; i < NTRY && ret < 0; i++) {
+        // a node without heartbeat will not answer a retry either
+        if (i > 0 && epos->Lost) break;
+        if (i > 0) epos->Stats.SDORetries++;
+        // drop a late answer to an earlier request
+        epos->SDORcvFlag = false;
+        epos->TxMessage.StdId = 0x600 + epos->Node_ID;
+        epos->TxMessage.RTR = CAN_RTR_DATA;
+        epos->TxMessage.IDE = CAN_ID_STD;
+        epos->TxMessage.DLC = 8;
+        epos->TxMessage.Data[0] = 0x40;
+        epos->TxMessage.Data[1] = Index&0xFF;
+        epos->TxMessage.Data[2] = (Index&0xFF00)>>8;
+        epos->TxMessage.Data[3]= SubIndex;
+        epos->TxMessage.Data[4]=0x00;
+        epos->TxMessage.Data[5]=0x00;
+        epos->TxMessage.Data[6]=0x00;
+        epos->TxMessage.Data[7]=0x00;
+
+        if ((n = sendCom(epos)) < 0) {
+            EPOS_LOG(SENDCOM_FAILED, epos->Node_ID, epos->TxMessage.StdId);
+            SDOBusy = false;
+            return (-1);
+        }
+
+        ret = readAnswer(epos);
+    }
+    *param = get32(&epos->SDOMsg.Data[4]);
     SDOBusy = false;
     // read response
     return ret;
@@ -2073,29 +2700,39 @@ firmware documentation for valid values
 */
 int WriteObject(epos_t *epos, WORD Index, BYTE SubIndex, WORD param[]) {
 
-    int n = 0;
+    int n = -1;
+    int i;
 
     if (!epos) return -1;
 
-    epos->TxMessage.StdId = 0x600 + epos->Node_ID;
-    epos->TxMessage.RTR = CAN_RTR_DATA;
-    epos->TxMessage.IDE = CAN_ID_STD;
-    epos->TxMessage.DLC = 8;
-    epos->TxMessage.Data[0] = 0x22;
-    epos->TxMessage.Data[1] = Index&0xFF;
-    epos->TxMessage.Data[2] = (Index&0xFF00)>>8;
-    epos->TxMessage.Data[3]= SubIndex;
-    epos->TxMessage.Data[4]=param[0]&0xFF;
-    epos->TxMessage.Data[5]=(param[0]&0xFF00)>>8;
-    epos->TxMessage.Data[6]=(param[1]&0xFF);
-    epos->TxMessage.Data[7]=(param[1]&0xFF00)>>8;
+    // send the request again if EPOS did not answer in time
+    for (i = 0; i < NTRY && n < 0; i++) {
+        if (i > 0 && epos->Lost) break;
+        if (i > 0) epos->Stats.SDORetries++;
+        // drop a late answer to an earlier request
+        epos->SDORcvFlag = false;
+        epos->TxMessage.StdId = 0x600 + epos->Node_ID;
+        epos->TxMessage.RTR = CAN_RTR_DATA;
+        epos->TxMessage.IDE = CAN_ID_STD;
+        epos->TxMessage.DLC = 8;
+        epos->TxMessage.Data[0] = 0x22;
+        epos->TxMessage.Data[1] = Index&0xFF;
+        epos->TxMessage.Data[2] = (Index&0xFF00)>>8;
+        epos->TxMessage.Data[3]= SubIndex;
+        epos->TxMessage.Data[4]=param[0]&0xFF;
+        epos->TxMessage.Data[5]=(param[0]&0xFF00)>>8;
+        epos->TxMessage.Data[6]=(param[1]&0xFF);
+        epos->TxMessage.Data[7]=(param[1]&0xFF00)>>8;
+
+        if ((n = sendCom(epos)) < 0) {
+            EPOS_LOG(SENDCOM_FAILED, epos->Node_ID, epos->TxMessage.StdId);
+            return (-1);
+        }
 
-    if ((n = sendCom(epos)) < 0) {
-        SEGGER_RTT_printf(0, " *** %s: problems with sendCom(), return value was %d ***\n ",  __func__, n);
-        return (-1);
+        n = readAnswer(epos);
     }
 
-    if ((n = readAnswer(epos)) < 0) {
+    if (n < 0) {
         SEGGER_RTT_printf(0, " *** %s: problems with readAnswer(), return value was %d ***\n ",  __func__, n);
         return (-1);
     }
@@ -2104,12 +2741,6 @@ int WriteObject(epos_t *epos, WORD Index, BYTE SubIndex, WORD param[]) {
 
 }
 
-/* compare WORD a with WORD b bitwise */
-static int bitcmp(WORD a, WORD b) {
-    if ((a & b) == b) return (1);
-    else return (0);
-}
-
 int startPDO(epos_t *epos)
 {
   int n = 0;
@@ -2121,7 +2752,7 @@ int startPDO(epos_t *epos)
   epos->TxMessage.Data[0] = 0x01;
   epos->TxMessage.Data[1] = epos->Node_ID;
   if ((n = sendCom(epos)) < 0) {
-    SEGGER_RTT_printf(0, " *** %s: problems with sendCom(), return value was %d ***\n ",  __func__, n);
+    EPOS_LOG(SENDCOM_FAILED, epos->Node_ID, epos->TxMessage.StdId);
     return (-1);
   }
   isPDO = true;
@@ -2129,7 +2760,17 @@ int startPDO(epos_t *epos)
   return 1;
 }
 
-int stopPDO(epos_t *epos)
+/*! send a NMT command, firmware spec 7.4
+
+\param epos the EPOS whose CAN device and TxMessage are used
+\param cmd NMT command specifier (0x01 start, 0x02 stop, 0x80 pre-operational,
+0x81 reset node, 0x82 reset communication)
+\param ID addressed node, 0 addresses all nodes on the bus
+
+\retval 1 success
+\retval -1 failure
+*/
+static int sendNMT(epos_t *epos, BYTE cmd, BYTE ID)
 {
   int n = 0;
   if (!epos) return -1;
@@ -2137,34 +2778,496 @@ int stopPDO(epos_t *epos)
   epos->TxMessage.RTR = CAN_RTR_DATA;
   epos->TxMessage.IDE = CAN_ID_STD;
   epos->TxMessage.DLC = 2;
-  epos->TxMessage.Data[0] = 0x80;
-  epos->TxMessage.Data[1] = epos->Node_ID;
+  epos->TxMessage.Data[0] = cmd;
+  epos->TxMessage.Data[1] = ID;
   if ((n = sendCom(epos)) < 0) {
-    SEGGER_RTT_printf(0, " *** %s: problems with sendCom(), return value was %d ***\n ",  __func__, n);
+    EPOS_LOG(SENDCOM_FAILED, epos->Node_ID, epos->TxMessage.StdId);
     return (-1);
   }
-  isPDO = false;
   return 1;
 }
 
-int PDOShutDown(epos_t *epos)
+/*! bring all EPOS to 'operation enable' at the same time
+
+All nodes are started with a single NMT broadcast. Then, round after
+round, the statusword of every node which is not enabled yet is
+requested (all SDO requests are sent before the first answer is waited
+for) and every node gets the controlword of its next step through
+RPDO1: fault reset, shutdown, switch on, enable operation. So the time
+for the whole bus is about the time of one node, instead of several
+blocking changeEPOSstate() calls per node.
+
+RPDO1 of every node has to be mapped to the controlword, as for
+PDOShutDown().
+
+\param epos array of EPOS objects, NULL entries are skipped
+\param num number of entries in epos
+\param timeout give up after timeout ms
+
+\retval 0 all nodes are in 'operation enable', their OpTime field holds
+the time in ms it took for each of them
+\retval -1 failure
+\retval -2 timeout, nodes with OpTime == EPOS_NOT_OPERATIONAL did not
+make it
+*/
+int bringUpEPOS(epos_t **epos, uint8_t num, uint32_t timeout)
+{
+  epos_t *master = NULL;
+  uint32_t start, now;
+  uint8_t pending = 0;
+  DWORD answer;
+  int i, n;
+
+  if (!epos) return -1;
+
+  for(i = 0; i < num; i++)
+  {
+    if(!epos[i]) continue;
+    if(!master) master = epos[i];
+    epos[i]->OpTime = EPOS_NOT_OPERATIONAL;
+    pending++;
+  }
+  if(!master) return -1;
+
+  start = HAL_GetTick();
+
+  // one broadcast instead of one startPDO() per node
+  if(sendNMT(master, 0x01, 0x00) < 0) return -1;
+  isPDO = true;
+
+  while(pending > 0)
+  {
+    // send all statusword requests first ...
+    for(i = 0; i < num; i++)
+    {
+      if(!epos[i] || epos[i]->OpTime != EPOS_NOT_OPERATIONAL) continue;
+      if(requestObject(epos[i], 0x6041, 0x00) < 0) return -1;
+    }
+
+    // ... then collect the answers and push every node one step further
+    for(i = 0; i < num; i++)
+    {
+      if(!epos[i] || epos[i]->OpTime != EPOS_NOT_OPERATIONAL) continue;
+      while((n = pollAnswer(epos[i], &answer)) == 0)
+      {
+        if((HAL_GetTick() - start) > timeout) break;
+      }
+      if(n <= 0 || epos[i]->E_error != E_NOERR) continue;
+
+      switch(observeEPOSstatus(epos[i], answer & 0xFFFF))
+      {
+      case 2: // switch on disabled
+        n = PDOWriteControlword(epos[i], 0x0006);
+        break;
+      case 3: // ready to switch on
+        n = PDOWriteControlword(epos[i], 0x0007);
+        break;
+      case 4: // switched on
+        n = PDOWriteControlword(epos[i], 0x000F);
+        break;
+      case 7: // operation enable
+        now = HAL_GetTick();
+        epos[i]->OpTime = now - start;
+        pending--;
+        break;
+      case 11: // fault, the reset needs a rising edge of bit 7
+        if((n = PDOWriteControlword(epos[i], 0x0000)) > 0)
+          n = PDOWriteControlword(epos[i], 0x0080);
+        break;
+      default: // transient state, ask again in the next round
+        break;
+      }
+      if(n < 0) return -1;
+    }
+
+    if((HAL_GetTick() - start) > timeout)
+    {
+      SEGGER_RTT_printf(0, "%s: %d node(s) not enabled after %lu ms\n",
+              __func__, pending, timeout);
+      return -2;
+    }
+  }
+  return 0;
+}
+
+/* wait for the answer to a pipelined request of EPOS, sent at 'start' */
+static int waitPolled(epos_t *epos, DWORD *answer, uint32_t start)
+{
+  int n;
+
+  while((n = pollAnswer(epos, answer)) == 0)
+  {
+    if((HAL_GetTick() - start) > EPOS_SDO_TIMEOUT)
+    {
+      EPOS_LOG(SDO_TIMEOUT, epos->Node_ID, EPOS_SDO_TIMEOUT);
+      epos->E_error = E_SDOTOUT;
+      epos->Stats.SDOTimeouts++;
+      return -1;
+    }
+  }
+  if(n < 0 || epos->E_error != E_NOERR) return -1;
+  return 1;
+}
+
+/*! read the error history (object 0x1003) of several nodes at once
+
+The number of entries of every node is requested, then entry 1 of all
+nodes, entry 2 of all nodes that have one, and so on: all requests of a
+round are sent before the first answer is waited for, so the whole bus
+takes about as long as one node with the longest history.
+
+\param epos array of EPOS objects, NULL entries are skipped
+\param num number of entries in epos
+\param hist array of num records for the result; Result is 0 for every
+node that answered all requests, else -1 and E_error of the node holds
+the reason
+\param clear if true, the history of every node read is cleared
+afterwards (0 written to 0x1003:0)
+\param time if not NULL, receives the time of the whole pass in us
+
+\retval 0 success
+\retval -1 failure
+\retval -2 at least one node did not answer, see hist[].Result
+*/
+int readEPOSErrorHistory(epos_t **epos, uint8_t num, eposErrHist_t *hist,
+                         bool clear, uint32_t *time)
+{
+  uint32_t cycles, start;
+  uint8_t sub, rounds = 0;
+  DWORD answer;
+  int i, failed = 0;
+
+  if (!epos || !hist) return -1;
+
+  cycles = EPOS_CYCLES();
+  for(i = 0; i < num; i++)
+  {
+    hist[i].Count = 0;
+    hist[i].Result = 0;
+  }
+
+  // round 0 reads the number of entries, round k entry k
+  for(sub = 0; sub <= rounds; sub++)
+  {
+    for(i = 0; i < num; i++)
+    {
+      if(!epos[i] || hist[i].Result < 0 || (sub > 0 && sub > hist[i].Count)) continue;
+      if(requestObject(epos[i], 0x1003, sub) < 0) hist[i].Result = -1;
+    }
+    start = HAL_GetTick();
+    for(i = 0; i < num; i++)
+    {
+      if(!epos[i] || hist[i].Result < 0 || (sub > 0 && sub > hist[i].Count)) continue;
+      if(waitPolled(epos[i], &answer, start) < 0)
+      {
+        hist[i].Result = -1;
+        continue;
+      }
+      if(sub == 0)
+      {
+        hist[i].Count = answer & 0xFF;
+        if(hist[i].Count > EPOS_ERRHIST_DEPTH) hist[i].Count = EPOS_ERRHIST_DEPTH;
+        if(hist[i].Count > rounds) rounds = hist[i].Count;
+      }
+      else
+      {
+        hist[i].Rec[sub - 1].Code = answer & 0xFFFF;
+        hist[i].Rec[sub - 1].Info = answer >> 16;
+      }
+    }
+  }
+
+  if(clear)
+  {
+    for(i = 0; i < num; i++)
+    {
+      if(!epos[i] || hist[i].Result < 0 || hist[i].Count == 0) continue;
+      if(requestSDO(epos[i], 0x2F, 0x1003, 0x00, 0) < 0) hist[i].Result = -1;
+    }
+    start = HAL_GetTick();
+    for(i = 0; i < num; i++)
+    {
+      if(!epos[i] || hist[i].Result < 0 || hist[i].Count == 0) continue;
+      if(waitPolled(epos[i], &answer, start) < 0) hist[i].Result = -1;
+    }
+  }
+
+  for(i = 0; i < num; i++)
+    if(epos[i] && hist[i].Result < 0) failed++;
+  if(time) *time = (EPOS_CYCLES() - cycles) / EPOS_CYCLES_PER_US;
+  return failed ? -2 : 0;
+}
+
+/************************************************************/
+/*            data recorder                                 */
+/************************************************************/
+
+/* EPOS2 data recorder objects, firmware spec 8.8 */
+#define REC_CONTROL     0x2010  ///< bit 0: trigger enable, bit 1: force trigger
+#define REC_CONFIG      0x2011  ///< trigger conditions, EPOS_REC_TRIG_*
+#define REC_PERIOD      0x2012  ///< sampling period, multiples of 0.1 ms
+#define REC_PRETRIGGER  0x2013  ///< samples before the trigger
+#define REC_NUMVARS     0x2014  ///< number of channels
+#define REC_VARINDEX    0x2015  ///< object index of channel 1-4 (sub 1-4)
+#define REC_VARSUB      0x2016  ///< object subindex of channel 1-4 (sub 1-4)
+#define REC_STATUS      0x2017  ///< EPOS_REC_RUNNING, _TRIGGERED, _AVAILABLE
+#define REC_MAXSAMPLES  0x2018  ///< samples the ring buffer holds
+#define REC_SAMPLES     0x2019  ///< samples recorded
+#define REC_START       0x201A  ///< sample of the ring where the oldest is
+#define REC_BUFFER      0x201B  ///< the ring buffer, domain object
+
+/*! upload an object of any size with a segmented SDO transfer
+
+Every segment is handed to 'sink' as soon as it arrives, so the object
+never has to fit into RAM at once. The answer to every segment request
+is busy-waited for, not polled every ms as in readAnswer(), so a
+segment costs one bus round trip.
+
+\return number of bytes received, -1 on error (E_error holds the abort
+code)
+*/
+static int uploadObject(epos_t *epos, WORD Index, BYTE SubIndex,
+                        void (*sink)(void *ctx, const uint8_t *data, int len),
+                        void *ctx)
+{
+  uint8_t cmd, toggle = 0x00;
+  DWORD answer;
+  int n, total = 0;
+
+  if (!epos || !sink) return -1;
+
+  if(requestObject(epos, Index, SubIndex) < 0) return -1;
+  if(waitPolled(epos, &answer, HAL_GetTick()) < 0) return -1;
+
+  cmd = epos->SDOMsg.Data[0];
+  if((cmd & 0xE0) != 0x40) goto protocol;
+  if(cmd & 0x02)
+  {
+    // expedited, the data is in the answer already
+    n = (cmd & 0x01) ? 4 - ((cmd >> 2) & 0x03) : 4;
+    sink(ctx, &epos->SDOMsg.Data[4], n);
+    return n;
+  }
+
+  for(;;)
+  {
+    if(requestSDO(epos, 0x60 | toggle, 0, 0, 0) < 0) return -1;
+    if(waitPolled(epos, &answer, HAL_GetTick()) < 0) return -1;
+    cmd = epos->SDOMsg.Data[0];
+    if((cmd & 0xE0) != 0x00) goto protocol;
+    if((cmd & 0x10) != toggle)
+    {
+      epos->E_error = E_TOGGLE;
+      requestSDO(epos, 0x80, Index, SubIndex, E_TOGGLE);
+      return -1;
+    }
+    n = 7 - ((cmd >> 1) & 0x07);
+    sink(ctx, &epos->SDOMsg.Data[1], n);
+    total += n;
+    if(cmd & 0x01) return total;
+    toggle ^= 0x10;
+  }
+
+protocol:
+  epos->E_error = E_CMDUKNOWN;
+  requestSDO(epos, 0x80, Index, SubIndex, E_CMDUKNOWN);
+  return -1;
+}
+
+/*! configure the data recorder of EPOS2
+
+The recorder is stopped first. It samples up to EPOS_REC_CHANNELS
+objects every rec->Period * 0.1 ms, down to the 10 kHz of the current
+loop, without any load on the bus.
+
+\retval 0 success
+\retval -1 failure
+*/
+int configEPOSRecorder(epos_t *epos, const eposRecorder_t *rec)
+{
+  WORD dw[2] = { 0x0, 0x0 };
+  int i;
+
+  if (!epos || !rec) return -1;
+  if (rec->NumChannels == 0 || rec->NumChannels > EPOS_REC_CHANNELS) return -1;
+
+  if (WriteObject(epos, REC_CONTROL, 0x00, dw) < 0) return -1;
+  dw[0] = rec->Trigger;
+  if (WriteObject(epos, REC_CONFIG, 0x00, dw) < 0) return -1;
+  dw[0] = rec->Period;
+  if (WriteObject(epos, REC_PERIOD, 0x00, dw) < 0) return -1;
+  dw[0] = rec->PreTrigger;
+  if (WriteObject(epos, REC_PRETRIGGER, 0x00, dw) < 0) return -1;
+  dw[0] = rec->NumChannels;
+  if (WriteObject(epos, REC_NUMVARS, 0x00, dw) < 0) return -1;
+  for(i = 0; i < rec->NumChannels; i++)
+  {
+    dw[0] = rec->Channel[i].Index;
+    if (WriteObject(epos, REC_VARINDEX, i + 1, dw) < 0) return -1;
+    dw[0] = rec->Channel[i].SubIndex;
+    if (WriteObject(epos, REC_VARSUB, i + 1, dw) < 0) return -1;
+  }
+  return 0;
+}
+
+/*! start the data recorder, it waits for its trigger after that */
+int armEPOSRecorder(epos_t *epos)
+{
+  WORD dw[2] = { 0x0001, 0x0 };
+
+  if (!epos) return -1;
+  return WriteObject(epos, REC_CONTROL, 0x00, dw) < 0 ? -1 : 0;
+}
+
+/*! trigger the running data recorder by hand */
+int triggerEPOSRecorder(epos_t *epos)
+{
+  WORD dw[2] = { 0x0003, 0x0 };
+
+  if (!epos) return -1;
+  return WriteObject(epos, REC_CONTROL, 0x00, dw) < 0 ? -1 : 0;
+}
+
+/*! check if the data recorder has finished
+
+\param status if not NULL, receives the recorder status word
+
+\retval 1 done (data available, or triggered and stopped), the samples
+can be uploaded
+\retval 0 still waiting or recording
+\retval -1 failure
+*/
+int pollEPOSRecorder(epos_t *epos, WORD *status)
+{
+  DWORD answer;
+
+  if (!epos) return -1;
+  if (ReadObject(epos, REC_STATUS, 0x00, &answer) < 0) return -1;
+  if (checkEPOSerror(epos) < 0) return -1;
+  if (status) *status = answer & 0xFFFF;
+  if (answer & EPOS_REC_AVAILABLE) return 1;
+  return ((answer & EPOS_REC_TRIGGERED) && !(answer & EPOS_REC_RUNNING)) ? 1 : 0;
+}
+
+/* state of the recorder buffer decoding, see recSink() */
+typedef struct {
+  const eposRecorder_t *rec;
+  int32_t **data;
+  uint16_t max;
+  uint16_t ring;      ///< samples of the ring buffer, REC_MAXSAMPLES
+  uint16_t start;     ///< slot of the oldest sample, REC_START
+  uint16_t recorded;  ///< samples in the ring, REC_SAMPLES
+  uint16_t slot;      ///< slot of the sample being decoded
+  uint8_t ch;         ///< channel of the next byte
+  uint8_t pos;        ///< byte of that channel
+  uint32_t value;
+} recDecode_t;
+
+/* the buffer is a ring of samples, every sample the channels in order,
+   little endian; slot 'start' holds the oldest sample, so slot s is
+   sample (s - start) mod ring, and slots past the recorded ones are
+   left out */
+static void recSink(void *ctx, const uint8_t *p, int len)
+{
+  recDecode_t *d = (recDecode_t *)ctx;
+  const eposRecChannel_t *c;
+  uint16_t n;
+
+  while(len-- > 0)
+  {
+    c = &d->rec->Channel[d->ch];
+    d->value |= (uint32_t)*p++ << (8 * d->pos);
+    if(++d->pos < c->Size) continue;
+    if(c->Signed && c->Size < 4 && (d->value & (1u << (8 * c->Size - 1))))
+      d->value |= 0xFFFFFFFFu << (8 * c->Size);
+    n = (d->slot + d->ring - d->start) % d->ring;
+    if(d->slot < d->ring && n < d->recorded && n < d->max && d->data[d->ch])
+      d->data[d->ch][n] = (int32_t)d->value;
+    d->value = 0;
+    d->pos = 0;
+    if(++d->ch == d->rec->NumChannels)
+    {
+      d->ch = 0;
+      d->slot++;
+    }
+  }
+}
+
+/*! upload the samples of the data recorder
+
+The size of the ring buffer, the number of samples in it and the slot
+of the oldest one are read first. The buffer is then read with a
+segmented SDO upload and decoded on the fly into one array per channel,
+the ring unrolled so that the oldest sample comes first; every value is
+sign extended according to the size and type of its channel.
+
+\param epos pointer on the EPOS object.
+\param rec the configuration given to configEPOSRecorder()
+\param data one array of 'max' values per channel, NULL to skip a channel
+\param max size of the arrays
+
+\return number of samples recorded (samples beyond max are dropped, the
+newest first), -1 on error
+*/
+int uploadEPOSRecorder(epos_t *epos, const eposRecorder_t *rec,
+                       int32_t *data[], uint16_t max)
+{
+  DWORD ring, start, recorded;
+  recDecode_t d;
+  int i;
+
+  if (!epos || !rec || !data) return -1;
+  if (rec->NumChannels == 0 || rec->NumChannels > EPOS_REC_CHANNELS) return -1;
+  for(i = 0; i < rec->NumChannels; i++)
+  {
+    if (rec->Channel[i].Size != 1 && rec->Channel[i].Size != 2
+        && rec->Channel[i].Size != 4) return -1;
+  }
+
+  if (ReadObject(epos, REC_MAXSAMPLES, 0x00, &ring) < 0 || checkEPOSerror(epos) < 0) return -1;
+  if (ReadObject(epos, REC_SAMPLES, 0x00, &recorded) < 0 || checkEPOSerror(epos) < 0) return -1;
+  if (ReadObject(epos, REC_START, 0x00, &start) < 0 || checkEPOSerror(epos) < 0) return -1;
+  ring &= 0xFFFF;
+  recorded &= 0xFFFF;
+  start &= 0xFFFF;
+  if (recorded == 0) return 0;
+  if (recorded > ring || start >= ring) return -1;
+
+  memset(&d, 0, sizeof(d));
+  d.rec = rec;
+  d.data = data;
+  d.max = max;
+  d.ring = ring;
+  d.start = start;
+  d.recorded = recorded;
+  SDOBusy = true;
+  i = uploadObject(epos, REC_BUFFER, 0x00, recSink, &d);
+  SDOBusy = false;
+  if (i < 0) return -1;
+  // a buffer shorter than the ring must still hold every recorded sample
+  if (d.slot < d.ring && (d.start != 0 || d.slot < d.recorded)) return -1;
+  return d.recorded;
+}
+
+int stopPDO(epos_t *epos)
 {
   int n = 0;
   if (!epos) return -1;
-  epos->TxMessage.StdId = 0x200 + epos->Node_ID;
+  epos->TxMessage.StdId = 0x0000;
   epos->TxMessage.RTR = CAN_RTR_DATA;
   epos->TxMessage.IDE = CAN_ID_STD;
   epos->TxMessage.DLC = 2;
-  epos->TxMessage.Data[0] = 0x06;
-  epos->TxMessage.Data[1] = 0x00;
+  epos->TxMessage.Data[0] = 0x80;
+  epos->TxMessage.Data[1] = epos->Node_ID;
   if ((n = sendCom(epos)) < 0) {
-    SEGGER_RTT_printf(0, " *** %s: problems with sendCom(), return value was %d ***\n ",  __func__, n);
+    EPOS_LOG(SENDCOM_FAILED, epos->Node_ID, epos->TxMessage.StdId);
     return (-1);
   }
+  isPDO = false;
   return 1;
 }
 
-int PDOSwitchOn(epos_t *epos)
+static int PDOWriteControlword(epos_t *epos, WORD cw)
 {
   int n = 0;
   if (!epos) return -1;
@@ -2172,30 +3275,374 @@ int PDOSwitchOn(epos_t *epos)
   epos->TxMessage.RTR = CAN_RTR_DATA;
   epos->TxMessage.IDE = CAN_ID_STD;
   epos->TxMessage.DLC = 2;
-  epos->TxMessage.Data[0] = 0x07;
-  epos->TxMessage.Data[1] = 0x00;
+  epos->TxMessage.Data[0] = cw & 0xFF;
+  epos->TxMessage.Data[1] = (cw >> 8) & 0xFF;
   if ((n = sendCom(epos)) < 0) {
-    SEGGER_RTT_printf(0, " *** %s: problems with sendCom(), return value was %d ***\n ",  __func__, n);
+    EPOS_LOG(SENDCOM_FAILED, epos->Node_ID, epos->TxMessage.StdId);
     return (-1);
   }
   return 1;
 }
 
+int PDOShutDown(epos_t *epos)
+{
+  return PDOWriteControlword(epos, 0x0006);
+}
+
+int PDOSwitchOn(epos_t *epos)
+{
+  return PDOWriteControlword(epos, 0x0007);
+}
+
 int PDOEnableOp(epos_t *epos)
 {
-  int n = 0;
+  return PDOWriteControlword(epos, 0x000F);
+}
+
+/* controlword of each eposCommand and the states (as bit mask) that
+   show the command was executed, firmware spec 8.1.3 */
+static const struct {
+  WORD cw;
+  uint16_t states;
+} commandTable[] = {
+  [EPOS_CMD_SHUTDOWN]       = { 0x0006, 1 << EPOS_READY },
+  [EPOS_CMD_SWITCHON]       = { 0x0007, 1 << EPOS_SWITCHEDON },
+  [EPOS_CMD_ENABLEOP]       = { 0x000F, 1 << EPOS_OPENABLE },
+  [EPOS_CMD_DISABLEVOLTAGE] = { 0x0000, 1 << EPOS_SWITCHONDIS },
+  // from 'operation enable' EPOS passes 'quick stop active' on its way
+  // to 'switch on disabled', from the other states it goes there directly
+  [EPOS_CMD_QUICKSTOP]      = { 0x0002, (1 << EPOS_QUICKSTOP) | (1 << EPOS_SWITCHONDIS) },
+  [EPOS_CMD_DISABLEOP]      = { 0x0007, 1 << EPOS_SWITCHEDON },
+  [EPOS_CMD_FAULTRESET]     = { 0x0080, 1 << EPOS_SWITCHONDIS },
+  [EPOS_CMD_HALT]           = { 0x010F, 1 << EPOS_OPENABLE },
+};
+
+/*! send a device control command through RPDO1 and verify it
+
+The state EPOS is in is tracked from its TPDOs by observeEPOSstatus(),
+so no SDO transfer is needed to check the effect of the command. The
+TPDOs have to be sent by EPOS on change or cyclically.
+
+Only a statusword received after the controlword confirms the command,
+so a state tracked from before cannot. EPOS_CMD_FAULTRESET sends
+controlword 0 first, because the reset needs a rising edge of bit 7.
+EPOS_CMD_HALT also waits for 'target reached'.
+
+\param epos pointer on the EPOS object.
+\param cmd the command
+\param timeout time in ms to wait for the statusword, 0 sends the
+command without waiting
+
+\retval 0 EPOS reached the state expected for the command
+\retval -1 failure
+\retval -2 timeout
+*/
+int PDOControl(epos_t *epos, eposCommand cmd, uint32_t timeout)
+{
+  uint32_t start;
+  uint16_t count;
+
   if (!epos) return -1;
-  epos->TxMessage.StdId = 0x200 + epos->Node_ID;
-  epos->TxMessage.RTR = CAN_RTR_DATA;
-  epos->TxMessage.IDE = CAN_ID_STD;
-  epos->TxMessage.DLC = 2;
-  epos->TxMessage.Data[0] = 0x0F;
-  epos->TxMessage.Data[1] = 0x00;
-  if ((n = sendCom(epos)) < 0) {
-    SEGGER_RTT_printf(0, " *** %s: problems with sendCom(), return value was %d ***\n ",  __func__, n);
+  if ((unsigned int)cmd >= sizeof(commandTable) / sizeof(commandTable[0])) {
+    SEGGER_RTT_printf(0, "ERROR: demanded command %d is UNKNOWN!\n", cmd);
     return (-1);
   }
-  return 1;
+
+  if (cmd == EPOS_CMD_FAULTRESET && PDOWriteControlword(epos, 0x0000) < 0)
+    return (-1);
+
+  count = epos->StatusCount;
+  start = HAL_GetTick();
+  if (PDOWriteControlword(epos, commandTable[cmd].cw) < 0)
+    return (-1);
+  if (timeout == 0)
+    return (0);
+
+  while ((HAL_GetTick() - start) <= timeout)
+  {
+    if (epos->StatusCount == count)
+      continue;
+    if (epos->State < 0 || !(commandTable[cmd].states & (1 << epos->State)))
+      continue;
+    if (cmd != EPOS_CMD_HALT || (epos->Statusword & E_BIT10) == E_BIT10)
+      return (0);
+  }
+  SEGGER_RTT_printf(0, "%s: command %d not confirmed within %lu ms, statusword %#06x\n",
+          __func__, cmd, timeout, epos->Statusword);
+  return (-2);
+}
+
+int PDOFaultReset(epos_t *epos, uint32_t timeout)
+{
+  return PDOControl(epos, EPOS_CMD_FAULTRESET, timeout);
+}
+
+int PDOQuickStop(epos_t *epos, uint32_t timeout)
+{
+  return PDOControl(epos, EPOS_CMD_QUICKSTOP, timeout);
+}
+
+int PDOHalt(epos_t *epos, uint32_t timeout)
+{
+  return PDOControl(epos, EPOS_CMD_HALT, timeout);
+}
+
+int PDODisableVoltage(epos_t *epos, uint32_t timeout)
+{
+  return PDOControl(epos, EPOS_CMD_DISABLEVOLTAGE, timeout);
+}
+
+int PDODisableOp(epos_t *epos, uint32_t timeout)
+{
+  return PDOControl(epos, EPOS_CMD_DISABLEOP, timeout);
+}
+
+/*! prepare the emergency stop of several axes
+
+A quick stop controlword frame (RPDO1) is built for every axis in
+advance, so triggerEPOSQuickStop() only has to copy them into the CAN
+transmit mailboxes. Call it again whenever the set of axes changes.
+
+\param epos array of EPOS objects, NULL entries are skipped
+\param num number of entries in epos
+
+\retval 0 success
+\retval -1 failure, e.g. more than EPOS_QUICKSTOP_NODES axes
+*/
+int armEPOSQuickStop(epos_t **epos, uint8_t num)
+{
+  CanTxMsgTypeDef *f;
+  int i;
+
+  if (!epos) return -1;
+  expireQuickStop();
+  if (quickStop.active) return -1;
+
+  quickStop.num = 0;
+  for(i = 0; i < num; i++)
+  {
+    if(!epos[i]) continue;
+    if(quickStop.num == EPOS_QUICKSTOP_NODES)
+    {
+      SEGGER_RTT_printf(0, "%s: more than %d axes!\n", __func__, EPOS_QUICKSTOP_NODES);
+      quickStop.num = 0;
+      return -1;
+    }
+    f = &quickStop.frame[quickStop.num];
+    f->StdId = 0x200 + epos[i]->Node_ID;
+    f->RTR = CAN_RTR_DATA;
+    f->IDE = CAN_ID_STD;
+    f->DLC = 2;
+    f->Data[0] = commandTable[EPOS_CMD_QUICKSTOP].cw & 0xFF;
+    f->Data[1] = commandTable[EPOS_CMD_QUICKSTOP].cw >> 8;
+    quickStop.epos[quickStop.num++] = epos[i];
+  }
+  return 0;
+}
+
+/* count and trace a quick stop frame that went out */
+static void sentQuickStop(void)
+{
+  CanTxMsgTypeDef *f = &quickStop.frame[quickStop.next];
+
+  traceEPOSFrame(f->StdId, f->DLC, f->Data, true);
+  quickStop.epos[quickStop.next]->Stats.TxFrames[(f->StdId >> 7) & 0x0F]++;
+  countFrame(f->DLC, true);
+  quickStop.next++;
+}
+
+/* put the pending quick stop frames into the free transmit mailboxes of
+   the bxCAN, the rest follows from HAL_CAN_TxCpltCallback(); other
+   transports get them in a row until one is not taken, the rest follows
+   from pollEPOSTransport() and transmitFrame(). Their Send() may block,
+   so it is called with interrupts enabled and 'pumping' keeps a second
+   pump out, e.g. one from within Send() */
+static void pumpQuickStop(void)
+{
+  static bool pumping = false;
+  CAN_HandleTypeDef *dev;
+  CanTxMsgTypeDef *f;
+  uint32_t primask;
+  bool busy;
+  int mb = 0;
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  if(transport != &bxcan)
+  {
+    busy = pumping;
+    pumping = true;
+    if (!primask) __enable_irq();
+    if(busy) return;
+    while(quickStop.next < quickStop.num)
+    {
+      dev = quickStop.epos[quickStop.next]->dev;
+      f = &quickStop.frame[quickStop.next];
+      if(transport->Send(transport->Ctx, dev, f) <= 0) break;
+      sentQuickStop();
+    }
+    pumping = false;
+    return;
+  }
+
+  while(quickStop.next < quickStop.num)
+  {
+    dev = quickStop.epos[quickStop.next]->dev;
+    f = &quickStop.frame[quickStop.next];
+    if(dev->Instance->TSR & CAN_TSR_TME0) mb = 0;
+    else if(dev->Instance->TSR & CAN_TSR_TME1) mb = 1;
+    else if(dev->Instance->TSR & CAN_TSR_TME2) mb = 2;
+    else break;
+
+    dev->Instance->sTxMailBox[mb].TIR = f->StdId << 21;
+    dev->Instance->sTxMailBox[mb].TDTR = f->DLC;
+    dev->Instance->sTxMailBox[mb].TDLR = ((uint32_t)f->Data[3] << 24) | ((uint32_t)f->Data[2] << 16)
+                                       | ((uint32_t)f->Data[1] << 8) | f->Data[0];
+    dev->Instance->sTxMailBox[mb].TDHR = ((uint32_t)f->Data[7] << 24) | ((uint32_t)f->Data[6] << 16)
+                                       | ((uint32_t)f->Data[5] << 8) | f->Data[4];
+    dev->Instance->sTxMailBox[mb].TIR |= CAN_TI0R_TXRQ;
+    __HAL_CAN_ENABLE_IT(dev, CAN_IT_TME);
+    sentQuickStop();
+  }
+  if (!primask) __enable_irq();
+}
+
+/*! stop all axes given to armEPOSQuickStop() as fast as possible
+
+Frames waiting in the transmit mailboxes are aborted and the mailboxes
+are filled with the quick stop frames right away; other transports
+send them after what they have queued already, and the frames they do
+not take at once are sent again from pollEPOSTransport(). Normal transmissions
+are refused until all stop frames are out. May be called from an
+interrupt. Whether and when the axes stopped is found with
+checkEPOSQuickStop().
+
+\retval 0 success
+\retval -1 nothing armed
+*/
+int triggerEPOSQuickStop(void)
+{
+  int i, state;
+
+  if (quickStop.num == 0) return -1;
+
+  quickStop.start = HAL_GetTick();
+  quickStop.stopped = 0;
+  quickStop.next = 0;
+  quickStop.missed = false;
+  for(i = 0; i < quickStop.num; i++)
+    quickStop.epos[i]->StopTime = EPOS_NOT_STOPPED;
+  quickStop.active = true;
+
+  for(i = 0; i < quickStop.num && transport == &bxcan; i++)
+  {
+    // abort whatever is still waiting for the bus
+    quickStop.epos[i]->dev->Instance->TSR = CAN_TSR_ABRQ0 | CAN_TSR_ABRQ1 | CAN_TSR_ABRQ2;
+  }
+  pumpQuickStop();
+
+  // axes that are not moving are stopped already
+  for(i = 0; i < quickStop.num; i++)
+  {
+    state = quickStop.epos[i]->State;
+    confirmQuickStop(quickStop.epos[i], state);
+  }
+  return 0;
+}
+
+/* the states in which an axis does not move any more: quick stop
+   active, switch on disabled, or a fault with its reaction */
+static bool isStoppedState(int state)
+{
+  return state == EPOS_QUICKSTOP || state == EPOS_SWITCHONDIS || state == EPOS_FAULTREACTDIS
+      || state == EPOS_FAULTREACTEN || state == EPOS_FAULT;
+}
+
+/* called by observeEPOSstatus() for every statusword during a quick stop */
+static void confirmQuickStop(epos_t *epos, int state)
+{
+  int i;
+
+  if(epos->StopTime != EPOS_NOT_STOPPED) return;
+  if(!isStoppedState(state)) return;
+
+  for(i = 0; i < quickStop.num; i++)
+  {
+    if(quickStop.epos[i] != epos) continue;
+    epos->StopTime = HAL_GetTick() - quickStop.start;
+    if(++quickStop.stopped == quickStop.num)
+    {
+      quickStop.time = epos->StopTime;
+      quickStop.active = false;
+    }
+    break;
+  }
+}
+
+/* end a quick stop that is not confirmed within EPOS_QUICKSTOP_TIMEOUT */
+static void expireQuickStop(void)
+{
+  uint32_t primask;
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  if(quickStop.active && HAL_GetTick() - quickStop.start > EPOS_QUICKSTOP_TIMEOUT)
+  {
+    quickStop.active = false;
+    quickStop.missed = true;
+    quickStop.time = HAL_GetTick() - quickStop.start;
+  }
+  if (!primask) __enable_irq();
+}
+
+/*! check the result of triggerEPOSQuickStop()
+
+An axis confirms the stop with 'quick stop active', 'switch on
+disabled' or one of the fault states. If not all of them did within
+EPOS_QUICKSTOP_TIMEOUT, the quick stop ends unconfirmed; the axes that
+did not confirm still have StopTime EPOS_NOT_STOPPED.
+
+\param time if not NULL, receives the ms from the trigger until the last
+axis confirmed, or until the quick stop ended. The time of each axis is
+in its StopTime field.
+
+\retval 1 all axes confirmed the quick stop
+\retval 0 still waiting for some axes
+\retval -1 never triggered
+\retval -2 ended with axes that did not confirm
+*/
+int checkEPOSQuickStop(uint32_t *time)
+{
+  if(quickStop.num == 0) return -1;
+  expireQuickStop();
+  if(quickStop.active) return 0;
+  if(time) *time = quickStop.time;
+  return quickStop.missed ? -2 : 1;
+}
+
+/*! stop waiting for the axes to confirm the quick stop
+
+Normal transmissions are allowed again and the quick stop can be armed
+anew; checkEPOSQuickStop() returns -2 if not all axes had confirmed.
+
+\retval 0 success
+\retval -1 nothing was triggered
+*/
+int cancelEPOSQuickStop(void)
+{
+  uint32_t primask;
+
+  if(quickStop.num == 0) return -1;
+  primask = __get_PRIMASK();
+  __disable_irq();
+  if(quickStop.active)
+  {
+    quickStop.active = false;
+    quickStop.missed = true;
+    quickStop.time = HAL_GetTick() - quickStop.start;
+  }
+  if (!primask) __enable_irq();
+  return 0;
 }
 
 int PDOSwitchProfile(epos_t *epos, Profile_t profile)
@@ -2210,7 +3657,7 @@ int PDOSwitchProfile(epos_t *epos, Profile_t profile)
   epos->TxMessage.Data[1] = 0x00;
   epos->TxMessage.Data[2] = profile;
   if ((n = sendCom(epos)) < 0) {
-    SEGGER_RTT_printf(0, " *** %s: problems with sendCom(), return value was %d ***\n ",  __func__, n);
+    EPOS_LOG(SENDCOM_FAILED, epos->Node_ID, epos->TxMessage.StdId);
     return (-1);
   }
   epos->CurProfile = profile;
@@ -2232,7 +3679,7 @@ int PDOSetVelocity(epos_t *epos, int32_t velocity)
   epos->TxMessage.Data[4] = (uint8_t)((velocity>>16) & 0xFF);
   epos->TxMessage.Data[5] = (uint8_t)((velocity>>24) & 0xFF);
   if ((n = sendCom(epos)) < 0) {
-    SEGGER_RTT_printf(0, " *** %s: problems with sendCom(), return value was %d ***\n ",  __func__, n);
+    EPOS_LOG(SENDCOM_FAILED, epos->Node_ID, epos->TxMessage.StdId);
     return (-1);
   }
   epos->TxVelocity = velocity;
@@ -2254,7 +3701,7 @@ int PDOSetPosition(epos_t *epos, int32_t position)
   epos->TxMessage.Data[4] = (uint8_t)((position>>16) & 0xFF);
   epos->TxMessage.Data[5] = (uint8_t)((position>>24) & 0xFF);
   if ((n = sendCom(epos)) < 0) {
-    SEGGER_RTT_printf(0, " *** %s: problems with sendCom(), return value was %d ***\n ",  __func__, n);
+    EPOS_LOG(SENDCOM_FAILED, epos->Node_ID, epos->TxMessage.StdId);
     return (-1);
   }
   epos->TxPosition = position;
@@ -2272,80 +3719,259 @@ int PDOSetRelativePosition(epos_t *epos, int32_t position_r)
     return -1;
 }
 
+/* frame length for the bus load estimate: a standard data frame has 47
+   bits besides the data, and up to one stuff bit per 4 bits of the 34 +
+   8*DLC bits from SOF to CRC. Received frames are counted in the CAN
+   interrupt, sent ones in thread context; the 64 bit sums are no atomic
+   update on Cortex-M, so the thread side disables interrupts for it. */
+static void countFrame(uint32_t DLC, bool tx)
+{
+  uint32_t primask = 0;
+
+  if(DLC > 8) DLC = 8;
+  if(tx)
+  {
+    primask = __get_PRIMASK();
+    __disable_irq();
+  }
+  busStats.Bits += 47 + 8 * DLC;
+  busStats.StuffBits += (34 + 8 * DLC - 1) / 4;
+  if(tx)
+  {
+    busStats.TxFrames++;
+    if (!primask) __enable_irq();
+  }
+  else busStats.RxFrames++;
+}
+
+/*! copy the counters of EPOS
+
+The counters are updated by the driver all the time, including the CAN
+interrupt, the copy is taken with interrupts disabled so it is
+consistent.
+
+\retval 0 success
+\retval -1 failure
+*/
+int getEPOSStats(epos_t *epos, eposStats_t *stats)
+{
+  uint32_t primask;
+
+  if (!epos || !stats) return -1;
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  *stats = epos->Stats;
+  if (!primask) __enable_irq();
+  return 0;
+}
+
+int resetEPOSStats(epos_t *epos)
+{
+  uint32_t primask;
+
+  if (!epos) return -1;
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  memset(&epos->Stats, 0, sizeof(epos->Stats));
+  epos->Stats.SDOMinUs = 0xFFFFFFFF;
+  if (!primask) __enable_irq();
+  return 0;
+}
+
+/* bits on the bus in 0.1% of the capacity, at most 1000 */
+static uint16_t loadPermille(uint64_t bits, uint64_t capacity)
+{
+  if (capacity == 0) return 0;
+  return bits >= capacity ? 1000 : (uint16_t)(bits * 1000 / capacity);
+}
+
+/*! copy the bus counters, Time and Load are filled in here
+
+Load takes one stuff bit per EPOS_STUFF_NOMINAL of the bits that can be
+stuffed, about what real data gives; LoadMax the worst case that
+StuffBits counts. Both are over the time in us, and at most 1000.
+
+\retval 0 success
+\retval -1 failure
+*/
+int getEPOSBusStats(eposBusStats_t *stats)
+{
+  uint32_t primask;
+  uint64_t us, capacity, nominal;
+
+  if (!stats) return -1;
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  *stats = busStats;
+  if (!primask) __enable_irq();
+
+  stats->Time = HAL_GetTick() - busStatsStart;
+  // the us clock wraps after 71 min, take the ms beyond an hour
+  us = stats->Time < 3600000 ? getEPOSTimeUs() - busStatsStartUs : (uint64_t)stats->Time * 1000;
+  capacity = (uint64_t)busBitrate * us / 1000000;
+  // 34 + 8*DLC of the 47 + 8*DLC bits of a frame can be stuffed
+  nominal = (stats->Bits - 13ull * (stats->TxFrames + stats->RxFrames)) / EPOS_STUFF_NOMINAL;
+  stats->Load = loadPermille(stats->Bits + nominal, capacity);
+  stats->LoadMax = loadPermille(stats->Bits + stats->StuffBits, capacity);
+  return 0;
+}
+
+void resetEPOSBusStats(void)
+{
+  uint32_t primask;
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+  memset(&busStats, 0, sizeof(busStats));
+  busStatsStart = HAL_GetTick();
+  busStatsStartUs = getEPOSTimeUs();
+  if (!primask) __enable_irq();
+}
+
+void setEPOSBitrate(uint32_t bitrate)
+{
+  busBitrate = bitrate;
+}
+
+/* every TPDO of the PDO mapping used here starts with the statusword,
+   just as every RPDO starts with the controlword */
+static void observePDOStatus(epos_t *epos, CanRxMsgTypeDef *msg)
+{
+  if(msg->DLC >= 2)
+    observeEPOSstatus(epos, ((WORD)(msg->Data[1]) << 8) | msg->Data[0]);
+}
+
+/* the index of the EPOS object of node 'id' in epos[], -1 if it is not
+   there. nodeTable[] has the object openEPOS() returned for the node,
+   nodeSlot[] where it was found the last time, so only the first frame
+   of a node, or one after the array changed, scans the array. The
+   object is only looked at once the array confirms it, as the memory of
+   an object the application freed may be used for another one. */
+static int findNode(epos_t **epos, uint8_t num, uint8_t id)
+{
+  epos_t *e = nodeTable[id];
+  int i = nodeSlot[id];
+
+  if(!e) return -1;
+  if(i < num && epos[i] == e && e->Node_ID == id) return i;
+  for(i = 0; i < num; i++)
+  {
+    if(!epos[i])
+    {
+      EPOS_LOG(RX_NOEPOS, i);
+      continue;
+    }
+    if(epos[i] == e && e->Node_ID == id)
+    {
+      nodeSlot[id] = i;
+      return i;
+    }
+  }
+  return -1;
+}
+
 int processCANMsg(epos_t **epos, uint8_t num)
 {
+  CanRxMsgTypeDef *msg;
+  epos_t *e;
+  uint8_t id;
+  int i;
+
+  EPOS_PROF_BEGIN(PROCESSCANMSG);
   while(pCANMsg > 0)
   {
-    int i = 0;
-    for(i = 0; i < num; i++)
+    msg = &CANMsgBuf[pCANMsg-1];
+    id = msg->StdId & 0x7F;
+    i = findNode(epos, num, id);
+    if(i < 0)
     {
-      if(!epos[i])
-      {
-        SEGGER_RTT_printf(0, "\nEPOS %d not initialized!\n", i);
-        continue;
-      }
-      if(CANMsgBuf[pCANMsg-1].StdId == (epos[i]->Node_ID + 0x180))
-      {
-        epos[i]->PDO1Msg = CANMsgBuf[pCANMsg-1];
-        epos[i]->PDO1RcvFlag = true;
-        break;
-      }
-      else if(CANMsgBuf[pCANMsg-1].StdId == (epos[i]->Node_ID + 0x280))
-      {
-        epos[i]->PDO2Msg = CANMsgBuf[pCANMsg-1];
-        epos[i]->PDO2RcvFlag = true;
-        break;
-      }
-      else if(CANMsgBuf[pCANMsg-1].StdId == (epos[i]->Node_ID + 0x380))
-      {
-        epos[i]->PDO3Msg = CANMsgBuf[pCANMsg-1];
-        epos[i]->PDO3RcvFlag = true;
-        break;
-      }
-      else if(CANMsgBuf[pCANMsg-1].StdId == (epos[i]->Node_ID + 0x480))
-      {
-        epos[i]->PDO4Msg = CANMsgBuf[pCANMsg-1];
-        epos[i]->PDO4RcvFlag = true;
-        break;
-      }
-      else if(CANMsgBuf[pCANMsg-1].StdId == (epos[i]->Node_ID + 0x580))
-      {
-        epos[i]->SDOMsg = CANMsgBuf[pCANMsg-1];
-        epos[i]->SDORcvFlag = true;
-        break;
-      }
-      else if(CANMsgBuf[pCANMsg-1].StdId == (epos[i]->Node_ID + 0x80))
-      {
-        epos[i]->Dev_Err = (((uint16_t)(CANMsgBuf[pCANMsg-1].Data[1])) << 8) + (uint16_t)(CANMsgBuf[pCANMsg-1].Data[0]);
-        epos[i]->ErrFlag = true;
-        break;
-      }
+      EPOS_LOG(RX_UNKNOWN, msg->StdId);
+      busStats.RxUnknown++;
+      pCANMsg --;
+      continue;
+    }
+    e = epos[i];
+    switch(msg->StdId & 0x780)
+    {
+    case 0x180:
+      e->PDO1Msg = *msg;
+      e->PDO1RcvFlag = true;
+      observePDOStatus(e, &e->PDO1Msg);
+      break;
+    case 0x280:
+      e->PDO2Msg = *msg;
+      e->PDO2RcvFlag = true;
+      observePDOStatus(e, &e->PDO2Msg);
+      break;
+    case 0x380:
+      e->PDO3Msg = *msg;
+      e->PDO3RcvFlag = true;
+      observePDOStatus(e, &e->PDO3Msg);
+      break;
+    case 0x480:
+      e->PDO4Msg = *msg;
+      e->PDO4RcvFlag = true;
+      observePDOStatus(e, &e->PDO4Msg);
+      break;
+    case 0x580:
+      e->SDOMsg = *msg;
+      e->SDORcvFlag = true;
+      break;
+    case 0x080:
+      observeEmcy(e, msg);
+      break;
+    case 0x700:
+      observeHeartbeat(e, msg);
+      break;
+    default:
+      i = -1;
+      break;
+    }
+    if(i < 0)
+    {
+      EPOS_LOG(RX_UNKNOWN, msg->StdId);
+      busStats.RxUnknown++;
     }
-    if( i == num)
+    else
     {
-      SEGGER_RTT_printf(0, "\nMessage id: %04x cannot be process!\n", CANMsgBuf[pCANMsg-1].StdId);
+      e->Stats.RxFrames[(msg->StdId >> 7) & 0x0F]++;
+      e->RxStamp = CANMsgStamp[pCANMsg-1];
     }
     pCANMsg --;
   }
   processPDOMessage(epos, num);
+  EPOS_PROF_END(PROCESSCANMSG);
   return 1;
 }
 
 int processPDOMessage(epos_t **epos, uint8_t num)
 {
+  EPOS_PROF_BEGIN(PROCESSPDO);
   for(int i = 0; i < num; i++)
   {
+    if(!epos[i]) continue;
+    // TPDO2 may carry the current actual value (0x6078) after the statusword
+    if(epos[i]->PDO2RcvFlag == true)
+    {
+      if(epos[i]->PDO2Msg.DLC >= 4)
+        epos[i]->RxCurrent = (int16_t)(((uint16_t)(epos[i]->PDO2Msg.Data[3])<<8) + epos[i]->PDO2Msg.Data[2]);
+      epos[i]->PDO2RcvFlag = false;
+    }
     if(epos[i]->PDO3RcvFlag == true)
     {
-      epos[i]->RxPosition = (((int32_t)(epos[i]->PDO3Msg.Data[5]))<<24)+(((int32_t)(epos[i]->PDO3Msg.Data[4]))<<16)+(((int32_t)(epos[i]->PDO3Msg.Data[3]))<<8)+ (int32_t)(epos[i]->PDO3Msg.Data[2]);
+      epos[i]->RxPosition = (int32_t)get32(&epos[i]->PDO3Msg.Data[2]);
       epos[i]->PDO3RcvFlag = false;
     }
     if(epos[i]->PDO4RcvFlag == true)
     {
-      epos[i]->RxVelocity = (((int32_t)(epos[i]->PDO4Msg.Data[5]))<<24)+(((int32_t)(epos[i]->PDO4Msg.Data[4]))<<16)+(((int32_t)(epos[i]->PDO4Msg.Data[3]))<<8)+ (int32_t)(epos[i]->PDO4Msg.Data[2]);
+      epos[i]->RxVelocity = (int32_t)get32(&epos[i]->PDO4Msg.Data[2]);
       epos[i]->PDO4RcvFlag = false;
     }
   }
+  EPOS_PROF_END(PROCESSPDO);
   return 1;
 }
 
@@ -2358,6 +3984,7 @@ int processPDOMessage(epos_t **epos, uint8_t num)
 void HAL_CAN_TxCpltCallback(CAN_HandleTypeDef* hcan)
 {
   CAN_TxReady = true;
+  if(quickStop.active) pumpQuickStop();
 }
 
 /**
@@ -2368,23 +3995,11 @@ void HAL_CAN_TxCpltCallback(CAN_HandleTypeDef* hcan)
   */
 void HAL_CAN_RxCpltCallback(CAN_HandleTypeDef* hcan)
 {
-//  CANMsgBuf[pCANMsg] = *(hcan->pRxMsg);
-  memcpy(&CANMsgBuf[pCANMsg], hcan->pRxMsg, sizeof(CanRxMsgTypeDef));
-  
-#ifdef DEBUG
-  SEGGER_RTT_printf(0, "\n<< Message id: %04x received!\n", CANMsgBuf[pCANMsg].StdId);
-  short i;
-  SEGGER_RTT_printf(0, "<< ");
-  for (i = 0; i < CANMsgBuf[pCANMsg].DLC; ++i) {
-    SEGGER_RTT_printf(0, "%02x ", CANMsgBuf[pCANMsg].Data[i]);
-  }
-  SEGGER_RTT_printf(0, "\n");
-#endif
-  pCANMsg ++;
-  CAN_RxReady = true;
-  processCANMsg(epos, EPOS_NUM);
+  EPOS_PROF_BEGIN(RXISR);
+  receiveEPOSFrame(hcan->pRxMsg, getEPOSTimeUs());
   if(HAL_CAN_Receive_IT(hcan, CAN_FIFO0) != HAL_OK)
   {
     //Error Handler
   }
+  EPOS_PROF_END(RXISR);
 }
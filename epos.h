@@ -35,6 +35,159 @@ typedef enum Profile_s{
 }Profile_t;
 
 
+/* EPOS states as returned by checkEPOSstate(), firmware spec 8.1.1 */
+#define EPOS_BADSTATE       -2 ///< statusword of no state
+#define EPOS_NOSTATE        -1 ///< no statusword seen yet
+#define EPOS_START           0
+#define EPOS_NOTREADY        1 ///< not ready to switch on
+#define EPOS_SWITCHONDIS     2 ///< switch on disabled
+#define EPOS_READY           3 ///< ready to switch on
+#define EPOS_SWITCHEDON      4
+#define EPOS_REFRESH         5
+#define EPOS_MEASUREINIT     6
+#define EPOS_OPENABLE        7 ///< operation enable
+#define EPOS_QUICKSTOP       8 ///< quick stop active
+#define EPOS_FAULTREACTDIS   9 ///< fault reaction active (disabled)
+#define EPOS_FAULTREACTEN   10 ///< fault reaction active (enabled)
+#define EPOS_FAULT          11
+
+/* EPOS device error codes (EMCY error code, object 0x1003), firmware
+   spec 6.2; the high nibble is the error class */
+#define EP_NOERR 0x0000
+#define EP_GENERR 0x1000
+#define EP_OCERR 0x2310
+#define EP_OVERR 0x3210
+#define EP_UVERR 0x3220
+#define EP_OTERR 0x4210
+#define EP_SUPVOLLOW 0x5113
+#define EP_OUTVOLLOW 0x5114
+#define EP_INTSOFT 0x6100
+#define EP_SOFTPAR 0x6320
+#define EP_POSSENS 0x7320
+#define EP_OBJLOST 0x8110
+#define EP_CANOVRUN 0x8111
+#define EP_CANPASS 0x8120
+#define EP_HEARTBEAT 0x8130
+
+/*! \brief number of EMCY messages kept per node, must be a power of 2 */
+#define EPOS_EMCY_HISTORY  8
+
+/*! \brief one EMCY message, CiA301 7.2.7 */
+typedef struct eposEmcy_s {
+  uint16_t Code;       ///< error code, EP_* (EP_NOERR: errors were reset)
+  uint8_t Register;    ///< error register, object 0x1001
+  uint8_t Data[5];     ///< manufacturer specific bytes
+  uint32_t Tick;       ///< HAL_GetTick() when it was received
+} eposEmcy_t;
+
+/* NMT states as sent in heartbeat frames, CiA301 7.2.8.3.2 */
+#define EPOS_NMT_BOOTUP       0x00
+#define EPOS_NMT_STOPPED      0x04
+#define EPOS_NMT_OPERATIONAL  0x05
+#define EPOS_NMT_PREOP        0x7F
+#define EPOS_NMT_UNKNOWN      0xFF ///< no heartbeat seen yet
+
+/*! \brief entries of the error history (0x1003) kept by
+   readEPOSErrorHistory(), EPOS2 stores up to 5 */
+#define EPOS_ERRHIST_DEPTH  5
+
+/*! \brief the error history of one node, newest entry first */
+typedef struct eposErrHist_s {
+  int8_t Result;       ///< 0: read, -1: no answer or SDO abort
+  uint8_t Count;       ///< entries in Rec
+  struct {
+    uint16_t Code;     ///< device error code, EP_*
+    uint16_t Info;     ///< manufacturer specific additional information
+  } Rec[EPOS_ERRHIST_DEPTH];
+} eposErrHist_t;
+
+/*! \brief number of channels of the EPOS2 data recorder */
+#define EPOS_REC_CHANNELS  4
+
+/* data recorder trigger conditions, eposRecorder_t.Trigger */
+#define EPOS_REC_TRIG_MOVESTART  0x0001 ///< start of a movement
+#define EPOS_REC_TRIG_ERROR      0x0002 ///< device error
+#define EPOS_REC_TRIG_DIGIN      0x0004 ///< digital input
+#define EPOS_REC_TRIG_MOVEEND    0x0008 ///< end of a movement
+
+/* data recorder status bits, see pollEPOSRecorder() */
+#define EPOS_REC_RUNNING    0x0001 ///< recording, the trigger is enabled
+#define EPOS_REC_TRIGGERED  0x0002 ///< the trigger came
+#define EPOS_REC_AVAILABLE  0x0004 ///< stopped, the samples can be uploaded
+
+/*! \brief one object sampled by the data recorder */
+typedef struct eposRecChannel_s {
+  WORD Index;
+  BYTE SubIndex;
+  uint8_t Size;        ///< size of the object: 1, 2 or 4 bytes
+  bool Signed;         ///< sign extend the samples
+} eposRecChannel_t;
+
+/*! \brief data recorder configuration, see configEPOSRecorder() */
+typedef struct eposRecorder_s {
+  uint8_t NumChannels; ///< 1 .. EPOS_REC_CHANNELS
+  eposRecChannel_t Channel[EPOS_REC_CHANNELS];
+  uint16_t Period;     ///< sampling period in 0.1 ms
+  uint16_t PreTrigger; ///< samples kept from before the trigger
+  uint16_t Trigger;    ///< EPOS_REC_TRIG_*
+} eposRecorder_t;
+
+/*! \brief number of bins of the SDO round trip time histogram */
+#define EPOS_HIST_BINS  16
+
+/*! \brief counters of one EPOS, see getEPOSStats() */
+typedef struct eposStats_s {
+  uint32_t TxFrames[16];   ///< frames sent, by function code (COB-ID >> 7)
+  uint32_t RxFrames[16];   ///< frames received, by function code (COB-ID >> 7)
+  uint32_t TxStalls;       ///< frames the CAN controller refused or did not send in time
+  uint32_t SDOCount;       ///< SDO transfers answered
+  uint32_t SDOTimeouts;    ///< SDO requests without answer
+  uint32_t SDOAborts;      ///< SDO transfers aborted by EPOS
+  uint32_t SDORetries;     ///< SDO requests sent again after a timeout
+  uint32_t SDOMinUs;       ///< shortest SDO round trip [us]
+  uint32_t SDOMaxUs;       ///< longest SDO round trip [us]
+  uint64_t SDOSumUs;       ///< sum of all SDO round trips [us]
+  /*! SDO round trips, bin k counts 2^k <= t < 2^(k+1) us (bin 0 also t < 1,
+     the last bin everything above) */
+  uint32_t SDOHist[EPOS_HIST_BINS];
+} eposStats_t;
+
+/*! \brief counters of the CAN bus, see getEPOSBusStats() */
+typedef struct eposBusStats_s {
+  uint32_t TxFrames;       ///< frames sent by the driver
+  uint32_t RxFrames;       ///< frames received
+  uint32_t RxOverflows;    ///< frames lost because CANMsgBuf was full
+  uint32_t RxUnknown;      ///< frames no opened EPOS was addressed by
+  uint64_t Bits;           ///< bits on the bus, without stuff bits
+  uint64_t StuffBits;      ///< worst case number of stuff bits
+  uint32_t Time;           ///< ms the counters ran
+  uint16_t Load;           ///< bus load estimate in 0.1%, nominal stuffing
+  uint16_t LoadMax;        ///< bound of the load in 0.1%, worst case stuffing
+} eposBusStats_t;
+
+/*! \brief a CAN interface under the driver, see setEPOSTransport()
+
+The default is the bxCAN of the STM32 through the HAL, with the frames
+received in HAL_CAN_RxCpltCallback(). Backends without a receive
+interrupt, like SocketCAN on Linux (linux/epos_socketcan.h), hand the
+frames to receiveEPOSFrame() from Poll, which the HAL port of such a
+system calls whenever the driver waits. A transport can also wrap
+another one, like the fault injection of epos_fault.h. */
+typedef struct eposTransport_s {
+  const char *Name;
+  /*! send one frame: 1 done, 0 not sent within EPOS_TX_TIMEOUT, -1 error */
+  int (*Send)(void *ctx, CAN_HandleTypeDef *dev, const CanTxMsgTypeDef *msg);
+  /*! deliver received frames, NULL if an interrupt does it */
+  int (*Poll)(void *ctx);
+  /*! receive only what the nodes with bit n % 8 of nodes[n / 8] set
+     send, NULL if the backend does not filter */
+  int (*Filter)(void *ctx, const uint8_t nodes[16]);
+  /*! look at a received frame before the driver does: 1 to go on, 0 if
+     the transport dealt with it; NULL lets every frame through */
+  int (*Receive)(void *ctx, const CanRxMsgTypeDef *msg, uint32_t stamp);
+  void *Ctx;
+} eposTransport_t;
+
 typedef struct epos_s {
   CAN_HandleTypeDef *dev;
   uint8_t Node_ID;
@@ -57,9 +210,58 @@ typedef struct epos_s {
   int32_t RxPosition;
   int32_t TxVelocity;
   int32_t RxVelocity;
+  int16_t RxCurrent;   ///< current actual value [mA], from TPDO2 if it carries it
   uint32_t E_error;    ///< EPOS global error status
+  uint32_t OpTime;     ///< ms from bringUpEPOS() start to 'operation enable'
+  WORD Statusword;     ///< last statusword seen, from SDO or TPDO
+  int8_t State;        ///< state decoded from Statusword, EPOS_NOSTATE at start
+  uint32_t StateTick;  ///< HAL_GetTick() when State was entered
+  uint16_t StatusCount; ///< incremented with every statusword seen
+  uint32_t StopTime;   ///< ms from triggerEPOSQuickStop() to 'quick stop active'
+  uint32_t SDOStart;   ///< EPOS_CYCLES() when the pending SDO request was sent
+  eposStats_t Stats;   ///< counters, read them with getEPOSStats()
+  eposEmcy_t Emcy[EPOS_EMCY_HISTORY]; ///< last EMCY messages, see getEPOSEmcy()
+  uint32_t EmcyCount;  ///< EMCY messages received since openEPOS()
+  uint8_t NMTState;    ///< EPOS_NMT_* from the last heartbeat
+  bool Lost;           ///< no heartbeat within HBDeadline
+  uint16_t HBDeadline; ///< ms without heartbeat until the node is lost, 0: not watched
+  uint32_t HBTick;     ///< HAL_GetTick() of the last heartbeat
+  uint32_t RxStamp;    ///< receive time of the last frame of the node [us], getEPOSTimeUs()
 } epos_t;
 
+/*! \brief CiA402 device control commands, firmware spec 8.1.3 */
+typedef enum eposCommand_s {
+  EPOS_CMD_SHUTDOWN = 0,
+  EPOS_CMD_SWITCHON,
+  EPOS_CMD_ENABLEOP,        ///< switch on & enable operation
+  EPOS_CMD_DISABLEVOLTAGE,
+  EPOS_CMD_QUICKSTOP,
+  EPOS_CMD_DISABLEOP,
+  EPOS_CMD_FAULTRESET,
+  EPOS_CMD_HALT             ///< stop the axis, stay in 'operation enable'
+} eposCommand;
+
+typedef enum eposEventType_s {
+  EPOS_EV_STATE = 0,  ///< the EPOS state changed
+  EPOS_EV_EMCY,       ///< EPOS sent an EMCY message
+  EPOS_EV_NMT,        ///< the NMT state in the heartbeat changed
+  EPOS_EV_NODELOST    ///< no heartbeat within the deadline
+} eposEventType;
+
+/*! \brief an event queued by the driver and handed to the application by
+   dispatchEPOSEvents() */
+typedef struct eposEvent_s {
+  eposEventType type;
+  epos_t *epos;
+  uint32_t tick;       ///< HAL_GetTick() when the event happened
+  int8_t from;         ///< EPOS_EV_STATE: state left, EPOS_EV_NMT: NMT state left (-1: unknown)
+  int8_t to;           ///< EPOS_EV_STATE: state entered, EPOS_EV_NMT: NMT state entered
+  WORD statusword;     ///< EPOS_EV_STATE: the statusword that caused it
+  eposEmcy_t emcy;     ///< EPOS_EV_EMCY: the message
+} eposEvent_t;
+
+typedef void (*eposEventCallback)(const eposEvent_t *event);
+
 
 typedef enum eposGPIO_s{
   PurposeA = 0x80,
@@ -80,6 +282,54 @@ typedef enum eposGPIO_s{
 //#define TRYSLEEP  (unsigned int)1e5 
 #define TRYSLEEP  (unsigned int)1e4 
 
+/*! \brief give up waiting for a CAN transmission after EPOS_TX_TIMEOUT ms */
+#define EPOS_TX_TIMEOUT  10
+
+/*! \brief give up waiting for an SDO answer after EPOS_SDO_TIMEOUT ms,
+   the request is sent up to NTRY times */
+#define EPOS_SDO_TIMEOUT  100
+
+/*! \brief bits that can be stuffed per stuff bit, for the nominal bus
+   load of getEPOSBusStats() */
+#define EPOS_STUFF_NOMINAL  10
+
+/*! \brief cycle counter used to time SDO transfers and for profiling. The
+   DWT counter is started by openEPOS() with EPOS_CYCLES_INIT(). Host
+   builds count ns with eposHostCycles() of their HAL port: the virtual
+   time of host/, so that all stamps have one timebase, CLOCK_MONOTONIC
+   in linux/. */
+#ifndef EPOS_CYCLES
+#ifdef EPOS_HOST
+uint32_t eposHostCycles(void);
+#define EPOS_CYCLES()       eposHostCycles()
+#define EPOS_CYCLES_PER_US  1000
+#define EPOS_CYCLES_INIT()
+#else
+#define EPOS_CYCLES()       (DWT->CYCCNT)
+#define EPOS_CYCLES_PER_US  (SystemCoreClock / 1000000)
+#define EPOS_CYCLES_INIT()  do {                         \
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;     \
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;                \
+  } while (0)
+#endif
+#endif
+
+/*! \brief OpTime of a node that did not reach 'operation enable' */
+#define EPOS_NOT_OPERATIONAL  0xFFFFFFFF
+
+/*! \brief StopTime of a node that did not confirm the quick stop (yet) */
+#define EPOS_NOT_STOPPED  0xFFFFFFFF
+
+/*! \brief max. number of nodes armEPOSQuickStop() keeps frames for */
+#define EPOS_QUICKSTOP_NODES  32
+
+/*! \brief ms the axes have to confirm a quick stop, see checkEPOSQuickStop() */
+#define EPOS_QUICKSTOP_TIMEOUT  500
+
+/*! \brief number of events buffered until dispatchEPOSEvents() is called,
+   must be a power of 2 */
+#define EPOS_EVENT_QUEUE  32
+
 
 /* all high-level functions return <0 in case of error */
 
@@ -100,18 +350,80 @@ int startPDO(epos_t *epos);
 
 int stopPDO(epos_t *epos);
 
+/*! \brief start all nodes with one NMT broadcast and bring them to
+   'operation enable' in parallel, see bringUpEPOS() in epos.c */
+int bringUpEPOS(epos_t **epos, uint8_t num, uint32_t timeout);
+
+/*! \brief read (and clear) the error history of all nodes in one
+   pipelined pass */
+int readEPOSErrorHistory(epos_t **epos, uint8_t num, eposErrHist_t *hist,
+                         bool clear, uint32_t *time);
+
+/*! \brief set up channels, trigger and sampling period of the data recorder */
+int configEPOSRecorder(epos_t *epos, const eposRecorder_t *rec);
+/*! \brief start the data recorder */
+int armEPOSRecorder(epos_t *epos);
+/*! \brief trigger the data recorder by hand */
+int triggerEPOSRecorder(epos_t *epos);
+/*! \brief 1 if the data recorder has finished */
+int pollEPOSRecorder(epos_t *epos, WORD *status);
+/*! \brief upload and decode the samples of the data recorder */
+int uploadEPOSRecorder(epos_t *epos, const eposRecorder_t *rec,
+                       int32_t *data[], uint16_t max);
+
 int PDOShutDown(epos_t *epos);
 
 int PDOSwitchOn(epos_t *epos);
 
 int PDOEnableOp(epos_t *epos);
 
+/*! \brief send a device control command through RPDO1 and wait until the
+   TPDO statusword shows its effect */
+int PDOControl(epos_t *epos, eposCommand cmd, uint32_t timeout);
+int PDOFaultReset(epos_t *epos, uint32_t timeout);
+int PDOQuickStop(epos_t *epos, uint32_t timeout);
+int PDOHalt(epos_t *epos, uint32_t timeout);
+int PDODisableVoltage(epos_t *epos, uint32_t timeout);
+int PDODisableOp(epos_t *epos, uint32_t timeout);
+
+/*! \brief prepare the quick stop frames for triggerEPOSQuickStop() */
+int armEPOSQuickStop(epos_t **epos, uint8_t num);
+/*! \brief stop all armed axes at once, may be called from an interrupt */
+int triggerEPOSQuickStop(void);
+/*! \brief check if all armed axes confirmed the quick stop */
+int checkEPOSQuickStop(uint32_t *time);
+/*! \brief end a quick stop not all axes confirmed */
+int cancelEPOSQuickStop(void);
+
 int PDOSwitchProfile(epos_t *epos, Profile_t profile);
 int PDOSetVelocity(epos_t *epos, int32_t velocity);
 int PDOSetPosition(epos_t *epos, int32_t position);
 int PDOSetRelativePosition(epos_t *epos, int32_t position_r);
 
 int processCANMsg(epos_t **epos, uint8_t num);
+
+/*! \brief use another CAN interface, NULL for the bxCAN through the HAL */
+int setEPOSTransport(const eposTransport_t *transport);
+/*! \brief the CAN interface in use */
+const eposTransport_t *getEPOSTransport(void);
+/*! \brief let the transport deliver what it received, see eposTransport_t */
+int pollEPOSTransport(void);
+/*! \brief the time in us, EPOS_CYCLES() extended so that it wraps only
+   after 2^32 us */
+uint32_t getEPOSTimeUs(void);
+/*! \brief hand a received frame to the driver, 'stamp' in us of getEPOSTimeUs() */
+void receiveEPOSFrame(const CanRxMsgTypeDef *msg, uint32_t stamp);
+
+/*! \brief copy the counters of EPOS */
+int getEPOSStats(epos_t *epos, eposStats_t *stats);
+/*! \brief clear the counters of EPOS */
+int resetEPOSStats(epos_t *epos);
+/*! \brief copy the counters of the bus and estimate the bus load */
+int getEPOSBusStats(eposBusStats_t *stats);
+/*! \brief clear the bus counters */
+void resetEPOSBusStats(void);
+/*! \brief set the CAN bitrate the bus load is estimated for, default 1 Mbit/s */
+void setEPOSBitrate(uint32_t bitrate);
 int processPDOMessage(epos_t **epos, uint8_t num);
 
 
@@ -120,11 +432,35 @@ int checkEPOSerror(epos_t *epos);
 
 /*! \brief check EPOS status, return state according to firmware spec 8.1.1 */
 int checkEPOSstate(epos_t *epos);
+/*! \brief the EPOS state of a statusword, no I/O, constant time */
+int decodeEPOSstate(WORD w);
 /*! \brief pretty-print EPOS state */
 int printEPOSstate(epos_t *epos);
 /*! \brief change EPOS state   ==> firmware spec 8.1.3 */
 int changeEPOSstate(epos_t *epos, int state);
 
+/*! \brief track the state of EPOS from a statusword it sent, queue an
+   event if the state changed */
+int observeEPOSstatus(epos_t *epos, WORD statusword);
+/*! \brief set the function dispatchEPOSEvents() hands the events to */
+void setEPOSEventCallback(eposEventCallback cb);
+/*! \brief hand all queued events to the event callback, call this from
+   the main loop, not from an interrupt */
+int dispatchEPOSEvents(void);
+
+/*! \brief copy the last EMCY messages of EPOS, newest first */
+int getEPOSEmcy(epos_t *epos, eposEmcy_t *emcy, int max);
+/*! \brief forget the EMCY messages of EPOS */
+int clearEPOSEmcy(epos_t *epos);
+/*! \brief describe an EPOS device error code */
+const char *EPOSErrorText(uint16_t code);
+
+/*! \brief let EPOS send heartbeats and watch them */
+int setEPOSHeartbeat(epos_t *epos, uint16_t period, uint16_t deadline);
+/*! \brief declare nodes lost whose heartbeat is overdue, call this
+   periodically */
+int checkEPOSHeartbeat(epos_t **epos, uint8_t num);
+
 int checkTarget(epos_t *epos);
 
 /*! \brief example from EPOS com. guide: ask EPOS for software version 
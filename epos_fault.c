@@ -0,0 +1,410 @@
+/*! \file epos_fault.c
+
+\brief fault injection between the driver and its transport
+
+See epos_fault.h. Frames the driver sends go through Send, frames the
+transport received through the Receive hook of receiveEPOSFrame(). A
+frame that is changed, duplicated or handed on later goes to the inner
+transport, or back into receiveEPOSFrame() with 'releasing' set, so the
+hook lets it through. Held frames wait in a small table until their
+time has come, or, when reordered, until a later frame of the same
+direction was handed on.
+
+*/
+
+#include <string.h>
+#include "epos.h"
+#include "epos_fault.h"
+
+static int fiSend(void *ctx, CAN_HandleTypeDef *dev, const CanTxMsgTypeDef *msg);
+static int fiPoll(void *ctx);
+static int fiFilter(void *ctx, const uint8_t nodes[16]);
+static int fiReceive(void *ctx, const CanRxMsgTypeDef *msg, uint32_t stamp);
+
+static eposTransport_t faultTransport = { "fault", fiSend, fiPoll, fiFilter, fiReceive, NULL };
+
+/* a frame held back */
+typedef struct {
+    bool used;
+    uint8_t dir;            ///< EPOS_FAULT_TX or EPOS_FAULT_RX
+    bool reorder;           ///< also goes when a later frame went
+    uint32_t due;           ///< clock() when it goes at the latest
+    uint32_t seq;           ///< frames of its direction handed on before it
+    CAN_HandleTypeDef *dev;
+    CanTxMsgTypeDef tx;
+    CanRxMsgTypeDef rx;
+    uint32_t stamp;
+} held_t;
+
+static struct {
+    const eposTransport_t *inner;
+    uint32_t (*clock)(void);
+    eposFaultRule_t rule[EPOS_FAULT_RULES];
+    uint32_t seen[EPOS_FAULT_RULES];   ///< matching frames so far
+    int rules;
+    eposFaultRandom_t random;
+    bool randomOn;
+    uint32_t rnd;
+    held_t held[EPOS_FAULT_HELD];
+    uint32_t passed[2];                ///< frames handed on, TX and RX
+    bool busOff;
+    uint32_t busOffEnd;
+    bool inSend;                       ///< in the inner Send
+    bool releasing;                    ///< in receiveEPOSFrame() of our own
+    eposFaultStats_t stats;
+} fi;
+
+
+/* xorshift32, the same sequence for the same seed on every system */
+static uint32_t rnd(void) {
+    fi.rnd ^= fi.rnd << 13;
+    fi.rnd ^= fi.rnd >> 17;
+    fi.rnd ^= fi.rnd << 5;
+    return fi.rnd;
+}
+
+static bool due(uint32_t t) {
+    return (int32_t)(fi.clock() - t) >= 0;
+}
+
+static bool checkBusOff(void) {
+    if (fi.busOff && due(fi.busOffEnd)) fi.busOff = false;
+    return fi.busOff;
+}
+
+/* what to do with a frame: the first rule that acts, else the policy */
+static eposFaultAction_t decide(uint8_t dir, uint32_t StdId, uint32_t *param) {
+    eposFaultRandom_t *p = &fi.random;
+    eposFaultAction_t a;
+    uint32_t r, sum = 0;
+    int i;
+
+    for (i = 0; i < fi.rules; i++) {
+        eposFaultRule_t *rl = &fi.rule[i];
+
+        if (!(rl->Dir & dir) || (StdId & rl->Mask) != rl->COBId) continue;
+        if (++fi.seen[i] <= rl->Skip) continue;
+        if (rl->Count && fi.seen[i] > rl->Skip + rl->Count) continue;
+        *param = rl->Param;
+        return rl->Action;
+    }
+
+    if (!fi.randomOn || !(p->Dir & dir) || (StdId & p->Mask) != p->COBId)
+        return EPOS_FAULT_PASS;
+    r = rnd() % 1000;
+    for (a = EPOS_FAULT_DROP; a < EPOS_FAULT_ACTIONS; a++) {
+        sum += p->Rate[a];
+        if (r >= sum) continue;
+        switch (a) {
+        case EPOS_FAULT_DELAY:
+            *param = p->DelayUs ? 1 + rnd() % p->DelayUs : 0;
+            break;
+        case EPOS_FAULT_CORRUPT:
+            *param = (rnd() & 7) | ((1 + rnd() % 255) << 8);
+            break;
+        case EPOS_FAULT_ABORT:
+            *param = p->AbortCode;
+            break;
+        case EPOS_FAULT_BUSOFF:
+            *param = p->BusOffUs;
+            break;
+        default:
+            *param = 0;
+            break;
+        }
+        return a;
+    }
+    return EPOS_FAULT_PASS;
+}
+
+static void corrupt(uint8_t *data, uint32_t param) {
+    uint8_t mask = (param >> 8) & 0xFF;
+
+    data[param & 7] ^= mask ? mask : 0xFF;
+}
+
+/* an SDO answer becomes an abort of the same object */
+static void abortAnswer(CanRxMsgTypeDef *msg, uint32_t code) {
+    msg->DLC = 8;
+    msg->Data[0] = 0x80;
+    msg->Data[4] = code & 0xFF;
+    msg->Data[5] = (code >> 8) & 0xFF;
+    msg->Data[6] = (code >> 16) & 0xFF;
+    msg->Data[7] = code >> 24;
+}
+
+static void startBusOff(uint32_t us) {
+    fi.busOff = true;
+    fi.busOffEnd = fi.clock() + us;
+}
+
+static int hold(uint8_t dir, bool reorder, uint32_t us, CAN_HandleTypeDef *dev,
+                const CanTxMsgTypeDef *tx, const CanRxMsgTypeDef *rx, uint32_t stamp) {
+    uint32_t n = 0;
+    int i, free = -1;
+
+    for (i = 0; i < EPOS_FAULT_HELD; i++) {
+        if (fi.held[i].used) n++;
+        else if (free < 0) free = i;
+    }
+    if (free < 0) {
+        fi.stats.Overflows++;
+        return -1;
+    }
+    fi.held[free].used = true;
+    fi.held[free].dir = dir;
+    fi.held[free].reorder = reorder;
+    fi.held[free].due = fi.clock() + us;
+    fi.held[free].seq = fi.passed[dir == EPOS_FAULT_RX];
+    fi.held[free].dev = dev;
+    if (tx) fi.held[free].tx = *tx;
+    if (rx) fi.held[free].rx = *rx;
+    fi.held[free].stamp = stamp;
+    if (n + 1 > fi.stats.HeldMax) fi.stats.HeldMax = n + 1;
+    return 0;
+}
+
+static bool waiting(uint8_t dir) {
+    int i;
+
+    for (i = 0; i < EPOS_FAULT_HELD; i++)
+        if (fi.held[i].used && fi.held[i].dir == dir) return true;
+    return false;
+}
+
+static int txOut(CAN_HandleTypeDef *dev, const CanTxMsgTypeDef *msg) {
+    int n;
+
+    fi.inSend = true;
+    n = fi.inner->Send(fi.inner->Ctx, dev, msg);
+    fi.inSend = false;
+    return n;
+}
+
+/* into the driver as if the transport had received it just now */
+static void rxOut(const CanRxMsgTypeDef *msg, uint32_t stamp) {
+    fi.releasing = true;
+    receiveEPOSFrame(msg, stamp);
+    fi.releasing = false;
+}
+
+/* hand on the held frames of 'dir' that are due; RX frames outside of
+   the receive path with the interrupts masked, like the ISR */
+static int release(uint8_t dir) {
+    uint32_t primask;
+    int i, n = 0;
+
+    for (i = 0; i < EPOS_FAULT_HELD; i++) {
+        held_t *h = &fi.held[i];
+
+        if (!h->used || h->dir != dir) continue;
+        if (!(h->reorder && fi.passed[dir == EPOS_FAULT_RX] > h->seq) && !due(h->due)) continue;
+        h->used = false;
+        if (checkBusOff()) {
+            fi.stats.BusOffLost++;
+            continue;
+        }
+        if (dir == EPOS_FAULT_TX) {
+            txOut(h->dev, &h->tx);
+        } else {
+            primask = __get_PRIMASK();
+            __disable_irq();
+            rxOut(&h->rx, h->stamp);
+            if (!primask) __enable_irq();
+        }
+        n++;
+    }
+    return n;
+}
+
+
+static int fiSend(void *ctx, CAN_HandleTypeDef *dev, const CanTxMsgTypeDef *msg) {
+    eposFaultAction_t a;
+    CanTxMsgTypeDef copy;
+    uint32_t param = 0;
+    int n = 1;
+
+    (void)ctx;
+    fi.stats.TxFrames++;
+    if (checkBusOff()) {
+        fi.stats.BusOffLost++;
+        return -1;
+    }
+
+    a = decide(EPOS_FAULT_TX, msg->StdId, &param);
+    switch (a) {
+    case EPOS_FAULT_DROP:
+        break;
+    case EPOS_FAULT_DELAY:
+    case EPOS_FAULT_REORDER:
+        if (a == EPOS_FAULT_REORDER && !param) param = EPOS_FAULT_REORDER_US;
+        if (hold(EPOS_FAULT_TX, a == EPOS_FAULT_REORDER, param, dev, msg, NULL, 0) < 0) {
+            a = EPOS_FAULT_PASS;
+            n = txOut(dev, msg);
+        }
+        break;
+    case EPOS_FAULT_DUPLICATE:
+        if ((n = txOut(dev, msg)) > 0) n = txOut(dev, msg);
+        break;
+    case EPOS_FAULT_CORRUPT:
+        copy = *msg;
+        corrupt(copy.Data, param);
+        n = txOut(dev, &copy);
+        break;
+    case EPOS_FAULT_BUSOFF:
+        startBusOff(param);
+        n = -1;
+        break;
+    default:                    // EPOS_FAULT_ABORT only acts on answers
+        a = EPOS_FAULT_PASS;
+        n = txOut(dev, msg);
+        break;
+    }
+    fi.stats.Faults[a]++;
+    if (a != EPOS_FAULT_REORDER) {
+        fi.passed[0]++;
+        release(EPOS_FAULT_TX);
+    }
+    return n;
+}
+
+static int fiPoll(void *ctx) {
+    int n = 0;
+
+    (void)ctx;
+    if (fi.inner->Poll) n = fi.inner->Poll(fi.inner->Ctx);
+    if (n < 0) return n;
+    if (!fi.inSend) release(EPOS_FAULT_TX);
+    return n + release(EPOS_FAULT_RX);
+}
+
+static int fiFilter(void *ctx, const uint8_t nodes[16]) {
+    (void)ctx;
+    return fi.inner->Filter ? fi.inner->Filter(fi.inner->Ctx, nodes) : 0;
+}
+
+/* 1: the driver takes the frame as it is, 0: it was dealt with here */
+static int fiReceive(void *ctx, const CanRxMsgTypeDef *msg, uint32_t stamp) {
+    eposFaultAction_t a;
+    CanRxMsgTypeDef copy;
+    uint32_t param = 0;
+    int take = 0;
+
+    (void)ctx;
+    if (fi.releasing) return 1;
+    if (fi.inner->Receive && !fi.inner->Receive(fi.inner->Ctx, msg, stamp)) return 0;
+    fi.stats.RxFrames++;
+    if (checkBusOff()) {
+        fi.stats.BusOffLost++;
+        return 0;
+    }
+
+    a = decide(EPOS_FAULT_RX, msg->StdId, &param);
+    switch (a) {
+    case EPOS_FAULT_DROP:
+        break;
+    case EPOS_FAULT_DELAY:
+    case EPOS_FAULT_REORDER:
+        if (a == EPOS_FAULT_REORDER && !param) param = EPOS_FAULT_REORDER_US;
+        if (hold(EPOS_FAULT_RX, a == EPOS_FAULT_REORDER, param, NULL, NULL, msg, stamp) < 0) {
+            a = EPOS_FAULT_PASS;
+            take = 1;
+        }
+        break;
+    case EPOS_FAULT_DUPLICATE:
+        rxOut(msg, stamp);
+        take = 1;
+        break;
+    case EPOS_FAULT_CORRUPT:
+        copy = *msg;
+        corrupt(copy.Data, param);
+        rxOut(&copy, stamp);
+        break;
+    case EPOS_FAULT_ABORT:
+        if ((msg->StdId & 0x780) == 0x580) {
+            copy = *msg;
+            abortAnswer(&copy, param);
+            rxOut(&copy, stamp);
+        } else {
+            a = EPOS_FAULT_PASS;
+            take = 1;
+        }
+        break;
+    case EPOS_FAULT_BUSOFF:
+        startBusOff(param);
+        break;
+    default:
+        take = 1;
+        break;
+    }
+    fi.stats.Faults[a]++;
+    if (a == EPOS_FAULT_REORDER) return 0;
+
+    // frames reordered behind this one go after it
+    fi.passed[1]++;
+    if (!waiting(EPOS_FAULT_RX)) return take;
+    if (take) rxOut(msg, stamp);
+    release(EPOS_FAULT_RX);
+    return 0;
+}
+
+
+/*! wrap a transport
+
+\param inner the transport the frames go to, NULL for the one in use
+\param clock time in us, NULL for getEPOSTimeUs(); host builds with
+virtual time pass theirs here
+
+\return the fault transport for setEPOSTransport()
+*/
+const eposTransport_t *openEPOSFault(const eposTransport_t *inner, uint32_t (*clock)(void)) {
+    if (!inner) inner = getEPOSTransport();
+    if (inner == &faultTransport) inner = fi.inner;
+    memset(&fi, 0, sizeof(fi));
+    fi.inner = inner;
+    fi.clock = clock ? clock : getEPOSTimeUs;
+    fi.rnd = 1;
+    return &faultTransport;
+}
+
+void closeEPOSFault(void) {
+    int i;
+
+    if (!fi.inner) return;
+    clearEPOSFaults();
+    for (i = 0; i < EPOS_FAULT_HELD; i++) fi.held[i].due = fi.clock();
+    release(EPOS_FAULT_TX);
+    release(EPOS_FAULT_RX);
+    if (getEPOSTransport() == &faultTransport) setEPOSTransport(fi.inner);
+}
+
+int addEPOSFaultRule(const eposFaultRule_t *rule) {
+    if (!rule || fi.rules >= EPOS_FAULT_RULES || rule->Action >= EPOS_FAULT_ACTIONS) return -1;
+    fi.rule[fi.rules] = *rule;
+    fi.seen[fi.rules] = 0;
+    fi.rules++;
+    return 0;
+}
+
+void setEPOSFaultRandom(const eposFaultRandom_t *policy) {
+    fi.randomOn = policy != NULL;
+    if (!policy) return;
+    fi.random = *policy;
+    fi.rnd = policy->Seed ? policy->Seed : 1;
+}
+
+void clearEPOSFaults(void) {
+    fi.rules = 0;
+    fi.randomOn = false;
+    fi.busOff = false;
+}
+
+bool isEPOSFaultBusOff(void) {
+    return fi.inner && checkBusOff();
+}
+
+int getEPOSFaultStats(eposFaultStats_t *stats) {
+    if (!stats) return -1;
+    *stats = fi.stats;
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*! \file epos_fault.h
+
+  fault injection between libEPOS and its CAN transport
+
+  A transport that wraps the one in use and drops, delays, duplicates,
+  reorders or corrupts frames in either direction, replaces SDO answers
+  by aborts and goes bus-off for a while. What happens to which frame
+  is scripted by rules, or drawn from a seeded random policy, so a run
+  can be repeated exactly:
+
+    setEPOSTransport(openEPOSFault(NULL, clockUs));
+    eposFaultRule_t r = { EPOS_FAULT_RX, 0x581, 0x7FF, 0, 1, EPOS_FAULT_DROP, 0 };
+    addEPOSFaultRule(&r);   // the next SDO answer of node 1 is lost
+
+  Delayed and reordered frames are held back and handed on by Poll, so
+  the system has to call pollEPOSTransport() while the driver waits; the
+  HAL ports of the host build and of Linux do it in HAL_GetTick().
+
+*/
+
+#ifndef _EPOS_FAULT_H
+#define _EPOS_FAULT_H
+
+#include "epos.h"
+
+/*! \brief scripted rules at most */
+#define EPOS_FAULT_RULES  16
+/*! \brief frames held back for a delay or a reorder at most; when full,
+   frames are passed on at once */
+#define EPOS_FAULT_HELD   32
+/*! \brief us a reordered frame waits for a successor at most, when the
+   rule gives no Param */
+#define EPOS_FAULT_REORDER_US  10000
+
+/* directions, eposFaultRule_t.Dir */
+#define EPOS_FAULT_TX  0x01   ///< frames the driver sends
+#define EPOS_FAULT_RX  0x02   ///< frames the driver receives
+
+typedef enum {
+  EPOS_FAULT_PASS = 0,  ///< nothing happens, the rule only counts
+  EPOS_FAULT_DROP,      ///< the frame is lost
+  EPOS_FAULT_DELAY,     ///< handed on Param us later
+  EPOS_FAULT_DUPLICATE, ///< handed on twice
+  EPOS_FAULT_REORDER,   ///< handed on after the next frame of its direction
+  EPOS_FAULT_CORRUPT,   ///< data byte Param & 7 xor (Param >> 8), 0xFF if 0
+  EPOS_FAULT_ABORT,     ///< an SDO answer becomes an abort with code Param
+  EPOS_FAULT_BUSOFF,    ///< nothing gets through for Param us, sends fail
+  EPOS_FAULT_ACTIONS
+} eposFaultAction_t;
+
+/*! \brief acts on the frames of direction Dir with (StdId & Mask) ==
+   COBId: lets Skip of them pass, then acts on Count of them, 0 for all.
+   The first rule that acts on a frame wins. */
+typedef struct eposFaultRule_s {
+  uint8_t Dir;
+  uint16_t COBId;
+  uint16_t Mask;        ///< 0 matches every frame
+  uint32_t Skip;
+  uint32_t Count;
+  eposFaultAction_t Action;
+  uint32_t Param;
+} eposFaultRule_t;
+
+/*! \brief faults drawn for every frame no rule acted on; Rate[action]
+   in 1/1000 of the matching frames, Param as for the rules with
+   random delays of 1..DelayUs and a random byte and bit pattern for
+   EPOS_FAULT_CORRUPT */
+typedef struct eposFaultRandom_s {
+  uint32_t Seed;        ///< 0 is taken as 1
+  uint8_t Dir;
+  uint16_t COBId;
+  uint16_t Mask;
+  uint16_t Rate[EPOS_FAULT_ACTIONS];
+  uint32_t DelayUs;
+  uint32_t AbortCode;
+  uint32_t BusOffUs;
+} eposFaultRandom_t;
+
+/*! \brief counters of the fault layer */
+typedef struct eposFaultStats_s {
+  uint32_t TxFrames;    ///< frames the driver sent
+  uint32_t RxFrames;    ///< frames the transport received
+  uint32_t Faults[EPOS_FAULT_ACTIONS]; ///< frames per action, PASS: untouched
+  uint32_t BusOffLost;  ///< frames lost while bus-off
+  uint32_t HeldMax;     ///< most frames held back at a time
+  uint32_t Overflows;   ///< faults not done because the hold was full
+} eposFaultStats_t;
+
+/*! \brief wrap 'inner', NULL for the transport in use; 'clock' gives us,
+   NULL for getEPOSTimeUs(). Rules, policy and counters are
+   cleared. The transport for setEPOSTransport(). */
+const eposTransport_t *openEPOSFault(const eposTransport_t *inner, uint32_t (*clock)(void));
+/*! \brief hand on what is held back, the driver goes back to the inner
+   transport if it still used this one */
+void closeEPOSFault(void);
+/*! \brief add a scripted rule, -1 when EPOS_FAULT_RULES are in use */
+int addEPOSFaultRule(const eposFaultRule_t *rule);
+/*! \brief set the random policy, NULL to switch it off */
+void setEPOSFaultRandom(const eposFaultRandom_t *policy);
+/*! \brief remove rules and policy, end a bus-off; held frames stay */
+void clearEPOSFaults(void);
+/*! \brief true while bus-off */
+bool isEPOSFaultBusOff(void);
+/*! \brief copy the counters */
+int getEPOSFaultStats(eposFaultStats_t *stats);
+
+#endif
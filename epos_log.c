@@ -0,0 +1,98 @@
+/*! \file epos_log.c
+
+\brief deferred binary logging
+
+SEGGER_RTT_printf() formats on the target, which costs thousands of
+cycles per call and is far too slow for the CAN interrupt. A log site
+here only writes a few bytes: the message ID, a timestamp and the raw
+arguments. The records go to RTT up-channel EPOS_LOG_CHANNEL, or into a
+RAM ring if EPOS_LOG_RAM is defined, and are formatted on the host by
+tools/epos_logdump.
+
+*/
+
+#include <stddef.h>
+#include "SEGGER_RTT.h"
+#include "epos.h"
+#include "epos_log.h"
+
+static uint8_t logBuf[EPOS_LOG_BUFSIZE];
+static uint32_t logDropped = 0;
+
+#ifdef EPOS_LOG_RAM
+static volatile uint32_t logHead = 0;
+static volatile uint32_t logTail = 0;
+#endif
+
+
+int initEPOSLog(void) {
+#ifndef EPOS_LOG_RAM
+    if (SEGGER_RTT_ConfigUpBuffer(EPOS_LOG_CHANNEL, "EPOSLog", logBuf,
+            sizeof(logBuf), SEGGER_RTT_MODE_NO_BLOCK_SKIP) < 0)
+        return (-1);
+#endif
+    logDropped = 0;
+    return (0);
+}
+
+
+void writeEPOSLog(uint16_t id, const uint32_t *arg, uint8_t nargs) {
+    uint8_t rec[8 + 4 * EPOS_LOG_MAXARGS];
+    uint32_t v;
+    unsigned int i, len;
+
+    if (nargs > EPOS_LOG_MAXARGS) nargs = EPOS_LOG_MAXARGS;
+
+    v = HAL_GetTick();
+    rec[0] = id & 0xFF;
+    rec[1] = id >> 8;
+    rec[2] = nargs;
+    rec[3] = EPOS_LOG_SYNC;
+    rec[4] = v & 0xFF;
+    rec[5] = (v >> 8) & 0xFF;
+    rec[6] = (v >> 16) & 0xFF;
+    rec[7] = (v >> 24) & 0xFF;
+    len = 8;
+    for (i = 0; i < nargs; i++) {
+        v = arg[i];
+        rec[len++] = v & 0xFF;
+        rec[len++] = (v >> 8) & 0xFF;
+        rec[len++] = (v >> 16) & 0xFF;
+        rec[len++] = (v >> 24) & 0xFF;
+    }
+
+#ifndef EPOS_LOG_RAM
+    // in skip mode RTT writes the whole record or nothing
+    if (SEGGER_RTT_Write(EPOS_LOG_CHANNEL, rec, len) != len)
+        logDropped++;
+#else
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (sizeof(logBuf) - (logHead - logTail) >= len) {
+        for (i = 0; i < len; i++)
+            logBuf[(logHead + i) % sizeof(logBuf)] = rec[i];
+        logHead += len;
+    } else {
+        logDropped++;
+    }
+    if (!primask) __enable_irq();
+#endif
+}
+
+
+uint32_t EPOSLogDropped(void) {
+    return logDropped;
+}
+
+
+#ifdef EPOS_LOG_RAM
+int readEPOSLog(uint8_t *buf, int len) {
+    int n = 0;
+
+    while (n < len && logTail != logHead) {
+        buf[n++] = logBuf[logTail % sizeof(logBuf)];
+        logTail++;
+    }
+    return (n);
+}
+#endif
@@ -0,0 +1,94 @@
+/*! \file epos_log.h
+
+  deferred binary logging for the time critical parts of libEPOS
+
+*/
+
+#ifndef _EPOS_LOG_H
+#define _EPOS_LOG_H
+
+#include <stdint.h>
+
+/* log levels */
+#define EPOS_LOG_NONE   0
+#define EPOS_LOG_ERROR  1
+#define EPOS_LOG_WARN   2
+#define EPOS_LOG_INFO   3
+#define EPOS_LOG_DEBUG  4
+
+/*! \brief messages above this level are not compiled in */
+#ifndef EPOS_LOG_LEVEL
+#ifdef DEBUG
+#define EPOS_LOG_LEVEL  EPOS_LOG_DEBUG
+#else
+#define EPOS_LOG_LEVEL  EPOS_LOG_WARN
+#endif
+#endif
+
+/*! \brief RTT up-channel the log records are written to */
+#ifndef EPOS_LOG_CHANNEL
+#define EPOS_LOG_CHANNEL  1
+#endif
+/*! \brief size of the RTT buffer, or of the RAM ring if EPOS_LOG_RAM is
+   defined; the ring is indexed modulo its size by free running
+   counters, so it must be a power of 2 */
+#ifndef EPOS_LOG_BUFSIZE
+#define EPOS_LOG_BUFSIZE  1024
+#endif
+#if defined(EPOS_LOG_RAM) && (EPOS_LOG_BUFSIZE & (EPOS_LOG_BUFSIZE - 1)) != 0
+#error "EPOS_LOG_BUFSIZE must be a power of 2 with EPOS_LOG_RAM"
+#endif
+
+/*! \brief max. number of arguments of a log message */
+#define EPOS_LOG_MAXARGS  4
+/*! \brief 4th byte of every record, lets the decoder find the next record
+   after garbage */
+#define EPOS_LOG_SYNC     0xE5
+
+/*
+  a record is (all little endian):
+    uint16_t id; uint8_t nargs; uint8_t sync; uint32_t tick;
+    uint32_t arg[nargs];
+*/
+
+#define EPOS_LOGMSG(name, level, format) EPOS_LOGID_##name,
+enum { 
+#include "epos_logmsg.h"
+  EPOS_LOGID_COUNT
+};
+#undef EPOS_LOGMSG
+#define EPOS_LOGMSG(name, level, format) EPOS_LOGLVL_##name = level,
+enum {
+#include "epos_logmsg.h"
+};
+#undef EPOS_LOGMSG
+
+/*! \brief log message 'name' of epos_logmsg.h with 32bit arguments.
+   Only the message ID and the raw arguments are stored, the formatting
+   is done by the host. Messages above EPOS_LOG_LEVEL cost nothing. */
+#define EPOS_LOG(name, ...) do {                                        \
+    if (EPOS_LOGLVL_##name <= EPOS_LOG_LEVEL) {                         \
+      const uint32_t logarg_[] = { __VA_ARGS__ };                       \
+      writeEPOSLog(EPOS_LOGID_##name, logarg_,                          \
+                   sizeof(logarg_) / sizeof(logarg_[0]));               \
+    }                                                                   \
+  } while (0)
+
+/*! \brief as EPOS_LOG(), for messages without arguments */
+#define EPOS_LOG0(name) do {                                            \
+    if (EPOS_LOGLVL_##name <= EPOS_LOG_LEVEL)                           \
+      writeEPOSLog(EPOS_LOGID_##name, NULL, 0);                         \
+  } while (0)
+
+/*! \brief set up the RTT channel of the log, call once at start-up */
+int initEPOSLog(void);
+/*! \brief store one log record, safe to call from interrupts */
+void writeEPOSLog(uint16_t id, const uint32_t *arg, uint8_t nargs);
+/*! \brief number of records dropped because the buffer was full */
+uint32_t EPOSLogDropped(void);
+#ifdef EPOS_LOG_RAM
+/*! \brief take up to len bytes of records out of the RAM ring */
+int readEPOSLog(uint8_t *buf, int len);
+#endif
+
+#endif
@@ -0,0 +1,32 @@
+/*! \file epos_logmsg.h
+
+  the messages of the deferred log, see epos_log.h
+
+  EPOS_LOGMSG(name, level, format): every message gets an ID from its
+  position in this list, so only append new messages at the end, or
+  old logs are decoded with the wrong format strings. The format is only
+  used by the host decoder (tools/epos_logdump.c), all arguments are
+  32bit integers.
+
+  No include guard, this file is included several times with different
+  definitions of EPOS_LOGMSG.
+
+*/
+
+EPOS_LOGMSG(TX_ERROR,       EPOS_LOG_ERROR, "node %u: Transmit Error!")
+EPOS_LOGMSG(TX_TIMEOUT,     EPOS_LOG_ERROR, "node %u: Transmit Timeout!")
+EPOS_LOGMSG(TX_BLOCKED,     EPOS_LOG_WARN,  "node %u: Transmit blocked by quick stop!")
+EPOS_LOGMSG(TX_FRAME,       EPOS_LOG_DEBUG, ">> Sent Message ID: %04x dlc %u data %08x %08x")
+EPOS_LOGMSG(SDO_ANSWER,     EPOS_LOG_DEBUG, "<< node %u: SDO answer %08x %08x")
+EPOS_LOGMSG(SDO_ABORT,      EPOS_LOG_WARN,  "node %u: SDO abort %08x for object %04x sub %02x")
+EPOS_LOGMSG(RX_FRAME,       EPOS_LOG_DEBUG, "<< Message id: %04x received, dlc %u data %08x %08x")
+EPOS_LOGMSG(RX_UNKNOWN,     EPOS_LOG_WARN,  "Message id: %04x cannot be process!")
+EPOS_LOGMSG(RX_NOEPOS,      EPOS_LOG_ERROR, "EPOS %u not initialized!")
+EPOS_LOGMSG(SENDCOM_FAILED, EPOS_LOG_ERROR, "node %u: sendCom() failed for COB-ID %03x")
+EPOS_LOGMSG(EVENTS_LOST,    EPOS_LOG_WARN,  "%u EPOS events lost!")
+EPOS_LOGMSG(SDO_TIMEOUT,    EPOS_LOG_WARN,  "node %u: no SDO answer within %u ms")
+EPOS_LOGMSG(RX_OVERFLOW,    EPOS_LOG_ERROR, "CANMsgBuf full, Message id: %04x lost!")
+EPOS_LOGMSG(EMCY,           EPOS_LOG_WARN,  "node %u: EMCY %04x, error register %02x")
+EPOS_LOGMSG(NODE_LOST,      EPOS_LOG_ERROR, "node %u: no heartbeat for %u ms, node lost!")
+EPOS_LOGMSG(EMCY_SHORT,     EPOS_LOG_WARN,  "node %u: EMCY with %u bytes ignored")
+EPOS_LOGMSG(HB_EMPTY,       EPOS_LOG_WARN,  "node %u: heartbeat without data ignored")
@@ -0,0 +1,89 @@
+/*! \file epos_prof.c
+
+\brief cycle counting profiling hooks
+
+With EPOS_PROFILE defined, sendCom(), readAnswer(), processCANMsg(),
+processPDOMessage() and HAL_CAN_RxCpltCallback() are timed with
+EPOS_CYCLES(): the DWT cycle counter on Cortex-M, ns from
+eposHostCycles() of the HAL port on host builds. Min, max, mean and a
+log2 histogram are kept per function, so a change that makes the worst
+case slower shows up right away.
+
+*/
+
+#include <string.h>
+#include "SEGGER_RTT.h"
+#include "epos.h"
+#include "epos_prof.h"
+
+static eposProfile_t profile[EPOS_PROF_SITES];
+
+static const char *siteName[EPOS_PROF_SITES] = {
+    "sendCom",
+    "readAnswer",
+    "processCANMsg",
+    "processPDOMessage",
+    "HAL_CAN_RxCpltCallback",
+};
+
+
+void recordEPOSProfile(eposProfSite site, uint32_t cycles) {
+    eposProfile_t *p = &profile[site];
+    uint32_t primask;
+    int bin = 0;
+
+    while ((cycles >> bin) > 1 && bin < EPOS_PROF_BINS - 1) bin++;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    if (p->Count == 0 || cycles < p->Min) p->Min = cycles;
+    if (cycles > p->Max) p->Max = cycles;
+    p->Sum += cycles;
+    p->Count++;
+    p->Hist[bin]++;
+    if (!primask) __enable_irq();
+}
+
+
+int getEPOSProfile(eposProfSite site, eposProfile_t *prof) {
+    uint32_t primask;
+
+    if (site >= EPOS_PROF_SITES || !prof) return -1;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    *prof = profile[site];
+    if (!primask) __enable_irq();
+    return (0);
+}
+
+
+void dumpEPOSProfile(void) {
+    eposProfile_t p;
+    int i, k;
+
+    SEGGER_RTT_printf(0, "\nlibEPOS profile (%u cycles/us):\n", EPOS_CYCLES_PER_US);
+    for (i = 0; i < EPOS_PROF_SITES; i++) {
+        getEPOSProfile(i, &p);
+        if (p.Count == 0) {
+            SEGGER_RTT_printf(0, "%-24s never called\n", siteName[i]);
+            continue;
+        }
+        SEGGER_RTT_printf(0, "%-24s n=%u min=%u mean=%u max=%u\n", siteName[i],
+                p.Count, p.Min, (uint32_t)(p.Sum / p.Count), p.Max);
+        for (k = 0; k < EPOS_PROF_BINS; k++) {
+            if (p.Hist[k])
+                SEGGER_RTT_printf(0, "    >= %10u: %u\n", 1u << k, p.Hist[k]);
+        }
+    }
+}
+
+
+void resetEPOSProfile(void) {
+    uint32_t primask;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    memset(profile, 0, sizeof(profile));
+    if (!primask) __enable_irq();
+}
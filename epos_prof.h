@@ -0,0 +1,52 @@
+/*! \file epos_prof.h
+
+  cycle counting profiling hooks around the hot paths of libEPOS
+
+*/
+
+#ifndef _EPOS_PROF_H
+#define _EPOS_PROF_H
+
+#include <stdint.h>
+
+/* profiled functions */
+typedef enum eposProfSite_s {
+  EPOS_PROF_SENDCOM = 0,
+  EPOS_PROF_READANSWER,
+  EPOS_PROF_PROCESSCANMSG,
+  EPOS_PROF_PROCESSPDO,
+  EPOS_PROF_RXISR,           ///< HAL_CAN_RxCpltCallback()
+  EPOS_PROF_SITES
+} eposProfSite;
+
+/*! \brief number of bins of the histogram, bin k counts 2^k <= t < 2^(k+1) */
+#define EPOS_PROF_BINS  32
+
+/*! \brief timing of one profiled function, in EPOS_CYCLES() units */
+typedef struct eposProfile_s {
+  uint32_t Count;
+  uint32_t Min;
+  uint32_t Max;
+  uint64_t Sum;
+  uint32_t Hist[EPOS_PROF_BINS];
+} eposProfile_t;
+
+/* the hooks cost nothing unless EPOS_PROFILE is defined */
+#ifdef EPOS_PROFILE
+#define EPOS_PROF_BEGIN(site)  uint32_t prof_##site = EPOS_CYCLES()
+#define EPOS_PROF_END(site)    recordEPOSProfile(EPOS_PROF_##site, EPOS_CYCLES() - prof_##site)
+#else
+#define EPOS_PROF_BEGIN(site)
+#define EPOS_PROF_END(site)
+#endif
+
+/*! \brief add one measurement of a profiled function */
+void recordEPOSProfile(eposProfSite site, uint32_t cycles);
+/*! \brief copy the timing of a profiled function */
+int getEPOSProfile(eposProfSite site, eposProfile_t *prof);
+/*! \brief print the timing of all profiled functions through RTT */
+void dumpEPOSProfile(void);
+/*! \brief clear the timing of all profiled functions */
+void resetEPOSProfile(void);
+
+#endif
@@ -0,0 +1,149 @@
+/*! \file epos_ramp.c
+
+\brief velocity ramp generator for Profile Velocity and Velocity Mode
+
+moveWithVelocity() and PDOSetVelocity() jump to the new velocity at
+once. For smooth streaming, e.g. in Velocity Mode (VM), every axis gets
+an eposRamp_t. tickEPOSRamps() is called at a fixed rate, moves each
+ramp towards its target with limited acceleration and jerk and sends a
+new setpoint through RPDO only if the rounded setpoint changed, so an
+axis at constant speed does not load the bus.
+
+*/
+
+#include <math.h>
+#include "SEGGER_RTT.h"
+#include "epos_ramp.h"
+
+
+/*! set up the velocity ramp of an axis
+
+\param ramp the ramp to set up
+\param epos the EPOS the setpoints are sent to
+\param dt tick period in s, i.e. the period tickEPOSRamps() is called with
+\param maxAcc acceleration limit in rpm/s
+\param maxJerk jerk limit in rpm/s^2, 0 for a trapezoidal ramp
+
+\retval 0 success
+\retval -1 failure
+*/
+int initEPOSRamp(eposRamp_t *ramp, epos_t *epos, float dt,
+                 float maxAcc, float maxJerk) {
+
+    if (!ramp || dt <= 0.0f || maxAcc <= 0.0f || maxJerk < 0.0f) return -1;
+
+    ramp->epos = epos;
+    ramp->dt = dt;
+    ramp->maxAcc = maxAcc;
+    ramp->maxJerk = maxJerk;
+    ramp->target = 0.0f;
+    ramp->vel = 0.0f;
+    ramp->acc = 0.0f;
+    ramp->setpoint = 0;
+    ramp->sent = false;
+
+    return (0);
+}
+
+
+int setEPOSRampTarget(eposRamp_t *ramp, int32_t velocity) {
+
+    if (!ramp) return -1;
+
+    ramp->target = (float)velocity;
+    return (0);
+}
+
+
+/*! advance the ramp by one tick
+
+Without jerk limit the velocity moves with maxAcc towards the target.
+With jerk limit the acceleration moves with maxJerk towards +-maxAcc,
+and starts to go back to 0 as soon as the velocity gained while doing so
+(acc*|acc| / 2*maxJerk) would reach the target: an S-curve.
+
+\return the new velocity setpoint in rpm
+*/
+int32_t stepEPOSRamp(eposRamp_t *ramp) {
+    float dv, want, dj;
+
+    dv = ramp->target - ramp->vel;
+
+    if (ramp->maxJerk <= 0.0f) {
+        want = ramp->maxAcc * ramp->dt;
+        if (dv > want) {
+            ramp->acc = ramp->maxAcc;
+            ramp->vel += want;
+        } else if (dv < -want) {
+            ramp->acc = -ramp->maxAcc;
+            ramp->vel -= want;
+        } else {
+            ramp->acc = 0.0f;
+            ramp->vel = ramp->target;
+        }
+    } else if (dv != 0.0f || ramp->acc != 0.0f) {
+        // velocity still gained while the acceleration goes back to 0
+        if (dv > ramp->acc * fabsf(ramp->acc) / (2.0f * ramp->maxJerk))
+            want = ramp->maxAcc;
+        else
+            want = -ramp->maxAcc;
+
+        dj = ramp->maxJerk * ramp->dt;
+        if (want - ramp->acc > dj) ramp->acc += dj;
+        else if (want - ramp->acc < -dj) ramp->acc -= dj;
+        else ramp->acc = want;
+
+        ramp->vel += ramp->acc * ramp->dt;
+
+        // do not overshoot the target because of the discrete ticks
+        if ((dv >= 0.0f && ramp->vel >= ramp->target)
+            || (dv <= 0.0f && ramp->vel <= ramp->target)) {
+            ramp->vel = ramp->target;
+            ramp->acc = 0.0f;
+        }
+    }
+
+    return (int32_t)lroundf(ramp->vel);
+}
+
+
+bool EPOSRampDone(const eposRamp_t *ramp) {
+    return ramp->vel == ramp->target && ramp->acc == 0.0f;
+}
+
+
+/*! advance all ramps by one tick and send the changed setpoints
+
+\param ramps array of ramps, one per axis
+\param num number of ramps
+
+Every axis is stepped and sent even if sending to another one failed,
+so the ramps stay in step; a setpoint that could not be sent is sent
+again on the next tick.
+
+\return number of setpoints sent, or minus the number of axes sending
+failed for
+*/
+int tickEPOSRamps(eposRamp_t *ramps, uint8_t num) {
+    int32_t sp;
+    int i, n = 0, failed = 0;
+
+    if (!ramps) return -1;
+
+    for (i = 0; i < num; i++) {
+        sp = stepEPOSRamp(&ramps[i]);
+        if (ramps[i].sent && sp == ramps[i].setpoint) continue;
+
+        if (PDOSetVelocity(ramps[i].epos, sp) < 0) {
+            SEGGER_RTT_printf(0, "%s: PDOSetVelocity() failed for axis %d\n",
+                    __func__, i);
+            ramps[i].sent = false;
+            failed++;
+            continue;
+        }
+        ramps[i].setpoint = sp;
+        ramps[i].sent = true;
+        n++;
+    }
+    return failed ? -failed : n;
+}
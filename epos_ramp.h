@@ -0,0 +1,38 @@
+/*! \file epos_ramp.h
+
+  velocity ramp generator for streaming velocity setpoints through RPDO
+
+*/
+
+#ifndef _EPOS_RAMP_H
+#define _EPOS_RAMP_H
+
+#include "epos.h"
+
+/*! \brief state of the velocity ramp of one axis */
+typedef struct eposRamp_s {
+  epos_t *epos;
+  float dt;            ///< tick period [s]
+  float maxAcc;        ///< acceleration limit [rpm/s]
+  float maxJerk;       ///< jerk limit [rpm/s^2], 0 means no jerk limit
+  float target;        ///< velocity the ramp is heading to [rpm]
+  float vel;           ///< present ramp velocity [rpm]
+  float acc;           ///< present ramp acceleration [rpm/s]
+  int32_t setpoint;    ///< last velocity setpoint sent to EPOS [rpm]
+  bool sent;           ///< setpoint has been sent at least once
+} eposRamp_t;
+
+/*! \brief set up the ramp of an axis, starting at standstill */
+int initEPOSRamp(eposRamp_t *ramp, epos_t *epos, float dt,
+                 float maxAcc, float maxJerk);
+/*! \brief set the velocity the ramp heads to */
+int setEPOSRampTarget(eposRamp_t *ramp, int32_t velocity);
+/*! \brief advance the ramp by one tick, returns the new setpoint. No I/O. */
+int32_t stepEPOSRamp(eposRamp_t *ramp);
+/*! \brief true if the ramp has reached its target */
+bool EPOSRampDone(const eposRamp_t *ramp);
+/*! \brief advance all ramps by one tick and send the setpoints that
+   changed with PDOSetVelocity(); call this at the fixed tick period */
+int tickEPOSRamps(eposRamp_t *ramps, uint8_t num);
+
+#endif
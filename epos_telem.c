@@ -0,0 +1,149 @@
+/*! \file epos_telem.c
+
+\brief binary live telemetry of the EPOS feedback
+
+monitorStatus() reads position, velocity and current with SDO transfers
+and prints them as text, a few lines per second. The streamer instead
+samples what the driver has decoded from the TPDOs anyway (statusword,
+state, RxPosition, RxVelocity, RxCurrent) at a fixed rate and writes a
+compact record to RTT channel EPOS_TELEM_CHANNEL. Nothing is sent on
+the bus and nothing blocks: a record that does not fit into the RTT
+buffer is dropped and counted, and the sequence number in the record
+lets the host see the gap. tools/epos_telem2csv turns the stream into
+CSV.
+
+*/
+
+#include "SEGGER_RTT.h"
+#include "epos.h"
+#include "epos_telem.h"
+
+static epos_t *axes[EPOS_TELEM_AXES];
+static uint8_t numAxes = 0;
+static uint16_t telemDivider = 1, count = 0;
+static uint16_t seq = 0;
+static volatile bool running = false;
+static uint32_t startTick;
+static eposTelemStats_t stats;
+static uint8_t telemBuf[EPOS_TELEM_BUFSIZE];
+
+
+/*! start streaming
+
+\param epos array of the axes to sample, NULL entries are skipped
+\param num number of entries in epos
+\param divider a record is written every divider-th call of
+tickEPOSTelemetry(), e.g. 10 for 100 Hz from a 1 kHz timer
+
+\retval 0 success
+\retval -1 failure, e.g. more than EPOS_TELEM_AXES axes
+*/
+int startEPOSTelemetry(epos_t **epos, uint8_t num, uint16_t divider) {
+    int i;
+
+    if (!epos || divider == 0) return -1;
+
+    running = false;
+    numAxes = 0;
+    for (i = 0; i < num; i++) {
+        if (!epos[i]) continue;
+        if (numAxes == EPOS_TELEM_AXES) return -1;
+        axes[numAxes++] = epos[i];
+    }
+    if (numAxes == 0) return -1;
+    if (SEGGER_RTT_ConfigUpBuffer(EPOS_TELEM_CHANNEL, "EPOSTelem", telemBuf,
+            sizeof(telemBuf), SEGGER_RTT_MODE_NO_BLOCK_SKIP) < 0)
+        return -1;
+
+    telemDivider = divider;
+    count = 0;
+    seq = 0;
+    stats.Samples = 0;
+    stats.Dropped = 0;
+    stats.Bytes = 0;
+    startTick = HAL_GetTick();
+    running = true;
+    return 0;
+}
+
+
+void stopEPOSTelemetry(void) {
+    running = false;
+}
+
+
+static uint8_t *put16(uint8_t *p, uint16_t v) {
+    *p++ = v & 0xFF;
+    *p++ = v >> 8;
+    return p;
+}
+
+static uint8_t *put32(uint8_t *p, uint32_t v) {
+    p = put16(p, v & 0xFFFF);
+    return put16(p, v >> 16);
+}
+
+
+/*! sample all axes and write one record, every divider-th call
+
+Call this at a fixed rate from a timer interrupt or the control loop.
+*/
+void tickEPOSTelemetry(void) {
+    uint8_t rec[EPOS_TELEM_RECSIZE(EPOS_TELEM_AXES)];
+    uint8_t *p = rec;
+    uint16_t s1 = 0, s2 = 0;
+    uint32_t primask;
+    unsigned int len, i;
+    epos_t *e;
+
+    if (!running || ++count < telemDivider) return;
+    count = 0;
+
+    *p++ = EPOS_TELEM_SYNC;
+    *p++ = numAxes;
+    p = put16(p, seq++);
+    p = put32(p, getEPOSTimeUs());
+    // the CAN interrupt must not update an axis while it is copied
+    primask = __get_PRIMASK();
+    __disable_irq();
+    for (i = 0; i < numAxes; i++) {
+        e = axes[i];
+        *p++ = e->Node_ID;
+        *p++ = (uint8_t)e->State;
+        p = put16(p, e->Statusword);
+        p = put32(p, (uint32_t)e->RxPosition);
+        p = put32(p, (uint32_t)e->RxVelocity);
+        p = put16(p, (uint16_t)e->RxCurrent);
+    }
+    if (!primask) __enable_irq();
+
+    for (i = 0; i < (unsigned int)(p - rec); i++) {
+        s1 = (s1 + rec[i]) % 255;
+        s2 = (s2 + s1) % 255;
+    }
+    p = put16(p, (s2 << 8) | s1);
+    len = p - rec;
+
+    // in skip mode RTT writes the whole record or nothing
+    if (SEGGER_RTT_Write(EPOS_TELEM_CHANNEL, rec, len) != len) {
+        stats.Dropped++;
+        return;
+    }
+    stats.Samples++;
+    stats.Bytes += len;
+}
+
+
+/*! copy the counters of the streamer and compute the bandwidth
+
+\retval 0 success
+\retval -1 failure
+*/
+int getEPOSTelemetryStats(eposTelemStats_t *s) {
+    if (!s) return -1;
+
+    *s = stats;
+    s->Time = HAL_GetTick() - startTick;
+    s->BytesPerSec = s->Time ? (uint32_t)((uint64_t)s->Bytes * 1000 / s->Time) : 0;
+    return 0;
+}
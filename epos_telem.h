@@ -0,0 +1,60 @@
+/*! \file epos_telem.h
+
+  binary live telemetry of the EPOS feedback over an RTT up-channel
+
+*/
+
+#ifndef _EPOS_TELEM_H
+#define _EPOS_TELEM_H
+
+#include <stdint.h>
+
+struct epos_s;
+
+/*! \brief RTT up-channel the telemetry records are written to */
+#ifndef EPOS_TELEM_CHANNEL
+#define EPOS_TELEM_CHANNEL  3
+#endif
+/*! \brief size of the RTT buffer of the telemetry channel */
+#ifndef EPOS_TELEM_BUFSIZE
+#define EPOS_TELEM_BUFSIZE  2048
+#endif
+/*! \brief max. number of axes in one record */
+#ifndef EPOS_TELEM_AXES
+#define EPOS_TELEM_AXES  16
+#endif
+
+/*! \brief first byte of every record, lets the decoder resynchronise */
+#define EPOS_TELEM_SYNC  0xA7
+
+/*
+  a record is (all little endian):
+    uint8_t sync; uint8_t naxes; uint16_t seq; uint32_t time_us;
+    naxes times:
+      uint8_t node; int8_t state; uint16_t statusword;
+      int32_t position; int32_t velocity; int16_t current;
+    uint16_t checksum;   Fletcher-16 of all bytes before it
+*/
+#define EPOS_TELEM_HDRSIZE   8
+#define EPOS_TELEM_AXISSIZE  14
+#define EPOS_TELEM_RECSIZE(naxes) \
+  (EPOS_TELEM_HDRSIZE + (naxes) * EPOS_TELEM_AXISSIZE + 2)
+
+/*! \brief counters of the streamer, see getEPOSTelemetryStats() */
+typedef struct eposTelemStats_s {
+  uint32_t Samples;     ///< records written
+  uint32_t Dropped;     ///< records that did not fit into the RTT buffer
+  uint32_t Bytes;       ///< bytes written
+  uint32_t Time;        ///< ms the streamer ran
+  uint32_t BytesPerSec; ///< output bandwidth
+} eposTelemStats_t;
+
+/*! \brief stream the feedback of these axes, every 'divider'-th call of
+   tickEPOSTelemetry() */
+int startEPOSTelemetry(struct epos_s **epos, uint8_t num, uint16_t divider);
+void stopEPOSTelemetry(void);
+/*! \brief call at a fixed rate, e.g. from a timer interrupt */
+void tickEPOSTelemetry(void);
+int getEPOSTelemetryStats(eposTelemStats_t *stats);
+
+#endif
@@ -0,0 +1,187 @@
+/*! \file epos_trace.c
+
+\brief in-RAM CAN frame trace recorder
+
+Every frame the driver sends or receives is put into a ring of
+EPOS_TRACE_DEPTH records with a us timestamp. Recording costs a copy of
+16 bytes, so the trace can run all the time. When one of the trigger
+conditions happens (EMCY, SDO abort, fault bit in a TPDO statusword, or
+triggerEPOSTrace()), 'post' more frames are recorded and the trace is
+frozen, so it holds the frames before and after the trigger.
+
+dumpEPOSTrace() writes the frozen trace in binary to RTT channel
+EPOS_TRACE_CHANNEL; tools/epos_trace2candump turns it into a candump
+.log file.
+
+*/
+
+#include <string.h>
+#include "SEGGER_RTT.h"
+#include "epos.h"
+#include "epos_trace.h"
+
+static eposTraceRec_t trace[EPOS_TRACE_DEPTH];
+static volatile eposTraceState traceState = EPOS_TRACE_IDLE;
+static uint32_t traceHead = 0;      ///< records written since start
+static uint32_t traceTrigger = 0;   ///< traceHead of the trigger record
+static bool traceTriggered = false;
+static uint16_t tracePost = 0;      ///< records still to take after trigger
+static uint8_t traceTriggers = 0;
+static uint32_t dumpPos = 0;        ///< next record dumpEPOSTrace() writes
+static bool dumpHdr = false;        ///< header of the dump is written
+static uint8_t traceBuf[EPOS_TRACE_BUFSIZE];
+
+/*! start the recorder
+
+\param post number of frames recorded after the trigger, the
+EPOS_TRACE_DEPTH - post frames before the trigger are kept
+\param triggers EPOS_TRIG_* conditions that trigger the trace, 0 to
+record until stopEPOSTrace() or triggerEPOSTrace()
+
+\retval 0 success
+\retval -1 post is larger than the trace, or no RTT channel
+*/
+int startEPOSTrace(uint16_t post, uint8_t triggers) {
+    uint32_t primask;
+
+    if (post > EPOS_TRACE_DEPTH) return -1;
+    if (SEGGER_RTT_ConfigUpBuffer(EPOS_TRACE_CHANNEL, "EPOSTrace", traceBuf,
+            sizeof(traceBuf), SEGGER_RTT_MODE_NO_BLOCK_SKIP) < 0)
+        return -1;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    traceHead = 0;
+    traceTriggered = false;
+    tracePost = post;
+    traceTriggers = triggers;
+    dumpPos = 0;
+    dumpHdr = false;
+    traceState = EPOS_TRACE_ARMED;
+    if (!primask) __enable_irq();
+    return 0;
+}
+
+
+void stopEPOSTrace(void) {
+    if (traceState != EPOS_TRACE_IDLE) traceState = EPOS_TRACE_DONE;
+}
+
+
+static void fireTrigger(void) {
+    traceTriggered = true;
+    traceTrigger = traceHead - 1;
+    trace[traceTrigger % EPOS_TRACE_DEPTH].Flags |= EPOS_TRACE_TRIGGER;
+    traceState = tracePost ? EPOS_TRACE_POST : EPOS_TRACE_DONE;
+}
+
+
+void triggerEPOSTrace(void) {
+    uint32_t primask;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    if (traceState == EPOS_TRACE_ARMED && traceHead > 0) fireTrigger();
+    if (!primask) __enable_irq();
+}
+
+
+eposTraceState EPOSTraceState(void) {
+    return traceState;
+}
+
+
+void traceEPOSFrame(uint32_t StdId, uint8_t DLC, const uint8_t *data, bool tx) {
+    eposTraceRec_t *r;
+    uint32_t primask;
+    uint8_t fc;
+
+    if (traceState != EPOS_TRACE_ARMED && traceState != EPOS_TRACE_POST)
+        return;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    r = &trace[traceHead % EPOS_TRACE_DEPTH];
+    r->Time = getEPOSTimeUs();
+    r->StdId = StdId;
+    r->DLC = DLC > 8 ? 8 : DLC;
+    r->Flags = tx ? EPOS_TRACE_TX : 0;
+    memcpy(r->Data, data, 8);
+    traceHead++;
+
+    if (traceState == EPOS_TRACE_POST) {
+        if (--tracePost == 0) traceState = EPOS_TRACE_DONE;
+    } else if (!tx && traceTriggers) {
+        fc = StdId >> 7;
+        if (((traceTriggers & EPOS_TRIG_EMCY) && fc == 0x1 && StdId != 0x080)
+            || ((traceTriggers & EPOS_TRIG_SDOABORT) && fc == 0xB && data[0] == 0x80)
+            || ((traceTriggers & EPOS_TRIG_FAULT) && DLC >= 2
+                && (fc == 0x3 || fc == 0x5 || fc == 0x7 || fc == 0x9)
+                && (data[0] & 0x08)))   // statusword bit 3: fault
+            fireTrigger();
+    }
+    if (!primask) __enable_irq();
+}
+
+
+/*! copy the frozen trace, oldest frame first
+
+\param rec array for the records
+\param max size of rec
+\param trigger if not NULL, receives the index of the trigger record in
+rec, -1 if the trace was not triggered
+
+\return number of records copied, -1 if the trace is still recording
+*/
+int readEPOSTrace(eposTraceRec_t *rec, int max, int *trigger) {
+    uint32_t first, i;
+    int n = 0;
+
+    if (traceState == EPOS_TRACE_ARMED || traceState == EPOS_TRACE_POST)
+        return -1;
+
+    first = traceHead > EPOS_TRACE_DEPTH ? traceHead - EPOS_TRACE_DEPTH : 0;
+    if (trigger) *trigger = -1;
+    for (i = first; i < traceHead && n < max; i++) {
+        if (trigger && traceTriggered && i == traceTrigger) *trigger = n;
+        rec[n++] = trace[i % EPOS_TRACE_DEPTH];
+    }
+    return n;
+}
+
+
+/*! write the frozen trace to RTT channel EPOS_TRACE_CHANNEL
+
+Nothing is blocked: only what fits into the RTT buffer is written, call
+this again (e.g. from the main loop) until it returns 0.
+
+\return number of records written in this call, -1 if the trace is
+still recording
+*/
+int dumpEPOSTrace(void) {
+    eposTraceHdr_t hdr;
+    uint32_t first, i;
+    int n = 0;
+
+    if (traceState == EPOS_TRACE_ARMED || traceState == EPOS_TRACE_POST)
+        return -1;
+
+    first = traceHead > EPOS_TRACE_DEPTH ? traceHead - EPOS_TRACE_DEPTH : 0;
+    if (!dumpHdr) {
+        hdr.Magic = EPOS_TRACE_MAGIC;
+        hdr.Count = traceHead - first;
+        hdr.Trigger = traceTriggered ? traceTrigger - first : 0xFFFF;
+        if (SEGGER_RTT_Write(EPOS_TRACE_CHANNEL, &hdr, sizeof(hdr)) != sizeof(hdr))
+            return 0;
+        dumpPos = first;
+        dumpHdr = true;
+    }
+    for (i = dumpPos; i < traceHead; i++) {
+        if (SEGGER_RTT_Write(EPOS_TRACE_CHANNEL, &trace[i % EPOS_TRACE_DEPTH],
+                             sizeof(eposTraceRec_t)) != sizeof(eposTraceRec_t))
+            break;
+        n++;
+    }
+    dumpPos = i;
+    return n;
+}
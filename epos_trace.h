@@ -0,0 +1,76 @@
+/*! \file epos_trace.h
+
+  in-RAM recorder of all CAN frames sent and received by libEPOS
+
+*/
+
+#ifndef _EPOS_TRACE_H
+#define _EPOS_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*! \brief number of frames the trace holds, must be a power of 2 */
+#ifndef EPOS_TRACE_DEPTH
+#define EPOS_TRACE_DEPTH  256
+#endif
+
+/*! \brief RTT up-channel dumpEPOSTrace() writes to */
+#ifndef EPOS_TRACE_CHANNEL
+#define EPOS_TRACE_CHANNEL  2
+#endif
+
+/*! \brief size of the RTT buffer of the trace channel */
+#ifndef EPOS_TRACE_BUFSIZE
+#define EPOS_TRACE_BUFSIZE  512
+#endif
+
+/* trigger conditions for startEPOSTrace() */
+#define EPOS_TRIG_EMCY      0x01   ///< an EMCY frame was received
+#define EPOS_TRIG_SDOABORT  0x02   ///< an SDO transfer was aborted
+#define EPOS_TRIG_FAULT     0x04   ///< a TPDO statusword has the fault bit set
+
+/* flags of a trace record */
+#define EPOS_TRACE_TX       0x01   ///< frame was sent, not received
+#define EPOS_TRACE_TRIGGER  0x02   ///< this frame triggered the trace
+
+/*! \brief one recorded frame, also the binary format of the dump */
+typedef struct eposTraceRec_s {
+  uint32_t Time;       ///< us since start-up, wraps after 71 minutes
+  uint16_t StdId;
+  uint8_t DLC;
+  uint8_t Flags;       ///< EPOS_TRACE_TX, EPOS_TRACE_TRIGGER
+  uint8_t Data[8];
+} eposTraceRec_t;
+
+/*! \brief header in front of the records of a dump */
+typedef struct eposTraceHdr_s {
+  uint32_t Magic;      ///< EPOS_TRACE_MAGIC
+  uint16_t Count;      ///< number of records following
+  uint16_t Trigger;    ///< index of the trigger record, 0xFFFF if none
+} eposTraceHdr_t;
+
+#define EPOS_TRACE_MAGIC  0x52545045   ///< "EPTR"
+
+typedef enum eposTraceState_s {
+  EPOS_TRACE_IDLE = 0,    ///< not recording
+  EPOS_TRACE_ARMED,       ///< recording, waiting for the trigger
+  EPOS_TRACE_POST,        ///< triggered, recording the post-trigger frames
+  EPOS_TRACE_DONE         ///< frozen, ready for dumpEPOSTrace()
+} eposTraceState;
+
+/*! \brief start recording, freeze 'post' frames after a trigger */
+int startEPOSTrace(uint16_t post, uint8_t triggers);
+/*! \brief stop recording, the trace can be dumped after that */
+void stopEPOSTrace(void);
+/*! \brief trigger the trace by hand */
+void triggerEPOSTrace(void);
+eposTraceState EPOSTraceState(void);
+/*! \brief record one frame, called by the driver for every frame */
+void traceEPOSFrame(uint32_t StdId, uint8_t DLC, const uint8_t *data, bool tx);
+/*! \brief write the frozen trace to the RTT channel, non-blocking */
+int dumpEPOSTrace(void);
+/*! \brief copy the frozen trace, oldest frame first */
+int readEPOSTrace(eposTraceRec_t *rec, int max, int *trigger);
+
+#endif
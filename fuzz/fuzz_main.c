@@ -0,0 +1,86 @@
+/*! \file fuzz_main.c
+
+\brief runs a fuzz target without libFuzzer
+
+For compilers without -fsanitize=fuzzer: the target gets the files
+given on the command line (a reproducer, or every file of a corpus
+directory), then -runs=N random inputs from -seed=S. The options are
+the ones of libFuzzer, so a test runs the same command with either.
+
+*/
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define FUZZ_MAX_INPUT 4096
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static uint8_t buf[FUZZ_MAX_INPUT];
+
+static int runFile(const char *path) {
+  FILE *f = fopen(path, "rb");
+  size_t n;
+
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  n = fread(buf, 1, sizeof(buf), f);
+  fclose(f);
+  LLVMFuzzerTestOneInput(buf, n);
+  return 0;
+}
+
+static int runPath(const char *path) {
+  char name[1024];
+  struct dirent *d;
+  struct stat st;
+  DIR *dir;
+  int n = 0;
+
+  if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) return runFile(path) < 0 ? -1 : 1;
+  if (!(dir = opendir(path))) return -1;
+  while ((d = readdir(dir))) {
+    snprintf(name, sizeof(name), "%s/%s", path, d->d_name);
+    if (stat(name, &st) == 0 && S_ISREG(st.st_mode) && runFile(name) == 0) n++;
+  }
+  closedir(dir);
+  return n;
+}
+
+/* xorshift32 */
+static uint32_t rnd(uint32_t *s) {
+  *s ^= *s << 13;
+  *s ^= *s >> 17;
+  *s ^= *s << 5;
+  return *s;
+}
+
+int main(int argc, char **argv) {
+  unsigned long runs = 0, k;
+  uint32_t seed = 1;
+  size_t n, i;
+  int a, r, files = 0;
+
+  for (a = 1; a < argc; a++) {
+    if (strncmp(argv[a], "-runs=", 6) == 0) runs = strtoul(argv[a] + 6, NULL, 0);
+    else if (strncmp(argv[a], "-seed=", 6) == 0) seed = strtoul(argv[a] + 6, NULL, 0);
+    else if (argv[a][0] == '-') continue;      // other libFuzzer options
+    else if ((r = runPath(argv[a])) >= 0) files += r;
+    else return 1;
+  }
+  if (!seed) seed = 1;
+
+  for (k = 0; k < runs; k++) {
+    n = rnd(&seed) % (FUZZ_MAX_INPUT + 1);
+    for (i = 0; i < n; i++) buf[i] = rnd(&seed) >> 24;
+    LLVMFuzzerTestOneInput(buf, n);
+  }
+  printf("%d files, %lu random inputs: ok\n", files, runs);
+  return 0;
+}
@@ -0,0 +1,107 @@
+/*! \file fuzz_rx.c
+
+\brief fuzz target: arbitrary frames into the receive interrupt
+
+The driver has four nodes open (IDs 1, 2, 64 and 127). Every 11 bytes
+of input are one frame handed to HAL_CAN_RxCpltCallback():
+
+    byte 0   bits 0-3 function code (COB-ID bits 7-10), bit 7: after the
+             frame, run one of the functions that read what the receive
+             path stored, chosen by bits 4-6
+    byte 1   bits 0-1 node of the set, bit 7: bits 0-6 are the node ID
+    byte 2   DLC, bits 0-3 as the bxCAN has them, so up to 15
+    3..10    data
+
+Covers processCANMsg(), processPDOMessage(), the EMCY, heartbeat and
+statusword decoding and the event queue. Besides what the sanitizers
+find, a frame that takes longer than EPOS_FUZZ_FRAME_US of virtual or
+EPOS_FUZZ_FRAME_NS of CPU time aborts the run, to catch slow paths in
+the dispatch.
+
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "epos.h"
+#include "main.h"
+#include "epos_host.h"
+
+/*! \brief virtual time one frame may take: every HAL_GetTick() call
+   costs EPOS_HOST_POLL_US, so waiting in the interrupt shows up here */
+#ifndef EPOS_FUZZ_FRAME_US
+#define EPOS_FUZZ_FRAME_US  20
+#endif
+/*! \brief CPU time one frame may take, generous for sanitizer builds
+   and the cold start */
+#ifndef EPOS_FUZZ_FRAME_NS
+#define EPOS_FUZZ_FRAME_NS  50000000
+#endif
+
+#define FRAME_BYTES 11
+
+static const uint8_t nodeSet[] = { 1, 2, 64, 127 };
+#define NODES (sizeof(nodeSet) / sizeof(nodeSet[0]))
+
+static void onEvent(const eposEvent_t *ev) {
+  (void)ev;
+}
+
+/* the readers of what the receive interrupt stored, none of them goes
+   to the bus */
+static void consume(uint8_t what, uint8_t node) {
+  eposEmcy_t emcy[EPOS_EMCY_HISTORY];
+  eposStats_t st;
+  epos_t *e = epos[node];
+
+  switch (what) {
+  case 0: dispatchEPOSEvents(); break;
+  case 1: getEPOSEmcy(e, emcy, EPOS_EMCY_HISTORY); break;
+  case 2: checkEPOSHeartbeat(epos, epos_num); break;
+  case 3: getEPOSStats(e, &st); break;
+  case 4: observeEPOSstatus(e, e->Statusword); break;
+  case 5: EPOSErrorText(e->Dev_Err); break;
+  case 6: clearEPOSEmcy(e); break;
+  default: processPDOMessage(epos, epos_num); break;
+  }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  CanRxMsgTypeDef msg;
+  uint64_t t0, v0;
+  unsigned i;
+
+  hostReset();
+  for (i = 0; i < NODES; i++) epos[i] = openEPOS(&hcan1, nodeSet[i]);
+  epos_num = NODES;
+  setEPOSEventCallback(onEvent);
+
+  for (; size >= FRAME_BYTES; data += FRAME_BYTES, size -= FRAME_BYTES) {
+    memset(&msg, 0, sizeof(msg));
+    msg.StdId = ((data[0] & 0x0F) << 7)
+        | ((data[1] & 0x80) ? (data[1] & 0x7F) : nodeSet[data[1] & 0x03]);
+    msg.IDE = CAN_ID_STD;
+    msg.RTR = CAN_RTR_DATA;
+    msg.DLC = data[2] & 0x0F;
+    memcpy(msg.Data, &data[3], 8);
+
+    t0 = hostCPUNs();
+    v0 = hostTimeUs();
+    hcan1.pRxMsg = &msg;
+    HAL_CAN_RxCpltCallback(&hcan1);
+    if (data[0] & 0x80) consume((data[0] >> 4) & 0x07, data[1] & 0x03);
+    if (hostTimeUs() - v0 > EPOS_FUZZ_FRAME_US || hostCPUNs() - t0 > EPOS_FUZZ_FRAME_NS) {
+      fprintf(stderr, "frame %03lx took %llu us virtual, %llu ns CPU\n",
+              (unsigned long)msg.StdId, (unsigned long long)(hostTimeUs() - v0),
+              (unsigned long long)(hostCPUNs() - t0));
+      abort();
+    }
+  }
+
+  setEPOSEventCallback(NULL);
+  dispatchEPOSEvents();
+  for (i = 0; i < NODES; i++) free(epos[i]);
+  epos_num = 0;
+  return 0;
+}
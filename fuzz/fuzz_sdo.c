@@ -0,0 +1,85 @@
+/*! \file fuzz_sdo.c
+
+\brief fuzz target: arbitrary SDO answers to the driver's requests
+
+One node (ID 1) is open. The input is a list of operations; every SDO
+request the driver sends on the way is answered from the input:
+
+    byte 0   operation: readStatusword(), readActualPosition(),
+             read_DevErr(), readDeviceName(), readSWversion(),
+             writePositionWindow(), readEPOSErrorHistory() or
+             uploadEPOSRecorder() with a 1, 2 or 4 byte channel
+    then, per answer, 9 bytes: bit 7 of the first drops the answer,
+             bit 6 sends it to another node, bits 0-3 are the DLC; then
+             the 8 data bytes
+
+This covers waitAnswer(), the expedited and segmented upload in
+uploadObject() and the decoding of what comes back. A request without
+input left is not answered; no operation starts then.
+
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "epos.h"
+#include "main.h"
+#include "epos_host.h"
+
+#define ANSWER_BYTES 9
+#define OPS 10
+
+static const uint8_t *in;
+static size_t left;
+
+/* the node: answers each SDO request from the input */
+static void node(const CanRxMsgTypeDef *f, bool fromDriver, void *ctx) {
+  (void)ctx;
+  if (!fromDriver || f->StdId != 0x601 || left < ANSWER_BYTES) return;
+  if (!(in[0] & 0x80))
+    hostCANSend((in[0] & 0x40) ? 0x582 : 0x581, in[0] & 0x0F, &in[1], 20);
+  in += ANSWER_BYTES;
+  left -= ANSWER_BYTES;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  eposRecorder_t rec = { 1, { { 0x6064, 0x00, 4, true } }, 10, 0, 0 };
+  int32_t samples[64], *chan[1] = { samples };
+  eposErrHist_t hist;
+  char name[8];
+  int32_t v;
+  WORD w;
+  uint8_t op;
+
+  hostReset();
+  hostAddFrameHook(node, NULL);
+  epos[0] = openEPOS(&hcan1, 1);
+  epos_num = 1;
+  in = data;
+  left = size;
+
+  while (left > ANSWER_BYTES) {
+    op = in[0];
+    in++;
+    left--;
+    switch (op % OPS) {
+    case 0: readStatusword(epos[0], &w); break;
+    case 1: readActualPosition(epos[0], &v); break;
+    case 2: read_DevErr(epos[0], op >> 4, &w); break;
+    case 3: readDeviceName(epos[0], name); break;
+    case 4: readSWversion(epos[0]); break;
+    case 5: writePositionWindow(epos[0], op); break;
+    case 6: readEPOSErrorHistory(epos, 1, &hist, op & 0x10, NULL); break;
+    default:
+      rec.Channel[0].Size = 1 << (op % OPS - 7);
+      rec.Channel[0].Signed = op & 0x10;
+      uploadEPOSRecorder(epos[0], &rec, chan, (op >> 5) ? 64 : 1);
+      break;
+    }
+  }
+
+  hostIdle();
+  free(epos[0]);
+  epos_num = 0;
+  return 0;
+}
@@ -0,0 +1,20 @@
+/*! \file SEGGER_RTT.h
+
+  host stand-in for SEGGER RTT: the up-channels are kept in memory and
+  can be read with hostRTTRead(), see epos_host.h
+
+*/
+
+#ifndef _EPOS_HOST_RTT_H
+#define _EPOS_HOST_RTT_H
+
+#define SEGGER_RTT_MODE_NO_BLOCK_SKIP         0
+#define SEGGER_RTT_MODE_NO_BLOCK_TRIM         1
+#define SEGGER_RTT_MODE_BLOCK_IF_FIFO_FULL    2
+
+int SEGGER_RTT_printf(unsigned BufferIndex, const char *sFormat, ...);
+unsigned SEGGER_RTT_Write(unsigned BufferIndex, const void *pBuffer, unsigned NumBytes);
+int SEGGER_RTT_ConfigUpBuffer(unsigned BufferIndex, const char *sName, void *pBuffer,
+                              unsigned BufferSize, unsigned Flags);
+
+#endif
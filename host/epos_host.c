@@ -0,0 +1,432 @@
+/*! \file epos_host.c
+
+\brief HAL, bus and RTT model of the host build
+
+See epos_host.h. The model keeps its own state of the three transmit
+mailboxes and brings the CAN_TypeDef registers in line with it whenever
+the driver calls into the HAL (HAL_GetTick(), the interrupt mask,
+__HAL_CAN_ENABLE_IT()), so both the HAL_CAN_Transmit_IT() path and the
+direct register writes of the quick stop are seen. RTT is in rtt_host.c.
+
+*/
+
+#include <string.h>
+#include <time.h>
+#include "main.h"
+#include "epos_host.h"
+
+epos_t *epos[EPOS_HOST_MAXNODES];
+uint8_t epos_num = 0;
+
+static CAN_TypeDef can1;
+CAN_HandleTypeDef hcan1 = { &can1, NULL, NULL };
+
+typedef struct {
+  CanRxMsgTypeDef msg;
+  uint64_t ready;        ///< us when the node hands it to its controller
+} nodeFrame_t;
+
+enum { MB_FREE = 0, MB_PENDING, MB_SENDING };
+
+static struct {
+  uint64_t now;                        ///< us
+  uint32_t bitrate;
+  bool masked;                         ///< __disable_irq() in effect
+  bool inIrq;                          ///< a callback is running
+  // the bus
+  bool busy;
+  int sending;                         ///< mailbox on the bus, -1: node frame
+  uint64_t busEnd;
+  CanRxMsgTypeDef onBus;
+  // transmit side of the driver
+  uint8_t mbState[3];
+  bool txIrq;                          ///< transmit complete interrupt pending
+  CAN_HandleTypeDef *txHandle;
+  // frames of the nodes
+  nodeFrame_t nodeQueue[EPOS_HOST_TXQUEUE];
+  int nodeCount;
+  // receive side of the driver
+  CanRxMsgTypeDef fifo[EPOS_HOST_RXFIFO];
+  int fifoCount;
+  bool rxArmed;
+  CAN_HandleTypeDef *rxHandle;
+  struct {
+    hostFrameHook fn;
+    void *ctx;
+  } hook[EPOS_HOST_HOOKS];
+  struct {
+    hostTimerHook fn;
+    void *ctx;
+    uint32_t period;
+    uint64_t next;
+  } timer[EPOS_HOST_HOOKS];
+  hostCANStats_t stats;
+} bus;
+
+
+
+void hostReset(void) {
+  memset(&bus, 0, sizeof(bus));
+  bus.bitrate = 1000000;
+  memset(&can1, 0, sizeof(can1));
+  can1.TSR = CAN_TSR_TME0 | CAN_TSR_TME1 | CAN_TSR_TME2;
+  hcan1.Instance = &can1;
+  hostRTTReset();
+}
+
+int hostAddFrameHook(hostFrameHook hook, void *ctx) {
+  int i;
+
+  for (i = 0; i < EPOS_HOST_HOOKS; i++)
+    if (bus.hook[i].fn == hook && bus.hook[i].ctx == ctx) return 0;
+  for (i = 0; i < EPOS_HOST_HOOKS; i++) {
+    if (bus.hook[i].fn) continue;
+    bus.hook[i].fn = hook;
+    bus.hook[i].ctx = ctx;
+    return 0;
+  }
+  return -1;
+}
+
+int hostAddTimer(hostTimerHook timer, void *ctx, uint32_t period) {
+  int i;
+
+  if (period == 0) return -1;
+  for (i = 0; i < EPOS_HOST_HOOKS; i++)
+    if (bus.timer[i].fn == timer && bus.timer[i].ctx == ctx) return 0;
+  for (i = 0; i < EPOS_HOST_HOOKS; i++) {
+    if (bus.timer[i].fn) continue;
+    bus.timer[i].fn = timer;
+    bus.timer[i].ctx = ctx;
+    bus.timer[i].period = period;
+    bus.timer[i].next = bus.now + period;
+    return 0;
+  }
+  return -1;
+}
+
+void hostSetBitrate(uint32_t bitrate) {
+  bus.bitrate = bitrate;
+}
+
+uint64_t hostTimeUs(void) {
+  return bus.now;
+}
+
+uint32_t eposHostCycles(void) {
+  return (uint32_t)(bus.now * EPOS_CYCLES_PER_US);
+}
+
+uint64_t hostCPUNs(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void hostGetCANStats(hostCANStats_t *stats) {
+  *stats = bus.stats;
+}
+
+
+/* bits of a base format data frame: the 34 + 8 * DLC bits from SOF to
+   the CRC, which are stuffed, and 13 fixed ones (CRC delimiter, ACK,
+   EOF, intermission); the stuff bits are in *stuff */
+static uint32_t frameBits(const CanRxMsgTypeDef *f, uint32_t *stuff) {
+  uint8_t bits[34 + 64];
+  uint16_t crc = 0;
+  int n = 0, i, run = 0;
+  uint8_t last = 2, b;
+
+  bits[n++] = 0;                                    // SOF
+  for (i = 10; i >= 0; i--) bits[n++] = (f->StdId >> i) & 1;
+  bits[n++] = 0;                                    // RTR
+  bits[n++] = 0;                                    // IDE
+  bits[n++] = 0;                                    // r0
+  for (i = 3; i >= 0; i--) bits[n++] = (f->DLC >> i) & 1;
+  for (i = 0; i < 8 * (int)f->DLC; i++) bits[n++] = (f->Data[i / 8] >> (7 - i % 8)) & 1;
+  for (i = 0; i < n; i++) {                         // CRC-15, ISO 11898-1 10.4.2.6
+    b = ((crc >> 14) & 1) ^ bits[i];
+    crc = (crc << 1) & 0x7FFF;
+    if (b) crc ^= 0x4599;
+  }
+  for (i = 14; i >= 0; i--) bits[n++] = (crc >> i) & 1;
+
+  // a stuff bit after 5 equal bits, it starts the next run itself
+  *stuff = 0;
+  for (i = 0; i < n; i++) {
+    if (bits[i] == last) run++;
+    else run = 1;
+    last = bits[i];
+    if (run == 5) {
+      (*stuff)++;
+      last ^= 1;
+      run = 1;
+    }
+  }
+  return n + 13;
+}
+
+/* duration of the frame on the bus, stuff bits included */
+static uint32_t frameUs(const CanRxMsgTypeDef *f) {
+  uint32_t stuff, bits = frameBits(f, &stuff);
+  uint32_t rate = bus.bitrate ? bus.bitrate : 1000000;
+  uint64_t us = ((uint64_t)(bits + stuff) * 1000000 + rate - 1) / rate;
+
+  bus.stats.Bits += bits;
+  bus.stats.StuffBits += stuff;
+  return us ? (uint32_t)us : 1;
+}
+
+/* bring the TSR in line with the mailbox model: take over aborts and
+   mailboxes the driver filled itself, and show which are empty */
+static void syncRegs(void) {
+  CAN_TypeDef *can = hcan1.Instance;
+  uint32_t tsr = can->TSR;
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    if ((tsr & (CAN_TSR_ABRQ0 << (8 * i))) && bus.mbState[i] == MB_PENDING) {
+      bus.mbState[i] = MB_FREE;
+      can->sTxMailBox[i].TIR &= ~CAN_TI0R_TXRQ;
+      bus.stats.Aborted++;
+    }
+    if (bus.mbState[i] == MB_FREE && (can->sTxMailBox[i].TIR & CAN_TI0R_TXRQ))
+      bus.mbState[i] = MB_PENDING;
+  }
+  tsr &= ~(CAN_TSR_ABRQ0 | CAN_TSR_ABRQ1 | CAN_TSR_ABRQ2
+           | CAN_TSR_TME0 | CAN_TSR_TME1 | CAN_TSR_TME2);
+  for (i = 0; i < 3; i++)
+    if (bus.mbState[i] == MB_FREE) tsr |= CAN_TSR_TME0 << i;
+  can->TSR = tsr;
+}
+
+/* start the frame that wins the arbitration, if any is ready */
+static void startFrame(void) {
+  CAN_TypeDef *can = hcan1.Instance;
+  uint32_t best = 0xFFFFFFFF, id;
+  int i, mb = -1, node = -1;
+
+  for (i = 0; i < 3; i++) {
+    if (bus.mbState[i] != MB_PENDING) continue;
+    id = can->sTxMailBox[i].TIR >> 21;
+    if (id < best) { best = id; mb = i; }
+  }
+  for (i = 0; i < bus.nodeCount; i++) {
+    if (bus.nodeQueue[i].ready > bus.now) continue;
+    if (bus.nodeQueue[i].msg.StdId < best) {
+      best = bus.nodeQueue[i].msg.StdId;
+      node = i;
+      mb = -1;
+    }
+  }
+  if (mb < 0 && node < 0) return;
+
+  memset(&bus.onBus, 0, sizeof(bus.onBus));
+  if (mb >= 0) {
+    bus.mbState[mb] = MB_SENDING;
+    bus.onBus.StdId = can->sTxMailBox[mb].TIR >> 21;
+    bus.onBus.DLC = can->sTxMailBox[mb].TDTR & 0x0F;
+    for (i = 0; i < 4; i++) {
+      bus.onBus.Data[i] = can->sTxMailBox[mb].TDLR >> (8 * i);
+      bus.onBus.Data[4 + i] = can->sTxMailBox[mb].TDHR >> (8 * i);
+    }
+  } else {
+    bus.onBus = bus.nodeQueue[node].msg;
+    memmove(&bus.nodeQueue[node], &bus.nodeQueue[node + 1],
+            (bus.nodeCount - node - 1) * sizeof(nodeFrame_t));
+    bus.nodeCount--;
+  }
+  if (bus.onBus.DLC > 8) bus.onBus.DLC = 8;
+  bus.busy = true;
+  bus.sending = mb;
+  bus.busEnd = bus.now + frameUs(&bus.onBus);
+  bus.stats.BusyUs += bus.busEnd - bus.now;
+}
+
+static void finishFrame(void) {
+  CAN_TypeDef *can = hcan1.Instance;
+  CanRxMsgTypeDef msg = bus.onBus;
+  bool fromDriver = bus.sending >= 0;
+  int i;
+
+  bus.busy = false;
+  if (fromDriver) {
+    bus.mbState[bus.sending] = MB_FREE;
+    can->sTxMailBox[bus.sending].TIR &= ~CAN_TI0R_TXRQ;
+    can->TSR |= CAN_TSR_RQCP0 << (8 * bus.sending);
+    if (can->IER & CAN_IT_TME) bus.txIrq = true;
+    bus.stats.TxFrames++;
+  } else {
+    if (bus.fifoCount < EPOS_HOST_RXFIFO) bus.fifo[bus.fifoCount++] = msg;
+    else bus.stats.RxOverruns++;
+    bus.stats.NodeFrames++;
+  }
+  syncRegs();
+  for (i = 0; i < EPOS_HOST_HOOKS; i++)
+    if (bus.hook[i].fn) bus.hook[i].fn(&msg, fromDriver, bus.hook[i].ctx);
+}
+
+/* run the "interrupt handlers" that are pending */
+static void dispatch(void) {
+  CanRxMsgTypeDef *dst;
+
+  if (bus.masked || bus.inIrq) return;
+  bus.inIrq = true;
+  for (;;) {
+    if (bus.txIrq) {
+      bus.txIrq = false;
+      HAL_CAN_TxCpltCallback(bus.txHandle ? bus.txHandle : &hcan1);
+      continue;
+    }
+    if (bus.rxArmed && bus.fifoCount > 0 && bus.rxHandle && bus.rxHandle->pRxMsg) {
+      dst = bus.rxHandle->pRxMsg;
+      *dst = bus.fifo[0];
+      dst->FIFONumber = CAN_FIFO0;
+      memmove(&bus.fifo[0], &bus.fifo[1], (bus.fifoCount - 1) * sizeof(bus.fifo[0]));
+      bus.fifoCount--;
+      bus.rxArmed = false;
+      HAL_CAN_RxCpltCallback(bus.rxHandle);
+      continue;
+    }
+    break;
+  }
+  bus.inIrq = false;
+}
+
+
+void hostAdvance(uint32_t us) {
+  uint64_t target = bus.now + us, next;
+  int i;
+
+  for (;;) {
+    syncRegs();
+    if (!bus.busy) startFrame();
+    next = UINT64_MAX;
+    if (bus.busy) next = bus.busEnd;
+    else
+      for (i = 0; i < bus.nodeCount; i++)
+        if (bus.nodeQueue[i].ready < next) next = bus.nodeQueue[i].ready;
+    for (i = 0; i < EPOS_HOST_HOOKS; i++)
+      if (bus.timer[i].fn && bus.timer[i].next < next) next = bus.timer[i].next;
+    if (next > target) break;
+    if (next > bus.now) bus.now = next;
+    if (bus.busy && bus.now >= bus.busEnd) finishFrame();
+    for (i = 0; i < EPOS_HOST_HOOKS; i++) {
+      if (!bus.timer[i].fn || bus.timer[i].next > bus.now) continue;
+      bus.timer[i].next += bus.timer[i].period;
+      bus.timer[i].fn(bus.timer[i].ctx);
+    }
+    dispatch();
+  }
+  bus.now = target;
+  dispatch();
+}
+
+void hostIdle(void) {
+  int i;
+
+  for (;;) {
+    syncRegs();
+    for (i = 0; i < 3 && bus.mbState[i] == MB_FREE; i++) ;
+    if (!bus.busy && i == 3 && bus.nodeCount == 0 && !bus.txIrq
+        && !(bus.rxArmed && bus.fifoCount > 0))
+      return;
+    hostAdvance(10);
+  }
+}
+
+int hostCANSend(uint32_t StdId, uint8_t DLC, const uint8_t *data, uint32_t delay) {
+  nodeFrame_t *f;
+
+  if (bus.nodeCount == EPOS_HOST_TXQUEUE) return -1;
+  f = &bus.nodeQueue[bus.nodeCount++];
+  memset(f, 0, sizeof(*f));
+  f->msg.StdId = StdId;
+  f->msg.IDE = CAN_ID_STD;
+  f->msg.RTR = CAN_RTR_DATA;
+  f->msg.DLC = DLC > 8 ? 8 : DLC;
+  if (data) memcpy(f->msg.Data, data, f->msg.DLC);
+  f->ready = bus.now + delay;
+  return 0;
+}
+
+
+/************************************************************/
+/*            HAL                                           */
+/************************************************************/
+
+HAL_StatusTypeDef HAL_CAN_Transmit_IT(CAN_HandleTypeDef *hcan) {
+  CAN_TypeDef *can = hcan->Instance;
+  CanTxMsgTypeDef *m = hcan->pTxMsg;
+  int mb;
+
+  syncRegs();
+  if (can->TSR & CAN_TSR_TME0) mb = 0;
+  else if (can->TSR & CAN_TSR_TME1) mb = 1;
+  else if (can->TSR & CAN_TSR_TME2) mb = 2;
+  else return HAL_BUSY;
+
+  can->sTxMailBox[mb].TIR = m->StdId << 21;
+  can->sTxMailBox[mb].TDTR = m->DLC & 0x0F;
+  can->sTxMailBox[mb].TDLR = ((uint32_t)m->Data[3] << 24) | ((uint32_t)m->Data[2] << 16)
+                           | ((uint32_t)m->Data[1] << 8) | m->Data[0];
+  can->sTxMailBox[mb].TDHR = ((uint32_t)m->Data[7] << 24) | ((uint32_t)m->Data[6] << 16)
+                           | ((uint32_t)m->Data[5] << 8) | m->Data[4];
+  can->sTxMailBox[mb].TIR |= CAN_TI0R_TXRQ;
+  can->IER |= CAN_IT_TME;
+  bus.txHandle = hcan;
+  syncRegs();
+  return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_CAN_Receive_IT(CAN_HandleTypeDef *hcan, uint8_t FIFONumber) {
+  (void)FIFONumber;
+  bus.rxHandle = hcan;
+  bus.rxArmed = true;
+  return HAL_OK;
+}
+
+void hostCANEnableIT(CAN_HandleTypeDef *hcan, uint32_t it) {
+  hcan->Instance->IER |= it;
+  bus.txHandle = hcan;
+  syncRegs();
+}
+
+/* transports with a Poll, like the fault injection, hand on what they
+   hold back while the driver waits, as on the Linux port */
+static void pollTransport(void) {
+  if (!bus.masked && !bus.inIrq) pollEPOSTransport();
+}
+
+void HAL_Delay(uint32_t Delay) {
+  uint32_t i;
+
+  for (i = 0; i < Delay; i++) {
+    pollTransport();
+    hostAdvance(1000);
+  }
+  pollTransport();
+}
+
+uint32_t HAL_GetTick(void) {
+  hostAdvance(EPOS_HOST_POLL_US);
+  pollTransport();
+  return (uint32_t)(bus.now / 1000);
+}
+
+uint32_t __get_PRIMASK(void) {
+  syncRegs();
+  return bus.masked;
+}
+
+void __disable_irq(void) {
+  syncRegs();
+  bus.masked = true;
+}
+
+void __enable_irq(void) {
+  bus.masked = false;
+  syncRegs();
+  dispatch();
+}
@@ -0,0 +1,89 @@
+/*! \file epos_host.h
+
+  simulated CAN bus, time and RTT of the host build
+
+  Time is virtual: it advances by EPOS_HOST_POLL_US with every
+  HAL_GetTick() call, so the busy-waiting loops of the driver make
+  progress, and by whole ms in HAL_Delay(). While time advances the bus
+  sends what is waiting in the three transmit mailboxes and in the queue
+  of the simulated nodes, lowest COB-ID first, each frame taking its
+  time on the bus. The completion of a transmission and the reception
+  of a frame call HAL_CAN_TxCpltCallback() and HAL_CAN_RxCpltCallback()
+  like the interrupts on the target, but not while __disable_irq() is
+  in effect or another callback is running. HAL_GetTick() and
+  HAL_Delay() also call pollEPOSTransport() there.
+
+*/
+
+#ifndef _EPOS_HOST_H
+#define _EPOS_HOST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "stm32f4xx_hal.h"
+
+/*! \brief us every HAL_GetTick() call takes */
+#ifndef EPOS_HOST_POLL_US
+#define EPOS_HOST_POLL_US  1
+#endif
+/*! \brief frames the simulated nodes can have waiting for the bus */
+#define EPOS_HOST_TXQUEUE  512
+/*! \brief depth of the receive FIFO of the bxCAN */
+#define EPOS_HOST_RXFIFO   3
+/*! \brief number of RTT up-channels */
+#define EPOS_HOST_RTT_CHANNELS  8
+
+/*! \brief the CAN handle the tests open EPOS on */
+extern CAN_HandleTypeDef hcan1;
+
+/*! \brief number of frame hooks and timers */
+#define EPOS_HOST_HOOKS  4
+
+/*! \brief called for every frame when its transmission is complete;
+   fromDriver tells frames of libEPOS from those of the nodes */
+typedef void (*hostFrameHook)(const CanRxMsgTypeDef *frame, bool fromDriver, void *ctx);
+/*! \brief called every 'period' us of virtual time, independent of the
+   interrupt mask of the driver (it is the nodes' time, not the MCU's) */
+typedef void (*hostTimerHook)(void *ctx);
+
+/*! \brief counters of the simulated bus */
+typedef struct hostCANStats_s {
+  uint32_t TxFrames;     ///< frames sent by the driver
+  uint32_t NodeFrames;   ///< frames sent by the simulated nodes
+  uint32_t RxOverruns;   ///< frames lost because the receive FIFO was full
+  uint32_t Aborted;      ///< mailboxes aborted with ABRQ
+  uint64_t BusyUs;       ///< time the bus was busy
+  uint64_t Bits;         ///< bits of all frames, without stuff bits
+  uint64_t StuffBits;    ///< stuff bits of all frames
+} hostCANStats_t;
+
+/*! \brief time 0, empty bus and RTT channels, no hooks and timers */
+void hostReset(void);
+/*! \brief add a frame hook, adding the same hook again does nothing */
+int hostAddFrameHook(hostFrameHook hook, void *ctx);
+/*! \brief add a timer, adding the same timer again does nothing */
+int hostAddTimer(hostTimerHook timer, void *ctx, uint32_t period);
+/*! \brief bitrate the frame times are computed for, default 1 Mbit/s;
+   a frame takes 47 + 8 * DLC bits plus the stuff bits its content
+   needs, arbitration goes to the lowest COB-ID when the bus is idle */
+void hostSetBitrate(uint32_t bitrate);
+/*! \brief a simulated node sends a frame 'delay' us from now */
+int hostCANSend(uint32_t StdId, uint8_t DLC, const uint8_t *data, uint32_t delay);
+/*! \brief let time pass */
+void hostAdvance(uint32_t us);
+/*! \brief let time pass until nothing is waiting for the bus any more */
+void hostIdle(void);
+uint64_t hostTimeUs(void);
+/*! \brief real time of the host CPU in ns, CLOCK_MONOTONIC, for what a
+   test or a tool measures of the driver itself, not the virtual time */
+uint64_t hostCPUNs(void);
+void hostGetCANStats(hostCANStats_t *stats);
+
+/*! \brief empty all RTT up-channels */
+void hostRTTReset(void);
+/*! \brief take up to max bytes out of an RTT up-channel */
+unsigned hostRTTRead(unsigned ch, void *buf, unsigned max);
+/*! \brief copy SEGGER_RTT_printf() output to stderr, off by default */
+void hostRTTEcho(bool on);
+
+#endif
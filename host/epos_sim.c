@@ -0,0 +1,898 @@
+/*! \file epos_sim.c
+
+\brief virtual EPOS2 nodes of the host build
+
+See epos_sim.h. The nodes hang on the frame hook and a timer of
+epos_host.c: frames are dispatched by the node ID in the COB-ID, NMT
+commands go to all nodes, and every EPOS_SIM_STEP_US all nodes advance
+their state machine, dynamics and producers in the order of their IDs.
+
+What is simplified against the real device:
+- no following error, the demand position is the actual position
+- state transitions take effect at once, there is no refresh or
+  measure init phase when switching on
+- new set-points in profile position mode are taken on a rising edge of
+  controlword bit 4 or whenever bit 5 (change immediately) is set, the
+  position mode takes 0x607A and RPDO3 at once
+- homing drives to position 0 and references there, whatever the method
+- the recorder samples at most once per step
+
+*/
+
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "epos.h"
+#include "epos_host.h"
+#include "epos_sim.h"
+
+/* SDO abort codes, CiA301 7.2.4.3.17 */
+#define ABORT_TOGGLE    0x05030000
+#define ABORT_COMMAND   0x05040001
+#define ABORT_MEMORY    0x05040005
+#define ABORT_WRITEONLY 0x06010001
+#define ABORT_READONLY  0x06010002
+#define ABORT_NOOBJECT  0x06020000
+#define ABORT_LENGTH    0x06070010
+#define ABORT_NOSUB     0x06090011
+#define ABORT_RANGE     0x06090030
+
+/* controlword bits used by the nodes */
+#define CW_NEWSETPOINT  0x0010
+#define CW_IMMEDIATELY  0x0020
+#define CW_RELATIVE     0x0040
+#define CW_FAULTRESET   0x0080
+#define CW_HALT         0x0100
+
+#define DEVICE_NAME     "EPOS2 24/5 (simulated)"
+
+static eposSim_t *nodes[128];
+
+/* statusword of every state, firmware spec 8.1.1 */
+static const uint16_t statusTable[] = {
+  [EPOS_START]         = 0x0000,
+  [EPOS_NOTREADY]      = 0x0100,
+  [EPOS_SWITCHONDIS]   = 0x0140,
+  [EPOS_READY]         = 0x0121,
+  [EPOS_SWITCHEDON]    = 0x0123,
+  [EPOS_REFRESH]       = 0x4123,
+  [EPOS_MEASUREINIT]   = 0x4133,
+  [EPOS_OPENABLE]      = 0x0137,
+  [EPOS_QUICKSTOP]     = 0x0117,
+  [EPOS_FAULTREACTDIS] = 0x010F,
+  [EPOS_FAULTREACTEN]  = 0x011F,
+  [EPOS_FAULT]         = 0x0108,
+};
+
+
+/************************************************************/
+/*            object dictionary                             */
+/************************************************************/
+
+enum { RO = 1, WO = 2, RW = 3, CONST = 5 };
+
+typedef struct {
+  uint16_t Index;
+  uint8_t SubIndex;
+  uint8_t Access;
+  uint8_t Size;             ///< bytes
+  uint32_t Value;           ///< offset into eposSim_t, the value if CONST
+} simObj_t;
+
+#define OBJ(i, s, a, f) { i, s, a, sizeof(((eposSim_t *)0)->f), offsetof(eposSim_t, f) }
+#define VAL(i, s, n, v) { i, s, CONST, n, v }
+
+static const simObj_t objects[] = {
+  VAL(0x1000, 0, 4, 0x00020192),              // device type: CiA402 servo
+  OBJ(0x1001, 0, RO, ErrorRegister),
+  OBJ(0x1003, 0, RW, ErrCount),
+  OBJ(0x1003, 1, RO, ErrHistory[0]),
+  OBJ(0x1003, 2, RO, ErrHistory[1]),
+  OBJ(0x1003, 3, RO, ErrHistory[2]),
+  OBJ(0x1003, 4, RO, ErrHistory[3]),
+  OBJ(0x1003, 5, RO, ErrHistory[4]),
+  OBJ(0x1017, 0, RW, Heartbeat),
+  VAL(0x1018, 0, 1, 4),
+  VAL(0x1018, 1, 4, 0x000000FB),              // maxon motor
+  VAL(0x1018, 2, 4, 0x03710000),              // EPOS2 24/5
+  VAL(0x1018, 3, 4, 0x21260000),
+  VAL(0x1018, 4, 4, 0),
+  VAL(0x2003, 1, 2, 0x2126),                  // software version
+  OBJ(0x2005, 0, RW, RS232Timeout),
+  OBJ(0x2010, 0, RW, RecControl),
+  OBJ(0x2011, 0, RW, RecConfig),
+  OBJ(0x2012, 0, RW, RecPeriod),
+  OBJ(0x2013, 0, RW, RecPreTrigger),
+  OBJ(0x2014, 0, RW, RecChannels),
+  OBJ(0x2015, 1, RW, RecIndex[0]),
+  OBJ(0x2015, 2, RW, RecIndex[1]),
+  OBJ(0x2015, 3, RW, RecIndex[2]),
+  OBJ(0x2015, 4, RW, RecIndex[3]),
+  OBJ(0x2016, 1, RW, RecSubIndex[0]),
+  OBJ(0x2016, 2, RW, RecSubIndex[1]),
+  OBJ(0x2016, 3, RW, RecSubIndex[2]),
+  OBJ(0x2016, 4, RW, RecSubIndex[3]),
+  OBJ(0x2017, 0, RO, RecStatus),
+  OBJ(0x2018, 0, RO, RecMaxSamples),
+  OBJ(0x2019, 0, RO, RecSamples),
+  OBJ(0x201A, 0, RO, RecStart),
+  OBJ(0x2071, 1, RO, DInputs),
+  OBJ(0x2071, 3, RW, DInputPolarity),
+  OBJ(0x2078, 1, RW, DOutputs),
+  OBJ(0x6040, 0, RW, Controlword),
+  OBJ(0x6041, 0, RO, Statusword),
+  OBJ(0x6060, 0, WO, OpMode),
+  OBJ(0x6061, 0, RO, OpMode),
+  OBJ(0x6062, 0, RO, PositionDemand),
+  OBJ(0x6064, 0, RO, Position),
+  OBJ(0x6067, 0, RW, PositionWindow),
+  OBJ(0x606B, 0, RO, VelocityDemand),
+  OBJ(0x606C, 0, RO, Velocity),
+  OBJ(0x6078, 0, RO, Current),
+  OBJ(0x607A, 0, RW, TargetPosition),
+  OBJ(0x607F, 0, RW, MaxProfileVelocity),
+  OBJ(0x6081, 0, RW, ProfileVelocity),
+  OBJ(0x6083, 0, RW, ProfileAcceleration),
+  OBJ(0x6084, 0, RW, ProfileDeceleration),
+  OBJ(0x6085, 0, RW, QuickStopDeceleration),
+  OBJ(0x6086, 0, RW, MotionProfileType),
+  OBJ(0x6098, 0, RW, HomingMethod),
+  OBJ(0x60FF, 0, RW, TargetVelocity),
+};
+
+/* the entry of Index/SubIndex or the abort code why there is none */
+static const simObj_t *findObject(uint16_t Index, uint8_t SubIndex, uint32_t *code) {
+  const simObj_t *o;
+  bool index = false;
+
+  for (o = objects; o < objects + sizeof(objects) / sizeof(objects[0]); o++) {
+    if (o->Index != Index) continue;
+    if (o->SubIndex == SubIndex) return o;
+    index = true;
+  }
+  *code = index ? ABORT_NOSUB : ABORT_NOOBJECT;
+  return NULL;
+}
+
+static uint32_t getValue(const eposSim_t *s, const simObj_t *o) {
+  const uint8_t *p = (const uint8_t *)s + o->Value;
+
+  if (o->Access == CONST) return o->Value;
+  switch (o->Size) {
+  case 1: return *p;
+  case 2: return *(const uint16_t *)p;
+  default: return *(const uint32_t *)p;
+  }
+}
+
+static void setValue(eposSim_t *s, const simObj_t *o, uint32_t v) {
+  uint8_t *p = (uint8_t *)s + o->Value;
+
+  switch (o->Size) {
+  case 1: *p = (uint8_t)v; break;
+  case 2: *(uint16_t *)p = (uint16_t)v; break;
+  default: *(uint32_t *)p = v; break;
+  }
+}
+
+static uint32_t readRecorder(eposSim_t *s, uint8_t *buf, uint32_t *len);
+static void controlRecorder(eposSim_t *s);
+static void control(eposSim_t *s, uint16_t cw);
+
+/* read Index/SubIndex into buf (at most *len bytes), little endian;
+   returns 0 or an abort code */
+static uint32_t odRead(eposSim_t *s, uint16_t Index, uint8_t SubIndex,
+                       uint8_t *buf, uint32_t *len) {
+  const simObj_t *o;
+  uint32_t code, v;
+  int i;
+
+  if (Index == 0x1008 || Index == 0x201B) {
+    if (SubIndex != 0) return ABORT_NOSUB;
+    if (Index == 0x201B) return readRecorder(s, buf, len);
+    if (*len < sizeof(DEVICE_NAME) - 1) return ABORT_MEMORY;
+    *len = sizeof(DEVICE_NAME) - 1;
+    memcpy(buf, DEVICE_NAME, *len);
+    return 0;
+  }
+  if (!(o = findObject(Index, SubIndex, &code))) return code;
+  if (!(o->Access & RO)) return ABORT_WRITEONLY;
+  v = getValue(s, o);
+  if (o->Index == 0x1018 && o->SubIndex == 4) v = s->Node_ID;   // serial number
+  for (i = 0; i < o->Size; i++) buf[i] = (v >> (8 * i)) & 0xFF;
+  *len = o->Size;
+  return 0;
+}
+
+/* write len bytes of buf to Index/SubIndex, len 0: size not indicated;
+   returns 0 or an abort code */
+static uint32_t odWrite(eposSim_t *s, uint16_t Index, uint8_t SubIndex,
+                        const uint8_t *buf, uint32_t len) {
+  const simObj_t *o;
+  uint32_t code, v = 0;
+  int i;
+
+  if (Index == 0x1008 || Index == 0x201B) return ABORT_READONLY;
+  if (!(o = findObject(Index, SubIndex, &code))) return code;
+  if (!(o->Access & WO) || o->Access == CONST) return ABORT_READONLY;
+  if (len != 0 && len != o->Size) return ABORT_LENGTH;
+  for (i = 0; i < o->Size; i++) v |= (uint32_t)buf[i] << (8 * i);
+
+  switch (Index) {
+  case 0x1003:                              // only the history can be cleared
+    if (v != 0) return ABORT_RANGE;
+    memset(s->ErrHistory, 0, sizeof(s->ErrHistory));
+    break;
+  case 0x2014:
+    if (v == 0 || v > EPOS_SIM_RECCH) return ABORT_RANGE;
+    break;
+  case 0x6040:
+    control(s, v);
+    return 0;
+  case 0x6060:
+    switch ((uint8_t)v) {
+    case PPM: case PVM: case PM: case VM: case HM: break;
+    default: return ABORT_RANGE;
+    }
+    break;
+  }
+  setValue(s, o, v);
+
+  switch (Index) {
+  case 0x1017:
+    s->hbElapsed = 0;
+    break;
+  case 0x2010:
+    controlRecorder(s);
+    break;
+  case 0x607A:
+    if (s->OpMode == (int8_t)PM) s->setPoint = s->TargetPosition;
+    break;
+  }
+  return 0;
+}
+
+
+/************************************************************/
+/*            frames                                        */
+/************************************************************/
+
+static void send(eposSim_t *s, uint16_t cobid, uint8_t DLC, const uint8_t *data,
+                 uint32_t delay) {
+  if (s->Silent) return;
+  hostCANSend(cobid, DLC, data, delay);
+}
+
+static void sendHeartbeat(eposSim_t *s) {
+  uint8_t d = s->NMTState;
+
+  send(s, 0x700 + s->Node_ID, 1, &d, 0);
+}
+
+static void sendEmcy(eposSim_t *s, uint16_t code) {
+  uint8_t d[8] = { code & 0xFF, code >> 8, s->ErrorRegister, 0, 0, 0, 0, 0 };
+
+  if (s->NMTState == EPOS_NMT_STOPPED) return;
+  send(s, 0x80 + s->Node_ID, 8, d, 0);
+}
+
+static void updateStatus(eposSim_t *s);
+
+/* TPDO1 right away when the statusword changed */
+static void sendStatus(eposSim_t *s, uint32_t delay) {
+  uint8_t d[2];
+
+  updateStatus(s);
+  if (s->Statusword == s->sentStatus) return;
+  s->sentStatus = s->Statusword;
+  if (s->NMTState != EPOS_NMT_OPERATIONAL || !(s->TPDOMask & EPOS_SIM_TPDO1)) return;
+  d[0] = s->Statusword & 0xFF;
+  d[1] = s->Statusword >> 8;
+  send(s, 0x180 + s->Node_ID, 2, d, delay);
+}
+
+/* TPDO2..4 when their value changed and the inhibit time is over */
+static void sendPDOs(eposSim_t *s) {
+  uint64_t now = hostTimeUs();
+  uint8_t d[6];
+  int32_t v;
+  int k;
+
+  if (s->NMTState != EPOS_NMT_OPERATIONAL) return;
+  d[0] = s->Statusword & 0xFF;
+  d[1] = s->Statusword >> 8;
+  for (k = 0; k < 3; k++) {
+    if (!(s->TPDOMask & (EPOS_SIM_TPDO2 << k))) continue;
+    if (now - s->lastTPDO[k] < s->PDOInhibit) continue;
+    switch (k) {
+    case 0:
+      if (s->Current == s->sentCurrent) continue;
+      s->sentCurrent = s->Current;
+      d[2] = s->Current & 0xFF;
+      d[3] = (s->Current >> 8) & 0xFF;
+      send(s, 0x280 + s->Node_ID, 4, d, 0);
+      break;
+    default:
+      v = k == 1 ? s->Position : s->Velocity;
+      if (v == (k == 1 ? s->sentPosition : s->sentVelocity)) continue;
+      if (k == 1) s->sentPosition = v;
+      else s->sentVelocity = v;
+      d[2] = v & 0xFF;
+      d[3] = (v >> 8) & 0xFF;
+      d[4] = (v >> 16) & 0xFF;
+      d[5] = (v >> 24) & 0xFF;
+      send(s, 0x280 + 0x100 * k + s->Node_ID, 6, d, 0);
+      break;
+    }
+    s->lastTPDO[k] = now;
+  }
+}
+
+static void sendAbort(eposSim_t *s, uint16_t Index, uint8_t SubIndex, uint32_t code) {
+  uint8_t d[8] = { 0x80, Index & 0xFF, Index >> 8, SubIndex,
+                   code & 0xFF, (code >> 8) & 0xFF, (code >> 16) & 0xFF, code >> 24 };
+
+  s->seg.active = false;
+  s->SDOAborts++;
+  send(s, 0x580 + s->Node_ID, 8, d, s->SDODelay);
+}
+
+/* SDO server, CiA301 7.2.4.3 */
+static void serveSDO(eposSim_t *s, const uint8_t *d) {
+  uint8_t r[8] = { 0 };
+  uint16_t Index = d[1] | (d[2] << 8);
+  uint8_t SubIndex = d[3];
+  uint32_t len, code, n;
+
+  if (s->NMTState != EPOS_NMT_PREOP && s->NMTState != EPOS_NMT_OPERATIONAL) return;
+  if ((d[0] >> 5) == 4) {                   // abort by the client
+    s->seg.active = false;
+    return;
+  }
+  s->SDORequests++;
+
+  switch (d[0] >> 5) {
+  case 2:                                   // initiate upload
+    s->seg.active = false;
+    len = sizeof(s->seg.buf);
+    if ((code = odRead(s, Index, SubIndex, s->seg.buf, &len))) break;
+    r[1] = d[1]; r[2] = d[2]; r[3] = d[3];
+    if (len <= 4) {
+      r[0] = 0x43 | ((4 - len) << 2);
+      memcpy(&r[4], s->seg.buf, len);
+    } else {
+      r[0] = 0x41;
+      r[4] = len & 0xFF;
+      r[5] = (len >> 8) & 0xFF;
+      s->seg.active = true;
+      s->seg.upload = true;
+      s->seg.Index = Index;
+      s->seg.SubIndex = SubIndex;
+      s->seg.toggle = 0;
+      s->seg.len = len;
+      s->seg.pos = 0;
+    }
+    send(s, 0x580 + s->Node_ID, 8, r, s->SDODelay);
+    return;
+
+  case 3:                                   // upload segment
+    if (!s->seg.active || !s->seg.upload) {
+      code = ABORT_COMMAND;
+      break;
+    }
+    Index = s->seg.Index;
+    SubIndex = s->seg.SubIndex;
+    if ((d[0] & 0x10) != s->seg.toggle) {
+      code = ABORT_TOGGLE;
+      break;
+    }
+    n = s->seg.len - s->seg.pos;
+    if (n > 7) n = 7;
+    memcpy(&r[1], &s->seg.buf[s->seg.pos], n);
+    s->seg.pos += n;
+    r[0] = s->seg.toggle | ((7 - n) << 1);
+    if (s->seg.pos == s->seg.len) {
+      r[0] |= 0x01;
+      s->seg.active = false;
+    }
+    s->seg.toggle ^= 0x10;
+    send(s, 0x580 + s->Node_ID, 8, r, s->SDODelay);
+    return;
+
+  case 1:                                   // initiate download
+    s->seg.active = false;
+    if (d[0] & 0x02) {                      // expedited
+      n = (d[0] & 0x01) ? 4 - ((d[0] >> 2) & 0x03) : 0;
+      if ((code = odWrite(s, Index, SubIndex, &d[4], n))) break;
+    } else {
+      len = (d[0] & 0x01) ? d[4] | (d[5] << 8) | ((uint32_t)d[6] << 16) | ((uint32_t)d[7] << 24) : 0;
+      if (len > sizeof(s->seg.buf)) {
+        code = ABORT_MEMORY;
+        break;
+      }
+      s->seg.active = true;
+      s->seg.upload = false;
+      s->seg.Index = Index;
+      s->seg.SubIndex = SubIndex;
+      s->seg.toggle = 0;
+      s->seg.len = len;
+      s->seg.pos = 0;
+    }
+    r[0] = 0x60;
+    r[1] = d[1]; r[2] = d[2]; r[3] = d[3];
+    send(s, 0x580 + s->Node_ID, 8, r, s->SDODelay);
+    if (Index == 0x6040) sendStatus(s, s->SDODelay);
+    return;
+
+  case 0:                                   // download segment
+    if (!s->seg.active || s->seg.upload) {
+      code = ABORT_COMMAND;
+      break;
+    }
+    Index = s->seg.Index;
+    SubIndex = s->seg.SubIndex;
+    if ((d[0] & 0x10) != s->seg.toggle) {
+      code = ABORT_TOGGLE;
+      break;
+    }
+    n = 7 - ((d[0] >> 1) & 0x07);
+    if (s->seg.pos + n > sizeof(s->seg.buf)) {
+      code = ABORT_MEMORY;
+      break;
+    }
+    memcpy(&s->seg.buf[s->seg.pos], &d[1], n);
+    s->seg.pos += n;
+    r[0] = 0x20 | s->seg.toggle;
+    s->seg.toggle ^= 0x10;
+    if (d[0] & 0x01) {
+      s->seg.active = false;
+      if (s->seg.len && s->seg.len != s->seg.pos) {
+        code = ABORT_LENGTH;
+        break;
+      }
+      if ((code = odWrite(s, Index, SubIndex, s->seg.buf, s->seg.pos))) break;
+    }
+    send(s, 0x580 + s->Node_ID, 8, r, s->SDODelay);
+    return;
+
+  default:
+    code = ABORT_COMMAND;
+    break;
+  }
+  sendAbort(s, Index, SubIndex, code);
+}
+
+/* RPDO1..4 of the default mapping, see the PDO functions of epos.c */
+static void receivePDO(eposSim_t *s, const CanRxMsgTypeDef *f) {
+  int32_t v = 0;
+
+  if (s->NMTState != EPOS_NMT_OPERATIONAL || f->DLC < 2) return;
+  if (f->DLC >= 6)
+    v = f->Data[2] | (f->Data[3] << 8) | (f->Data[4] << 16) | ((uint32_t)f->Data[5] << 24);
+  switch (f->StdId & 0x780) {
+  case 0x300:                               // controlword + mode
+    if (f->DLC >= 3) s->OpMode = (int8_t)f->Data[2];
+    break;
+  case 0x400:                               // controlword + target position
+    if (f->DLC < 6) return;
+    s->TargetPosition = v;
+    s->setPoint = v;
+    break;
+  case 0x500:                               // controlword + target velocity
+    if (f->DLC < 6) return;
+    s->TargetVelocity = v;
+    break;
+  }
+  control(s, f->Data[0] | (f->Data[1] << 8));
+  sendStatus(s, 0);
+}
+
+
+/************************************************************/
+/*            device                                        */
+/************************************************************/
+
+static void defaults(eposSim_t *s) {
+  uint8_t id = s->Node_ID;
+
+  memset(s, 0, offsetof(eposSim_t, seg));
+  s->seg.active = false;
+  s->Node_ID = id;
+  s->SDODelay = 150;
+  s->PDOInhibit = 10000;
+  s->TPDOMask = EPOS_SIM_TPDO1 | EPOS_SIM_TPDO2 | EPOS_SIM_TPDO3 | EPOS_SIM_TPDO4;
+  s->EncoderCounts = 2000;
+  s->State = EPOS_START;
+  s->OpMode = PPM;
+  s->PositionWindow = 0xFFFFFFFF;
+  s->MaxProfileVelocity = 25000;
+  s->ProfileVelocity = 1000;
+  s->ProfileAcceleration = 10000;
+  s->ProfileDeceleration = 10000;
+  s->QuickStopDeceleration = 10000;
+  s->RS232Timeout = 500;
+  s->RecPeriod = 10;
+  s->RecChannels = 1;
+  s->RecIndex[0] = 0x6064;
+  s->sentStatus = 0xFFFF;
+}
+
+/* NMT boot-up: boot-up frame, then pre-operational */
+static void bootUp(eposSim_t *s) {
+  s->NMTState = EPOS_NMT_BOOTUP;
+  sendHeartbeat(s);
+  s->NMTState = EPOS_NMT_PREOP;
+  s->Heartbeat = 0;
+  s->hbElapsed = 0;
+}
+
+static void nmt(eposSim_t *s, uint8_t cmd) {
+  switch (cmd) {
+  case 0x01:
+    s->NMTState = EPOS_NMT_OPERATIONAL;
+    s->sentStatus = 0xFFFF;                 // TPDO1 with the next step
+    break;
+  case 0x02:
+    s->NMTState = EPOS_NMT_STOPPED;
+    s->seg.active = false;
+    break;
+  case 0x80:
+    s->NMTState = EPOS_NMT_PREOP;
+    break;
+  case 0x81:                                // reset node
+    defaults(s);
+    bootUp(s);
+    break;
+  case 0x82:                                // reset communication
+    s->seg.active = false;
+    bootUp(s);
+    break;
+  }
+}
+
+void faultEPOSSim(eposSim_t *s, uint16_t code, uint8_t reg) {
+  if (!s) return;
+  memmove(&s->ErrHistory[1], &s->ErrHistory[0],
+          sizeof(s->ErrHistory) - sizeof(s->ErrHistory[0]));
+  s->ErrHistory[0] = code;
+  if (s->ErrCount < EPOS_SIM_ERRHIST) s->ErrCount++;
+  s->ErrorRegister |= reg | 0x01;
+  sendEmcy(s, code);
+  switch (s->State) {
+  case EPOS_FAULT:
+  case EPOS_FAULTREACTDIS:
+  case EPOS_FAULTREACTEN:
+    break;
+  case EPOS_OPENABLE:
+  case EPOS_QUICKSTOP:
+    s->State = EPOS_FAULTREACTEN;
+    break;
+  default:
+    s->State = EPOS_FAULTREACTDIS;
+    break;
+  }
+  if (s->RecConfig & EPOS_REC_TRIG_ERROR) s->RecControl |= 0x0002;
+  sendStatus(s, 0);
+}
+
+/* a new controlword, device control commands of firmware spec 8.1.3 */
+static void control(eposSim_t *s, uint16_t cw) {
+  uint16_t old = s->Controlword;
+  int8_t st = s->State;
+
+  s->Controlword = cw;
+
+  if (st == EPOS_FAULT) {
+    if ((cw & CW_FAULTRESET) && !(old & CW_FAULTRESET)) {
+      s->ErrorRegister = 0;
+      sendEmcy(s, EP_NOERR);
+      s->State = EPOS_SWITCHONDIS;
+    }
+    return;
+  }
+  if (cw & CW_FAULTRESET) return;
+
+  if ((cw & 0x02) == 0) {                   // disable voltage
+    if (st >= EPOS_READY && st <= EPOS_QUICKSTOP) st = EPOS_SWITCHONDIS;
+  } else if ((cw & 0x06) == 0x02) {         // quick stop
+    if (st == EPOS_READY || st == EPOS_SWITCHEDON) st = EPOS_SWITCHONDIS;
+    else if (st == EPOS_OPENABLE) st = EPOS_QUICKSTOP;
+  } else if ((cw & 0x07) == 0x06) {         // shutdown
+    if (st == EPOS_SWITCHONDIS || st == EPOS_SWITCHEDON || st == EPOS_OPENABLE)
+      st = EPOS_READY;
+  } else if ((cw & 0x0F) == 0x07) {         // switch on, disable operation
+    if (st == EPOS_READY || st == EPOS_OPENABLE) st = EPOS_SWITCHEDON;
+  } else if ((cw & 0x0F) == 0x0F) {         // enable operation
+    if (st == EPOS_SWITCHEDON || st == EPOS_QUICKSTOP) st = EPOS_OPENABLE;
+  }
+  if (st == EPOS_OPENABLE && s->State != EPOS_OPENABLE) {
+    s->setPoint = (int32_t)lround(s->pos);    // hold the position
+    s->TargetVelocity = 0;
+  }
+  s->State = st;
+  if (st != EPOS_OPENABLE) return;
+
+  // set-points of profile position and homing mode
+  if (!(cw & CW_NEWSETPOINT)) return;
+  if ((old & CW_NEWSETPOINT) && !(cw & CW_IMMEDIATELY)) return;
+  if (s->OpMode == (int8_t)PPM) {
+    s->setPoint = (cw & CW_RELATIVE) ? s->setPoint + s->TargetPosition : s->TargetPosition;
+    s->reached = false;
+    if (s->RecConfig & EPOS_REC_TRIG_MOVESTART) s->RecControl |= 0x0002;
+  } else if (s->OpMode == (int8_t)HM) {
+    s->setPoint = 0;
+    s->homed = false;
+    s->reached = false;
+  }
+}
+
+static void updateStatus(eposSim_t *s) {
+  uint16_t w = statusTable[s->State];
+
+  if (s->reached && (s->State == EPOS_OPENABLE || s->State == EPOS_QUICKSTOP)) w |= 0x0400;
+  if (s->State == EPOS_OPENABLE) {
+    if (s->OpMode == (int8_t)PPM && (s->Controlword & CW_NEWSETPOINT)) w |= 0x1000;
+    if (s->OpMode == (int8_t)HM && s->homed) w |= 0x1000;
+  }
+  s->Statusword = w;
+}
+
+/* move vel towards 'want' with the acceleration or deceleration */
+static double ramp(double vel, double want, double acc, double dec, double dt) {
+  double rate = (fabs(want) < fabs(vel) || want * vel < 0) ? dec : acc;
+  double dv = rate > 0 ? rate * dt : INFINITY;
+
+  if (want > vel) return want - vel < dv ? want : vel + dv;
+  return vel - want < dv ? want : vel - dv;
+}
+
+static void move(eposSim_t *s) {
+  const double dt = EPOS_SIM_STEP_US * 1e-6;
+  double cps = s->EncoderCounts / 60.0;     // quadcounts/s per rpm
+  double acc = s->ProfileAcceleration * cps, dec = s->ProfileDeceleration * cps;
+  double want = 0, vmax, dist, rate, old = s->vel;
+  bool position = false;
+
+  if (s->State == EPOS_QUICKSTOP) {
+    dec = s->QuickStopDeceleration * cps;
+  } else if (s->State != EPOS_OPENABLE) {
+    s->vel = 0;                             // power stage off
+    old = 0;
+    dec = 0;
+  } else if (!(s->Controlword & CW_HALT)) {
+    switch ((uint8_t)s->OpMode) {
+    case PPM: case PM: case HM:
+      position = true;
+      vmax = (s->OpMode == (int8_t)PM ? s->MaxProfileVelocity : s->ProfileVelocity) * cps;
+      dist = s->setPoint - s->pos;
+      // fastest velocity that still stops at the set-point in whole steps
+      rate = (dec > 0 ? dec : acc) * dt;
+      want = sqrt(rate * rate / 4 + 2.0 * rate / dt * fabs(dist)) - rate / 2;
+      if (want > vmax) want = vmax;
+      if (dist < 0) want = -want;
+      break;
+    case PVM:
+      want = s->TargetVelocity * cps;
+      break;
+    case VM:
+      want = s->TargetVelocity * cps;
+      acc = dec = 0;                        // no profile
+      break;
+    }
+  }
+
+  s->vel = ramp(s->vel, want, acc, dec, dt);
+  s->pos += s->vel * dt;
+  if (position && (s->setPoint - s->pos) * (s->setPoint - (s->pos - s->vel * dt)) <= 0
+      && fabs(s->vel) <= sqrt(2.0 * (dec > 0 ? dec : acc) * 1.0) + 1.0) {
+    s->pos = s->setPoint;                   // arrived
+    s->vel = 0;
+    want = 0;
+  }
+
+  if (s->State == EPOS_OPENABLE) {
+    if (s->Controlword & CW_HALT) s->reached = s->vel == 0;
+    else if (position) s->reached = s->pos == s->setPoint && s->vel == 0;
+    else s->reached = s->vel == want;
+    if (s->OpMode == (int8_t)HM && s->reached && !s->homed) {
+      s->homed = true;
+      s->pos = 0;
+    }
+  } else if (s->State == EPOS_QUICKSTOP) {
+    s->reached = s->vel == 0;
+  }
+  if (s->reached && old != 0 && s->vel == 0 && (s->RecConfig & EPOS_REC_TRIG_MOVEEND))
+    s->RecControl |= 0x0002;
+
+  s->Position = (int32_t)lround(s->pos);
+  s->PositionDemand = s->Position;
+  s->Velocity = (int32_t)lround(s->vel / cps);
+  s->VelocityDemand = (int32_t)lround(want / cps);
+  // some friction and the torque for the acceleration
+  s->Current = (int16_t)lround((s->vel - old) / dt / cps * 0.01 + (s->vel > 0 ? 50 : s->vel < 0 ? -50 : 0));
+}
+
+/* one step of EPOS_SIM_STEP_US */
+static void step(eposSim_t *s) {
+  switch (s->State) {
+  case EPOS_START: s->State = EPOS_NOTREADY; break;
+  case EPOS_NOTREADY: s->State = EPOS_SWITCHONDIS; break;
+  case EPOS_FAULTREACTDIS:
+  case EPOS_FAULTREACTEN: s->State = EPOS_FAULT; break;
+  case EPOS_QUICKSTOP:
+    if (s->vel == 0 && s->reached) s->State = EPOS_SWITCHONDIS;
+    break;
+  }
+  move(s);
+  sendStatus(s, 0);
+  sendPDOs(s);
+
+  if (s->Heartbeat) {
+    s->hbElapsed += EPOS_SIM_STEP_US;
+    if (s->hbElapsed >= s->Heartbeat * 1000u) {
+      s->hbElapsed = 0;
+      sendHeartbeat(s);
+    }
+  }
+}
+
+
+/************************************************************/
+/*            data recorder                                 */
+/************************************************************/
+
+static uint32_t sampleSize(const eposSim_t *s) {
+  uint32_t n = 0;
+  int i;
+
+  for (i = 0; i < s->RecChannels && i < EPOS_SIM_RECCH; i++) n += s->recSize[i];
+  return n;
+}
+
+/* bit 0 of the control word enables the trigger and starts, bit 1
+   triggers */
+static void controlRecorder(eposSim_t *s) {
+  uint8_t buf[EPOS_SIM_DOMAIN];
+  uint32_t len, size;
+  int i;
+
+  if (!(s->RecControl & 0x0001)) {
+    s->RecStatus &= ~EPOS_REC_RUNNING;
+    return;
+  }
+  if (s->RecStatus & EPOS_REC_RUNNING) return;
+  for (i = 0; i < EPOS_SIM_RECCH; i++) {
+    len = sizeof(buf);
+    s->recSize[i] = 0;
+    if (odRead(s, s->RecIndex[i], s->RecSubIndex[i], buf, &len) == 0 && len <= 4)
+      s->recSize[i] = len;
+  }
+  size = sampleSize(s);
+  s->RecStatus = EPOS_REC_RUNNING;
+  s->RecMaxSamples = size ? EPOS_SIM_RECBUF / size : 0;
+  s->RecSamples = 0;
+  s->RecStart = 0;
+  s->recWrite = 0;
+  s->recFilled = 0;
+  s->recElapsed = 0;
+}
+
+/* a ring of RecMaxSamples samples like on the device: recWrite is the
+   next slot, RecStart the oldest of the RecSamples kept */
+static void sampleRecorder(eposSim_t *s) {
+  uint32_t size = sampleSize(s), cap = s->RecMaxSamples, len, pos;
+  uint8_t buf[EPOS_SIM_DOMAIN];
+  int i;
+
+  if (!(s->RecStatus & EPOS_REC_RUNNING) || size == 0 || cap == 0) return;
+  s->recElapsed += EPOS_SIM_STEP_US;
+  if (s->recElapsed < s->RecPeriod * 100u) return;
+  s->recElapsed = 0;
+
+  if ((s->RecControl & 0x0002) && !(s->RecStatus & EPOS_REC_TRIGGERED)) {
+    s->RecStatus |= EPOS_REC_TRIGGERED;
+    s->recPost = cap - (s->RecPreTrigger < cap ? s->RecPreTrigger : cap);
+    if (s->RecSamples > cap - s->recPost) s->RecSamples = cap - s->recPost;
+  }
+  if (s->RecStatus & EPOS_REC_TRIGGERED) {
+    if (s->recPost == 0) {
+      s->RecStatus = (s->RecStatus & ~EPOS_REC_RUNNING) | EPOS_REC_AVAILABLE;
+      s->RecControl &= ~0x0003;
+      return;
+    }
+    s->recPost--;
+  }
+
+  for (i = 0, pos = 0; i < s->RecChannels && i < EPOS_SIM_RECCH; i++) {
+    if (!s->recSize[i]) continue;
+    len = sizeof(buf);
+    if (odRead(s, s->RecIndex[i], s->RecSubIndex[i], buf, &len) != 0) memset(buf, 0, 4);
+    memcpy(&s->rec[s->recWrite * size + pos], buf, s->recSize[i]);
+    pos += s->recSize[i];
+  }
+  s->recWrite = (s->recWrite + 1) % cap;
+  if (s->recFilled < cap) s->recFilled++;
+  if (s->RecSamples < cap) s->RecSamples++;
+  s->RecStart = (s->recWrite + cap - s->RecSamples) % cap;
+}
+
+/* the ring as it is, up to the last slot ever written */
+static uint32_t readRecorder(eposSim_t *s, uint8_t *buf, uint32_t *len) {
+  uint32_t size = sampleSize(s);
+
+  if (*len < s->recFilled * size) return ABORT_MEMORY;
+  *len = s->recFilled * size;
+  memcpy(buf, s->rec, *len);
+  return 0;
+}
+
+
+/************************************************************/
+/*            the bus                                       */
+/************************************************************/
+
+static void frameHook(const CanRxMsgTypeDef *f, bool fromDriver, void *ctx) {
+  eposSim_t *s;
+  int i;
+
+  (void)fromDriver;
+  (void)ctx;
+  if (f->IDE != CAN_ID_STD || f->RTR != CAN_RTR_DATA) return;
+
+  if (f->StdId == 0x000) {                  // NMT, node 0: all
+    if (f->DLC < 2) return;
+    for (i = 1; i < 128; i++) {
+      if (!(s = nodes[i]) || s->Silent) continue;
+      if (f->Data[1] == 0 || f->Data[1] == i) nmt(s, f->Data[0]);
+    }
+    return;
+  }
+  if (!(s = nodes[f->StdId & 0x7F]) || s->Silent) return;
+  switch (f->StdId & 0x780) {
+  case 0x600:
+    if (f->DLC == 8) serveSDO(s, f->Data);
+    break;
+  case 0x200: case 0x300: case 0x400: case 0x500:
+    receivePDO(s, f);
+    break;
+  }
+}
+
+static void timerHook(void *ctx) {
+  int i;
+
+  (void)ctx;
+  for (i = 1; i < 128; i++) {
+    if (!nodes[i]) continue;
+    step(nodes[i]);
+    sampleRecorder(nodes[i]);
+  }
+}
+
+eposSim_t *addEPOSSim(uint8_t id) {
+  eposSim_t *s;
+
+  if (id < 1 || id > 127 || nodes[id]) return NULL;
+  if (hostAddFrameHook(frameHook, NULL) < 0) return NULL;
+  if (hostAddTimer(timerHook, NULL, EPOS_SIM_STEP_US) < 0) return NULL;
+  if (!(s = calloc(1, sizeof(*s)))) return NULL;
+  s->Node_ID = id;
+  defaults(s);
+  bootUp(s);
+  nodes[id] = s;
+  return s;
+}
+
+eposSim_t *getEPOSSim(uint8_t id) {
+  return id < 128 ? nodes[id] : NULL;
+}
+
+void removeEPOSSims(void) {
+  int i;
+
+  for (i = 0; i < 128; i++) {
+    free(nodes[i]);
+    nodes[i] = NULL;
+  }
+}
@@ -0,0 +1,140 @@
+/*! \file epos_sim.h
+
+  virtual EPOS2 nodes on the simulated bus of the host build
+
+  Every node has the objects libEPOS uses, an SDO server (expedited and
+  segmented transfers, CiA301 abort codes), the CiA402 state machine of
+  firmware spec 8.1.1, the PDO mapping of the default configuration, EMCY
+  and heartbeat producers and simple profile position/velocity dynamics.
+  All nodes share the bus of epos_host.c; they see every frame there and
+  answer after a configurable delay, so the driver runs unchanged against
+  1..127 of them.
+
+  The nodes run in steps of EPOS_SIM_STEP_US of virtual time; positions
+  are in quadcounts, velocities in rpm, accelerations in rpm/s.
+
+*/
+
+#ifndef _EPOS_SIM_H
+#define _EPOS_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*! \brief time step of state machine, dynamics and producers, us */
+#define EPOS_SIM_STEP_US   1000
+/*! \brief size of the longest object transferred by segmented SDO */
+#define EPOS_SIM_DOMAIN    2048
+/*! \brief entries of the error history, object 0x1003 */
+#define EPOS_SIM_ERRHIST   5
+/*! \brief channels and bytes of the data recorder */
+#define EPOS_SIM_RECCH     4
+#define EPOS_SIM_RECBUF    2048
+
+/* TPDOs sent by a node in NMT operational, eposSim_t.TPDOMask */
+#define EPOS_SIM_TPDO1  0x01 ///< statusword, on change
+#define EPOS_SIM_TPDO2  0x02 ///< statusword + current actual
+#define EPOS_SIM_TPDO3  0x04 ///< statusword + position actual
+#define EPOS_SIM_TPDO4  0x08 ///< statusword + velocity actual
+
+/*! \brief one virtual node; the fields may be changed between steps to
+   set up a test, the object dictionary maps onto them */
+typedef struct eposSim_s {
+  uint8_t Node_ID;
+
+  /* behaviour */
+  uint32_t SDODelay;      ///< us from request to answer, default 150
+  uint32_t PDOInhibit;    ///< min. us between two frames of TPDO2..4
+  uint8_t TPDOMask;       ///< EPOS_SIM_TPDO*, all by default
+  bool Silent;            ///< sends nothing and ignores all frames
+  uint32_t EncoderCounts; ///< quadcounts per revolution, default 2000
+
+  /* communication, CiA301 */
+  uint8_t NMTState;       ///< EPOS_NMT_*
+  uint16_t Heartbeat;     ///< producer time, ms, object 0x1017
+  uint8_t ErrorRegister;  ///< object 0x1001
+  uint8_t ErrCount;       ///< object 0x1003:0
+  uint32_t ErrHistory[EPOS_SIM_ERRHIST]; ///< newest first
+  uint32_t SDORequests;   ///< SDO requests answered
+  uint32_t SDOAborts;     ///< of which with an abort
+
+  /* device control, CiA402 */
+  int8_t State;           ///< EPOS_* of epos.h
+  uint16_t Controlword;   ///< object 0x6040
+  uint16_t Statusword;    ///< object 0x6041
+  int8_t OpMode;          ///< object 0x6060, Profile_t
+
+  /* motion */
+  int32_t TargetPosition;     ///< object 0x607A
+  int32_t PositionDemand;     ///< object 0x6062
+  int32_t Position;           ///< object 0x6064
+  uint32_t PositionWindow;    ///< object 0x6067
+  int32_t TargetVelocity;     ///< object 0x60FF
+  int32_t VelocityDemand;     ///< object 0x606B
+  int32_t Velocity;           ///< object 0x606C
+  int16_t Current;            ///< object 0x6078, mA
+  uint32_t MaxProfileVelocity;    ///< object 0x607F
+  uint32_t ProfileVelocity;       ///< object 0x6081
+  uint32_t ProfileAcceleration;   ///< object 0x6083
+  uint32_t ProfileDeceleration;   ///< object 0x6084
+  uint32_t QuickStopDeceleration; ///< object 0x6085
+  int16_t MotionProfileType;      ///< object 0x6086
+  int8_t HomingMethod;            ///< object 0x6098
+
+  /* I/O and misc. */
+  uint16_t RS232Timeout;    ///< object 0x2005
+  uint16_t DInputs;         ///< object 0x2071:1
+  uint16_t DInputPolarity;  ///< object 0x2071:3
+  uint16_t DOutputs;        ///< object 0x2078:1
+
+  /* data recorder, objects 0x2010..0x201B */
+  uint16_t RecControl;
+  uint16_t RecConfig;
+  uint16_t RecPeriod;       ///< 0.1 ms
+  uint16_t RecPreTrigger;   ///< samples
+  uint16_t RecChannels;
+  uint16_t RecIndex[EPOS_SIM_RECCH];
+  uint8_t RecSubIndex[EPOS_SIM_RECCH];
+  uint16_t RecStatus;
+  uint16_t RecMaxSamples;   ///< samples the ring holds
+  uint16_t RecSamples;      ///< samples in the ring
+  uint16_t RecStart;        ///< slot of the oldest sample
+
+  /* internal */
+  double pos;               ///< quadcounts
+  double vel;               ///< quadcounts/s
+  int32_t setPoint;         ///< position the profile moves to
+  bool reached;             ///< statusword bit 10
+  bool homed;               ///< statusword bit 12 in homing mode
+  uint64_t lastTPDO[3];     ///< time of the last TPDO2..4, us
+  uint16_t sentStatus;
+  int16_t sentCurrent;
+  int32_t sentPosition, sentVelocity;
+  uint32_t hbElapsed;       ///< us since the last heartbeat
+  uint32_t recElapsed;      ///< us since the last sample
+  uint8_t recSize[EPOS_SIM_RECCH];
+  uint16_t recWrite, recFilled, recPost;
+  uint8_t rec[EPOS_SIM_RECBUF];
+  struct {
+    bool active;
+    bool upload;
+    uint16_t Index;
+    uint8_t SubIndex;
+    uint8_t toggle;
+    uint32_t len, pos;
+    uint8_t buf[EPOS_SIM_DOMAIN];
+  } seg;                    ///< segmented transfer in progress
+} eposSim_t;
+
+/*! \brief add a node to the bus, it sends its boot-up frame and enters
+   pre-operational; NULL if the ID is invalid or taken. hostReset()
+   takes the nodes off the bus, call removeEPOSSims() with it. */
+eposSim_t *addEPOSSim(uint8_t id);
+/*! \brief the node with 'id' or NULL */
+eposSim_t *getEPOSSim(uint8_t id);
+/*! \brief remove all nodes */
+void removeEPOSSims(void);
+/*! \brief raise device error 'code': EMCY, error history, fault reaction */
+void faultEPOSSim(eposSim_t *sim, uint16_t code, uint8_t reg);
+
+#endif
@@ -0,0 +1,20 @@
+/*! \file main.h
+
+  host stand-in for the main.h of the application: the EPOS array
+  HAL_CAN_RxCpltCallback() hands to processCANMsg(), defined in
+  epos_host.c and filled by the test or benchmark
+
+*/
+
+#ifndef _EPOS_HOST_MAIN_H
+#define _EPOS_HOST_MAIN_H
+
+#include "epos.h"
+
+#define EPOS_HOST_MAXNODES  127
+
+extern epos_t *epos[EPOS_HOST_MAXNODES];
+extern uint8_t epos_num;
+#define EPOS_NUM  epos_num
+
+#endif
@@ -0,0 +1,88 @@
+/*! \file rtt_host.c
+
+\brief RTT up-channels of the host build, kept in memory
+
+Separate from epos_host.c, so code that only prints (the ramp benchmark)
+does not pull in the driver.
+
+*/
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SEGGER_RTT.h"
+#include "epos_host.h"
+
+static struct {
+  uint8_t *data;
+  unsigned size;
+  unsigned cap;          ///< set by SEGGER_RTT_ConfigUpBuffer(), 0: 1 MB
+} rtt[EPOS_HOST_RTT_CHANNELS];
+static bool rttEcho = false;
+
+
+void hostRTTReset(void) {
+  int i;
+
+  for (i = 0; i < EPOS_HOST_RTT_CHANNELS; i++) {
+    free(rtt[i].data);
+    rtt[i].data = NULL;
+    rtt[i].size = 0;
+    rtt[i].cap = 0;
+  }
+}
+
+int SEGGER_RTT_ConfigUpBuffer(unsigned BufferIndex, const char *sName, void *pBuffer,
+                              unsigned BufferSize, unsigned Flags) {
+  (void)sName;
+  (void)pBuffer;
+  (void)Flags;
+  if (BufferIndex >= EPOS_HOST_RTT_CHANNELS) return -1;
+  rtt[BufferIndex].cap = BufferSize;
+  return 0;
+}
+
+/* like SEGGER_RTT_MODE_NO_BLOCK_SKIP: all or nothing */
+unsigned SEGGER_RTT_Write(unsigned BufferIndex, const void *pBuffer, unsigned NumBytes) {
+  uint8_t *p;
+
+  if (BufferIndex >= EPOS_HOST_RTT_CHANNELS) return 0;
+  if (rtt[BufferIndex].size + NumBytes > (rtt[BufferIndex].cap ? rtt[BufferIndex].cap : 1u << 20))
+    return 0;
+  if (!(p = realloc(rtt[BufferIndex].data, rtt[BufferIndex].size + NumBytes))) return 0;
+  memcpy(p + rtt[BufferIndex].size, pBuffer, NumBytes);
+  rtt[BufferIndex].data = p;
+  rtt[BufferIndex].size += NumBytes;
+  return NumBytes;
+}
+
+int SEGGER_RTT_printf(unsigned BufferIndex, const char *sFormat, ...) {
+  char line[256];
+  va_list ap;
+  int n;
+
+  va_start(ap, sFormat);
+  n = vsnprintf(line, sizeof(line), sFormat, ap);
+  va_end(ap);
+  if (n < 0) return n;
+  if (n >= (int)sizeof(line)) n = sizeof(line) - 1;
+  if (rttEcho) fputs(line, stderr);
+  return SEGGER_RTT_Write(BufferIndex, line, n);
+}
+
+unsigned hostRTTRead(unsigned ch, void *buf, unsigned max) {
+  unsigned n;
+
+  if (ch >= EPOS_HOST_RTT_CHANNELS) return 0;
+  n = rtt[ch].size < max ? rtt[ch].size : max;
+  memcpy(buf, rtt[ch].data, n);
+  memmove(rtt[ch].data, rtt[ch].data + n, rtt[ch].size - n);
+  rtt[ch].size -= n;
+  return n;
+}
+
+void hostRTTEcho(bool on) {
+  rttEcho = on;
+}
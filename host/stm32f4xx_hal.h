@@ -0,0 +1,106 @@
+/*! \file stm32f4xx_hal.h
+
+  host stand-in for the parts of the STM32F4 HAL used by libEPOS
+
+  Only what epos.c and its modules need is declared: the CAN handle and
+  message types of the old CAN driver, the bxCAN transmit mailbox
+  registers the quick stop writes to, HAL_Delay()/HAL_GetTick() and the
+  interrupt mask. The behaviour is in epos_host.c.
+
+*/
+
+#ifndef _EPOS_HOST_HAL_H
+#define _EPOS_HOST_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+  HAL_OK = 0x00,
+  HAL_ERROR = 0x01,
+  HAL_BUSY = 0x02,
+  HAL_TIMEOUT = 0x03
+} HAL_StatusTypeDef;
+
+typedef enum { RESET = 0, SET = !RESET } FlagStatus;
+
+typedef struct {
+  uint32_t StdId;
+  uint32_t ExtId;
+  uint32_t IDE;
+  uint32_t RTR;
+  uint32_t DLC;
+  uint8_t Data[8];
+} CanTxMsgTypeDef;
+
+typedef struct {
+  uint32_t StdId;
+  uint32_t ExtId;
+  uint32_t IDE;
+  uint32_t RTR;
+  uint32_t DLC;
+  uint8_t Data[8];
+  uint32_t FMI;
+  uint32_t FIFONumber;
+} CanRxMsgTypeDef;
+
+typedef struct {
+  volatile uint32_t TIR;
+  volatile uint32_t TDTR;
+  volatile uint32_t TDLR;
+  volatile uint32_t TDHR;
+} CAN_TxMailBox_TypeDef;
+
+typedef struct {
+  volatile uint32_t MCR;
+  volatile uint32_t MSR;
+  volatile uint32_t TSR;
+  volatile uint32_t RF0R;
+  volatile uint32_t RF1R;
+  volatile uint32_t IER;
+  volatile uint32_t ESR;
+  volatile uint32_t BTR;
+  CAN_TxMailBox_TypeDef sTxMailBox[3];
+} CAN_TypeDef;
+
+typedef struct {
+  CAN_TypeDef *Instance;
+  CanTxMsgTypeDef *pTxMsg;
+  CanRxMsgTypeDef *pRxMsg;
+} CAN_HandleTypeDef;
+
+#define CAN_ID_STD     0x00000000U
+#define CAN_RTR_DATA   0x00000000U
+#define CAN_FIFO0      ((uint8_t)0x00U)
+
+#define CAN_TSR_RQCP0  (1U << 0)
+#define CAN_TSR_ABRQ0  (1U << 7)
+#define CAN_TSR_RQCP1  (1U << 8)
+#define CAN_TSR_ABRQ1  (1U << 15)
+#define CAN_TSR_RQCP2  (1U << 16)
+#define CAN_TSR_ABRQ2  (1U << 23)
+#define CAN_TSR_TME0   (1U << 26)
+#define CAN_TSR_TME1   (1U << 27)
+#define CAN_TSR_TME2   (1U << 28)
+#define CAN_TI0R_TXRQ  (1U << 0)
+#define CAN_IT_TME     (1U << 0)
+
+/* on the target a plain register write; here it also tells the bus model
+   that the mailboxes were written to */
+void hostCANEnableIT(CAN_HandleTypeDef *hcan, uint32_t it);
+#define __HAL_CAN_ENABLE_IT(h, it)  hostCANEnableIT((h), (it))
+
+HAL_StatusTypeDef HAL_CAN_Transmit_IT(CAN_HandleTypeDef *hcan);
+HAL_StatusTypeDef HAL_CAN_Receive_IT(CAN_HandleTypeDef *hcan, uint8_t FIFONumber);
+void HAL_CAN_TxCpltCallback(CAN_HandleTypeDef *hcan);
+void HAL_CAN_RxCpltCallback(CAN_HandleTypeDef *hcan);
+
+void HAL_Delay(uint32_t Delay);
+uint32_t HAL_GetTick(void);
+
+/* the interrupt mask; "interrupts" are the CAN callbacks of the bus model */
+uint32_t __get_PRIMASK(void);
+void __disable_irq(void);
+void __enable_irq(void);
+
+#endif
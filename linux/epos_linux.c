@@ -0,0 +1,84 @@
+/*! \file epos_linux.c
+
+\brief HAL port of libEPOS on Linux
+
+Uses the HAL declarations of host/ and gives them real time:
+HAL_GetTick() and HAL_Delay() run on CLOCK_MONOTONIC. There is no
+receive interrupt; instead every HAL_GetTick() lets the transport
+deliver what it received, unless the "interrupts" are masked. All wait
+loops of the driver look at the time, so its flags change while it
+waits just as on the target. The driver is meant to be used from one
+thread.
+
+The bxCAN functions fail, select a transport with setEPOSTransport(),
+e.g. the one of openEPOSSocketCAN().
+
+*/
+
+#include <time.h>
+#include "main.h"
+
+epos_t *epos[EPOS_HOST_MAXNODES];
+uint8_t epos_num = 0;
+
+static CAN_TypeDef can1;
+CAN_HandleTypeDef hcan1 = { &can1, NULL, NULL };
+
+static bool masked = false;
+
+static uint64_t nowUs(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+HAL_StatusTypeDef HAL_CAN_Transmit_IT(CAN_HandleTypeDef *hcan) {
+  (void)hcan;
+  return HAL_ERROR;
+}
+
+HAL_StatusTypeDef HAL_CAN_Receive_IT(CAN_HandleTypeDef *hcan, uint8_t FIFONumber) {
+  (void)hcan;
+  (void)FIFONumber;
+  return HAL_OK;
+}
+
+void hostCANEnableIT(CAN_HandleTypeDef *hcan, uint32_t it) {
+  hcan->Instance->IER |= it;
+}
+
+void HAL_Delay(uint32_t Delay) {
+  struct timespec ts = { 0, 100000 };
+  uint64_t end = nowUs() + Delay * 1000ull;
+
+  // keep receiving while sleeping
+  do {
+    if (!masked) pollEPOSTransport();
+    nanosleep(&ts, NULL);
+  } while (nowUs() < end);
+}
+
+uint32_t eposHostCycles(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+uint32_t HAL_GetTick(void) {
+  if (!masked) pollEPOSTransport();
+  return (uint32_t)(nowUs() / 1000);
+}
+
+uint32_t __get_PRIMASK(void) {
+  return masked;
+}
+
+void __disable_irq(void) {
+  masked = true;
+}
+
+void __enable_irq(void) {
+  masked = false;
+}
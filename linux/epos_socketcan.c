@@ -0,0 +1,184 @@
+/*! \file epos_socketcan.c
+
+\brief SocketCAN transport of libEPOS
+
+See epos_socketcan.h. Send() waits with poll() while the socket queue
+is full, up to EPOS_TX_TIMEOUT. Poll() reads with recvmsg() until the
+socket is empty and takes the receive time from SO_TIMESTAMP; that is
+CLOCK_REALTIME, so the age of the frame is subtracted from
+getEPOSTimeUs() to give the stamp the clock of the bxCAN port.
+
+The filters: all frames a node sends have bit 7 of the COB-ID set
+(EMCY 0x080, TPDO1-4 0x180-0x480, SDO answer 0x580), except the
+heartbeat 0x700; the ones sent to it have it clear. So two filters per
+node are enough, at most 254 for a full bus.
+
+*/
+
+#include <errno.h>
+#include <net/if.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include "epos_socketcan.h"
+
+static int scSend(void *ctx, CAN_HandleTypeDef *dev, const CanTxMsgTypeDef *msg);
+static int scPoll(void *ctx);
+static int scFilter(void *ctx, const uint8_t nodes[16]);
+
+static int fd = -1;
+static eposSocketCANStats_t stats;
+static const eposTransport_t socketcan = { "SocketCAN", scSend, scPoll, scFilter, NULL, NULL };
+
+static uint64_t nowMs(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+const eposTransport_t *openEPOSSocketCAN(const char *ifname) {
+  struct sockaddr_can addr;
+  struct ifreq ifr;
+  int on = 1;
+
+  if (!ifname || strlen(ifname) >= IFNAMSIZ) return NULL;
+  closeEPOSSocketCAN();
+
+  if ((fd = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW)) < 0)
+    return NULL;
+  memset(&ifr, 0, sizeof(ifr));
+  strcpy(ifr.ifr_name, ifname);
+  memset(&addr, 0, sizeof(addr));
+  addr.can_family = AF_CAN;
+  // nothing is received until the filters of the nodes are set
+  if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0
+      || setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0) < 0
+      || setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on)) < 0) {
+    closeEPOSSocketCAN();
+    return NULL;
+  }
+  addr.can_ifindex = ifr.ifr_ifindex;
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    closeEPOSSocketCAN();
+    return NULL;
+  }
+  memset(&stats, 0, sizeof(stats));
+  return &socketcan;
+}
+
+void closeEPOSSocketCAN(void) {
+  if (getEPOSTransport() == &socketcan) setEPOSTransport(NULL);
+  if (fd >= 0) close(fd);
+  fd = -1;
+}
+
+int getEPOSSocketCANStats(eposSocketCANStats_t *s) {
+  if (!s) return -1;
+  *s = stats;
+  return 0;
+}
+
+static int scSend(void *ctx, CAN_HandleTypeDef *dev, const CanTxMsgTypeDef *msg) {
+  struct can_frame f;
+  struct pollfd p = { fd, POLLOUT, 0 };
+  uint64_t start = nowMs(), now;
+  bool busy = false;
+
+  (void)ctx;
+  (void)dev;
+  if (fd < 0) return -1;
+  memset(&f, 0, sizeof(f));
+  f.can_id = msg->StdId & CAN_SFF_MASK;
+  if (msg->RTR != CAN_RTR_DATA) f.can_id |= CAN_RTR_FLAG;
+  f.can_dlc = msg->DLC > 8 ? 8 : msg->DLC;
+  memcpy(f.data, msg->Data, f.can_dlc);
+
+  for (;;) {
+    if (write(fd, &f, sizeof(f)) == sizeof(f)) {
+      stats.TxFrames++;
+      if (busy) stats.TxBusy++;
+      return 1;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) return -1;
+    busy = true;
+    now = nowMs();
+    if (now - start > EPOS_TX_TIMEOUT) return 0;
+    // ENOBUFS is not signalled by poll(), so wake up every ms anyway
+    poll(&p, 1, 1);
+  }
+}
+
+static int scPoll(void *ctx) {
+  char control[CMSG_SPACE(sizeof(struct timeval))];
+  struct can_frame f;
+  struct iovec iov = { &f, sizeof(f) };
+  struct msghdr mh;
+  struct cmsghdr *c;
+  struct timeval tv;
+  struct timespec ts;
+  CanRxMsgTypeDef msg;
+  uint64_t real, age;
+  uint32_t now, stamp;
+  int n = 0;
+
+  (void)ctx;
+  if (fd < 0) return -1;
+  now = getEPOSTimeUs();
+  clock_gettime(CLOCK_REALTIME, &ts);
+  real = ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+  while (n < EPOS_SOCKETCAN_BURST) {
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &mh, MSG_DONTWAIT) < (ssize_t)sizeof(f)) break;
+    if (f.can_id & (CAN_EFF_FLAG | CAN_RTR_FLAG | CAN_ERR_FLAG)) {
+      stats.RxIgnored++;
+      continue;
+    }
+
+    stamp = now;
+    for (c = CMSG_FIRSTHDR(&mh); c; c = CMSG_NXTHDR(&mh, c)) {
+      if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_TIMESTAMP) continue;
+      memcpy(&tv, CMSG_DATA(c), sizeof(tv));
+      age = real - (tv.tv_sec * 1000000ull + tv.tv_usec);
+      // a step of the realtime clock must not put the frame ahead of now
+      if (age < (1ull << 31)) stamp = now - (uint32_t)age;
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.StdId = f.can_id & CAN_SFF_MASK;
+    msg.IDE = CAN_ID_STD;
+    msg.RTR = CAN_RTR_DATA;
+    msg.DLC = f.can_dlc > 8 ? 8 : f.can_dlc;
+    memcpy(msg.Data, f.data, msg.DLC);
+    receiveEPOSFrame(&msg, stamp);
+    stats.RxFrames++;
+    n++;
+  }
+  return n;
+}
+
+static int scFilter(void *ctx, const uint8_t nodes[16]) {
+  struct can_filter filter[2 * 128];
+  int id, n = 0;
+
+  (void)ctx;
+  if (fd < 0) return -1;
+  for (id = 1; id < 128; id++) {
+    if (!(nodes[id / 8] & (1 << (id % 8)))) continue;
+    filter[n].can_id = 0x080 | id;
+    filter[n++].can_mask = 0x0FF | CAN_EFF_FLAG | CAN_RTR_FLAG;
+    filter[n].can_id = 0x700 | id;
+    filter[n++].can_mask = CAN_SFF_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG;
+  }
+  return setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, n ? filter : NULL,
+                    n * sizeof(filter[0])) < 0 ? -1 : 0;
+}
@@ -0,0 +1,42 @@
+/*! \file epos_socketcan.h
+
+  SocketCAN transport of libEPOS on Linux
+
+  One raw CAN socket, non-blocking. The kernel filters what it receives
+  down to the frames the opened nodes send (EMCY, TPDOs, SDO answers,
+  heartbeat), and every frame comes with its kernel receive time.
+
+    if (!setEPOSTransport(openEPOSSocketCAN("can0"))) ...
+
+  For tests without an adapter, a virtual bus:
+
+    ip link add dev vcan0 type vcan && ip link set up vcan0
+
+*/
+
+#ifndef _EPOS_SOCKETCAN_H
+#define _EPOS_SOCKETCAN_H
+
+#include "epos.h"
+
+/*! \brief frames delivered per pollEPOSTransport() at most */
+#define EPOS_SOCKETCAN_BURST  64
+
+/*! \brief counters of the SocketCAN transport */
+typedef struct eposSocketCANStats_s {
+  uint32_t TxFrames;     ///< frames written to the socket
+  uint32_t TxBusy;       ///< writes that had to wait for the socket
+  uint32_t RxFrames;     ///< frames handed to the driver
+  uint32_t RxIgnored;    ///< extended, remote or error frames
+} eposSocketCANStats_t;
+
+/*! \brief open the CAN interface 'ifname'; the transport for
+   setEPOSTransport(), NULL on failure */
+const eposTransport_t *openEPOSSocketCAN(const char *ifname);
+/*! \brief close the socket, the driver goes back to the bxCAN transport
+   if it still used this one */
+void closeEPOSSocketCAN(void);
+/*! \brief copy the counters */
+int getEPOSSocketCANStats(eposSocketCANStats_t *stats);
+
+#endif
@@ -0,0 +1,22 @@
+/*! \file check.h
+
+\brief the check of the host tests: a failed CHECK() prints the
+condition and counts it in 'failed', the test returns 1 if any failed
+
+*/
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+static int failed = 0;
+
+#define CHECK(cond) do {                                              \
+    if (!(cond)) {                                                    \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failed++;                                                       \
+    }                                                                 \
+  } while (0)
+
+#endif
@@ -0,0 +1,153 @@
+/*! \file test_fault.c
+
+\brief the driver against simulated nodes through the fault layer
+
+Lost, late, duplicated, reordered and corrupted frames, SDO aborts and a
+bus-off, each scripted on its own, then a seeded random policy that has
+to give the same faults on every run. Checks what the driver makes of
+them and how long it blocks.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "epos.h"
+#include "main.h"
+#include "epos_host.h"
+#include "epos_sim.h"
+#include "epos_fault.h"
+#include "check.h"
+
+#define NODES 2
+
+static void rule(uint8_t dir, uint16_t cob, uint32_t skip, eposFaultAction_t a, uint32_t param) {
+  eposFaultRule_t r = { dir, cob, 0x7FF, skip, 1, a, param };
+
+  clearEPOSFaults();
+  CHECK(addEPOSFaultRule(&r) == 0);
+}
+
+/* reads spread over the nodes, the SDO drops of a random policy */
+static uint32_t randomRun(uint32_t seed, int *errors) {
+  eposFaultRandom_t p = { seed, EPOS_FAULT_RX, 0x580, 0x780, { 0 }, 0, 0, 0 };
+  eposFaultStats_t s0, s1;
+  WORD w;
+  int k;
+
+  p.Rate[EPOS_FAULT_DROP] = 100;
+  getEPOSFaultStats(&s0);
+  clearEPOSFaults();
+  setEPOSFaultRandom(&p);
+  *errors = 0;
+  for (k = 0; k < 100; k++)
+    if (readStatusword(epos[k % NODES], &w) < 0) (*errors)++;
+  setEPOSFaultRandom(NULL);
+  getEPOSFaultStats(&s1);
+  return s1.Faults[EPOS_FAULT_DROP] - s0.Faults[EPOS_FAULT_DROP];
+}
+
+int main(void) {
+  eposSim_t *sim[NODES];
+  eposFaultStats_t st;
+  uint8_t sw[2] = { 0x37, 0x04 };
+  uint64_t t0, plain;
+  int32_t pos = 0;
+  uint32_t drops;
+  WORD w = 0;
+  int i, errors;
+
+  hostReset();
+  removeEPOSSims();
+  for (i = 0; i < NODES; i++) {
+    sim[i] = addEPOSSim(i + 1);
+    epos[i] = openEPOS(&hcan1, i + 1);
+    if (!sim[i] || !epos[i]) return 1;
+  }
+  epos_num = NODES;
+  hostAdvance(5000);
+  CHECK(bringUpEPOS(epos, NODES, 1000) == 0);
+
+  // the default clock, getEPOSTimeUs(), runs on the virtual time
+  CHECK(setEPOSTransport(openEPOSFault(NULL, NULL)) == 0);
+  CHECK(getEPOSTransport() != NULL && getEPOSTransport()->Receive != NULL);
+
+  // nothing scripted: frames go through as they are
+  t0 = hostTimeUs();
+  CHECK(readStatusword(epos[0], &w) >= 0 && w == sim[0]->Statusword);
+  plain = hostTimeUs() - t0;
+
+  // a lost answer costs one SDO timeout, the retry gets through
+  rule(EPOS_FAULT_RX, 0x581, 0, EPOS_FAULT_DROP, 0);
+  t0 = hostTimeUs();
+  CHECK(readStatusword(epos[0], &w) >= 0 && w == sim[0]->Statusword);
+  CHECK(hostTimeUs() - t0 >= EPOS_SDO_TIMEOUT * 1000ull);
+  CHECK(epos[0]->Stats.SDOTimeouts == 1);
+
+  // a lost request, the same
+  rule(EPOS_FAULT_TX, 0x602, 0, EPOS_FAULT_DROP, 0);
+  CHECK(readStatusword(epos[1], &w) >= 0 && w == sim[1]->Statusword);
+  CHECK(epos[1]->Stats.SDOTimeouts == 1);
+
+  // any abort code instead of the answer, in E_error like a real one
+  rule(EPOS_FAULT_RX, 0x581, 0, EPOS_FAULT_ABORT, 0x06020000);
+  readStatusword(epos[0], &w);
+  CHECK(epos[0]->E_error == 0x06020000);
+  CHECK(epos[0]->Stats.SDOAborts == 1);
+  CHECK(readStatusword(epos[0], &w) >= 0 && epos[0]->E_error == 0);
+
+  // a late answer
+  rule(EPOS_FAULT_RX, 0x582, 0, EPOS_FAULT_DELAY, 5000);
+  t0 = hostTimeUs();
+  CHECK(readStatusword(epos[1], &w) >= 0 && w == sim[1]->Statusword);
+  CHECK(hostTimeUs() - t0 >= plain + 5000);
+  CHECK(epos[1]->Stats.SDOTimeouts == 1);
+
+  // a flipped bit in the data
+  rule(EPOS_FAULT_RX, 0x581, 0, EPOS_FAULT_CORRUPT, 4 | (0x01 << 8));
+  CHECK(readStatusword(epos[0], &w) >= 0 && w == (sim[0]->Statusword ^ 0x0001));
+
+  // a duplicated answer must not be taken for the next one
+  rule(EPOS_FAULT_RX, 0x581, 0, EPOS_FAULT_DUPLICATE, 0);
+  CHECK(readStatusword(epos[0], &w) >= 0 && w == sim[0]->Statusword);
+  sim[0]->Position = 1234;
+  sim[0]->pos = 1234;
+  CHECK(readActualPosition(epos[0], &pos) >= 0 && pos == 1234);
+
+  // two TPDOs the other way round: the older statusword stays
+  rule(EPOS_FAULT_RX, 0x181, 0, EPOS_FAULT_REORDER, 0);
+  hostCANSend(0x181, 2, sw, 0);
+  sw[1] = 0x05;
+  hostCANSend(0x181, 2, sw, 0);
+  hostIdle();
+  CHECK(epos[0]->Statusword == 0x0437);
+  hostCANSend(0x181, 2, sw, 0);
+  hostIdle();
+  CHECK(epos[0]->Statusword == 0x0537);
+
+  // bus-off: sends fail until it is over
+  rule(EPOS_FAULT_TX, 0x601, 0, EPOS_FAULT_BUSOFF, 20000);
+  CHECK(readStatusword(epos[0], &w) < 0);
+  CHECK(isEPOSFaultBusOff());
+  CHECK(readStatusword(epos[1], &w) < 0);
+  hostAdvance(20000);
+  CHECK(!isEPOSFaultBusOff());
+  CHECK(readStatusword(epos[1], &w) >= 0 && w == sim[1]->Statusword);
+
+  // random, but the same faults for the same seed
+  drops = randomRun(42, &errors);
+  CHECK(drops > 0 && errors == 0);
+  CHECK(randomRun(42, &errors) == drops);
+  CHECK(randomRun(7, &errors) != drops);
+
+  getEPOSFaultStats(&st);
+  CHECK(st.Faults[EPOS_FAULT_BUSOFF] == 1 && st.BusOffLost >= 1);
+  CHECK(st.Faults[EPOS_FAULT_REORDER] == 1 && st.HeldMax >= 1);
+  closeEPOSFault();
+  CHECK(getEPOSTransport()->Receive == NULL);
+  CHECK(readStatusword(epos[0], &w) >= 0);
+
+  for (i = 0; i < NODES; i++) free(epos[i]);
+  removeEPOSSims();
+  if (failed) fprintf(stderr, "%d check(s) failed\n", failed);
+  return failed ? 1 : 0;
+}
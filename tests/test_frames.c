@@ -0,0 +1,427 @@
+/*! \file test_frames.c
+
+\brief the frames every public function of epos.h puts on the bus
+
+One simulated node, only its statusword TPDO switched on. The functions
+are called in the order an application would, from openEPOS() through
+the SDO reads and writes, the moves and homing, the data recorder, the
+PDO control and the quick stop; the ones without bus I/O are in the list
+too, so they have to stay that way. All frames on the bus from the call
+until EPOS_FRAMES_TAIL_US after it are recorded, then the node settles
+for EPOS_FRAMES_GAP_US without recording.
+
+The result is compared with a golden file: per function the number of
+frames, the round trips (a frame of the driver answered by one of the
+node) and the frames themselves. Any difference fails, a call that
+needs more frames or round trips than before with its own message. After
+a change that is meant to alter the traffic, -u writes the golden file
+anew. newEPOS(), deleteEPOS() and closeEPOS() are declared but not
+implemented and left out, and so is eposHostCycles(), the cycle counter
+of the host build.
+
+    test_frames [-u] golden
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "epos.h"
+#include "main.h"
+#include "epos_host.h"
+#include "epos_sim.h"
+
+/*! \brief us recorded after a function returned, for what it set off */
+#define EPOS_FRAMES_TAIL_US  2000
+/*! \brief us the node settles between two functions */
+#define EPOS_FRAMES_GAP_US   200000
+
+#define MAX_CASES 128
+#define MAX_TEXT  65536
+
+typedef struct {
+  const char *name;
+  unsigned frames;
+  unsigned trips;
+  char *text;             ///< the frames, one per line
+} record_t;
+
+static record_t got[MAX_CASES], golden[MAX_CASES];
+static int nGot, nGolden;
+
+static bool recording;
+static char text[MAX_TEXT];
+static size_t textLen;
+static unsigned frames, trips;
+static bool lastFromDriver;
+
+static eposRecorder_t rec = { 1, { { 0x6064, 0x00, 4, true } }, 10, 4, 0 };
+static eposErrHist_t hist;
+static epos_t *e;
+
+static void onEvent(const eposEvent_t *ev) {
+  (void)ev;
+}
+
+static void hook(const CanRxMsgTypeDef *f, bool fromDriver, void *ctx) {
+  int i;
+
+  (void)ctx;
+  if (!recording) return;
+  if (frames && lastFromDriver && !fromDriver) trips++;
+  lastFromDriver = fromDriver;
+  frames++;
+  textLen += snprintf(text + textLen, MAX_TEXT - textLen, "  %c %03lx %u",
+                      fromDriver ? '>' : '<', (unsigned long)f->StdId, (unsigned)f->DLC);
+  for (i = 0; i < (int)f->DLC && i < 8; i++)
+    textLen += snprintf(text + textLen, MAX_TEXT - textLen, " %02x", f->Data[i]);
+  textLen += snprintf(text + textLen, MAX_TEXT - textLen, "\n");
+  if (textLen >= MAX_TEXT) textLen = MAX_TEXT - 1;
+}
+
+/* the functions, in the order they are called */
+
+static void c_openEPOS(void) { e = epos[0] = openEPOS(&hcan1, 1); epos_num = 1; }
+static void c_setEPOSBitrate(void) { setEPOSBitrate(1000000); }
+static void c_setEPOSTransport(void) { setEPOSTransport(NULL); }
+static void c_getEPOSTransport(void) { getEPOSTransport(); }
+static void c_setEPOSEventCallback(void) { setEPOSEventCallback(onEvent); }
+static void c_checkEPOS(void) { checkEPOS(e); }
+static void c_readSWversion(void) { readSWversion(e); }
+static void c_readDeviceName(void) { char name[32]; readDeviceName(e, name); }
+static void c_readRS232timeout(void) { readRS232timeout(e); }
+static void c_readDInputPolarity(void) { WORD w; readDInputPolarity(e, &w); }
+static void c_setHomePolarity(void) { setHomePolarity(e, 1); }
+static void c_readStatusword(void) { WORD w; readStatusword(e, &w); }
+static void c_readControlword(void) { WORD w; readControlword(e, &w); }
+static void c_read_DevErr(void) { WORD w; read_DevErr(e, 1, &w); }
+static void c_checkEPOSerror(void) { checkEPOSerror(e); }
+static void c_EPOSErrorText(void) { EPOSErrorText(e->Dev_Err); }
+static void c_checkEPOSstate(void) { checkEPOSstate(e); }
+static void c_printEPOSstate(void) { printEPOSstate(e); }
+static void c_decodeEPOSstate(void) { decodeEPOSstate(e->Statusword); }
+static void c_observeEPOSstatus(void) { observeEPOSstatus(e, e->Statusword); }
+static void c_printEPOSstatusword(void) { printEPOSstatusword(e->Statusword); }
+static void c_printEPOScontrolword(void) { printEPOScontrolword(0x000F); }
+static void c_readOpMode(void) { readOpMode(e); }
+static void c_setOpMode(void) { setOpMode(e, PPM); }
+static void c_readDemandPosition(void) { int32_t v; readDemandPosition(e, &v); }
+static void c_readActualPosition(void) { int32_t v; readActualPosition(e, &v); }
+static void c_readTargetPosition(void) { int32_t v; readTargetPosition(e, &v); }
+static void c_readPositionWindow(void) { uint32_t v; readPositionWindow(e, &v); }
+static void c_writePositionWindow(void) { writePositionWindow(e, 20); }
+static void c_readDemandVelocity(void) { int32_t v; readDemandVelocity(e, &v); }
+static void c_readActualVelocity(void) { int32_t v; readActualVelocity(e, &v); }
+static void c_readTargetVelocity(void) { int32_t v; readTargetVelocity(e, &v); }
+static void c_readActualCurrent(void) { int16_t v; readActualCurrent(e, &v); }
+static void c_setProfileVelocity(void) { setProfileVelocity(e, 6000); }
+static void c_setProfileAcceleration(void) { setProfileAcceleration(e, 100000); }
+static void c_setProfileDeceleration(void) { setProfileDeceleration(e, 100000); }
+static void c_setMotionProfileType(void) { setMotionProfileType(e, 0); }
+static void c_setMaximalProfileVelocity(void) { setMaximalProfileVelocity(e, 8000); }
+static void c_setQuickStopDeceleration(void) { setQuickStopDeceleration(e, 100000); }
+static void c_setGPIOProfile(void) { setGPIOProfile(e, PurposeA, SET); }
+static void c_setEPOSHeartbeat(void) { setEPOSHeartbeat(e, 0, 0); }
+static void c_checkEPOSHeartbeat(void) { checkEPOSHeartbeat(epos, epos_num); }
+static void c_readEPOSErrorHistory(void) { readEPOSErrorHistory(epos, epos_num, &hist, true, NULL); }
+static void c_changeEPOSstate_shutdown(void) { changeEPOSstate(e, 0); }
+static void c_changeEPOSstate_switchon(void) { changeEPOSstate(e, 1); }
+static void c_changeEPOSstate_enableop(void) { changeEPOSstate(e, 5); }
+static void c_moveAbsolute(void) { moveAbsolute(e, 2000); }
+static void c_checkTarget(void) { checkTarget(e); }
+static void c_moveRelative(void) { moveRelative(e, -1000); }
+static void c_waitForTarget(void) { waitForTarget(e, 10); }
+static void c_monitorStatus(void) { moveAbsolute(e, 0); monitorStatus(e); }
+static void c_doHoming(void) { doHoming(e, 35, 500); }
+static void c_monitorHomingStatus(void) { monitorHomingStatus(e); }
+static void c_setTargetVelocity(void) { setTargetVelocity(e, 100); }
+static void c_moveWithVelocity(void) { moveWithVelocity(e, 200); }
+static void c_haltVelocityMovement(void) { haltVelocityMovement(e); }
+static void c_startVelocityMovement(void) { startVelocityMovement(e); }
+static void c_configEPOSRecorder(void) { configEPOSRecorder(e, &rec); }
+static void c_armEPOSRecorder(void) { armEPOSRecorder(e); }
+static void c_triggerEPOSRecorder(void) { triggerEPOSRecorder(e); }
+static void c_pollEPOSRecorder(void) { WORD w; pollEPOSRecorder(e, &w); }
+static void c_uploadEPOSRecorder(void) {
+  int32_t samples[8], *data[1] = { samples };
+  uploadEPOSRecorder(e, &rec, data, 8);
+}
+static void c_changeEPOSstate_disablevoltage(void) { changeEPOSstate(e, 2); }
+static void c_startPDO(void) { startPDO(e); }
+static void c_bringUpEPOS(void) { bringUpEPOS(epos, epos_num, 1000); }
+static void c_PDOSwitchProfile(void) { PDOSwitchProfile(e, PPM); }
+static void c_PDOSetPosition(void) { PDOSetPosition(e, 1000); }
+static void c_PDOSetRelativePosition(void) { PDOSetRelativePosition(e, -500); }
+static void c_PDOSetVelocity(void) { PDOSwitchProfile(e, PVM); PDOSetVelocity(e, 0); }
+static void c_PDOHalt(void) { PDOHalt(e, 100); }
+static void c_PDODisableOp(void) { PDODisableOp(e, 100); }
+static void c_PDOShutDown(void) { PDOShutDown(e); }
+static void c_PDOSwitchOn(void) { PDOSwitchOn(e); }
+static void c_PDOEnableOp(void) { PDOEnableOp(e); }
+static void c_PDOQuickStop(void) { PDOQuickStop(e, 100); }
+static void c_PDODisableVoltage(void) { PDODisableVoltage(e, 100); }
+static void c_PDOFaultReset(void) { PDOFaultReset(e, 100); }
+static void c_PDOControl(void) { PDOControl(e, EPOS_CMD_SHUTDOWN, 100); PDOControl(e, EPOS_CMD_ENABLEOP, 100); }
+static void c_armEPOSQuickStop(void) { armEPOSQuickStop(epos, epos_num); }
+static void c_triggerEPOSQuickStop(void) { triggerEPOSQuickStop(); }
+static void c_checkEPOSQuickStop(void) { uint32_t t; checkEPOSQuickStop(&t); }
+static void c_cancelEPOSQuickStop(void) { cancelEPOSQuickStop(); }
+static void c_receiveEPOSFrame(void) {
+  CanRxMsgTypeDef m;
+
+  // the statusword TPDO of the node, as a receive interrupt hands it on
+  memset(&m, 0, sizeof(m));
+  m.StdId = 0x181;
+  m.IDE = CAN_ID_STD;
+  m.RTR = CAN_RTR_DATA;
+  m.DLC = 2;
+  m.Data[0] = e->Statusword & 0xFF;
+  m.Data[1] = e->Statusword >> 8;
+  receiveEPOSFrame(&m, getEPOSTimeUs());
+}
+static void c_processCANMsg(void) { processCANMsg(epos, epos_num); }
+static void c_processPDOMessage(void) { processPDOMessage(epos, epos_num); }
+static void c_dispatchEPOSEvents(void) { dispatchEPOSEvents(); }
+static void c_getEPOSEmcy(void) { eposEmcy_t m[EPOS_EMCY_HISTORY]; getEPOSEmcy(e, m, EPOS_EMCY_HISTORY); }
+static void c_clearEPOSEmcy(void) { clearEPOSEmcy(e); }
+static void c_getEPOSStats(void) { eposStats_t s; getEPOSStats(e, &s); }
+static void c_resetEPOSStats(void) { resetEPOSStats(e); }
+static void c_getEPOSBusStats(void) { eposBusStats_t s; getEPOSBusStats(&s); }
+static void c_resetEPOSBusStats(void) { resetEPOSBusStats(); }
+static void c_pollEPOSTransport(void) { pollEPOSTransport(); }
+static void c_getEPOSTimeUs(void) { getEPOSTimeUs(); }
+static void c_stopPDO(void) { stopPDO(e); }
+
+#define CASE(name) { #name, c_##name }
+
+static const struct {
+  const char *name;
+  void (*fn)(void);
+} cases[] = {
+  CASE(openEPOS),
+  CASE(setEPOSBitrate),
+  CASE(setEPOSTransport),
+  CASE(getEPOSTransport),
+  CASE(setEPOSEventCallback),
+  CASE(checkEPOS),
+  CASE(readSWversion),
+  CASE(readDeviceName),
+  CASE(readRS232timeout),
+  CASE(readDInputPolarity),
+  CASE(setHomePolarity),
+  CASE(readStatusword),
+  CASE(readControlword),
+  CASE(read_DevErr),
+  CASE(checkEPOSerror),
+  CASE(EPOSErrorText),
+  CASE(checkEPOSstate),
+  CASE(printEPOSstate),
+  CASE(decodeEPOSstate),
+  CASE(observeEPOSstatus),
+  CASE(printEPOSstatusword),
+  CASE(printEPOScontrolword),
+  CASE(readOpMode),
+  CASE(setOpMode),
+  CASE(readDemandPosition),
+  CASE(readActualPosition),
+  CASE(readTargetPosition),
+  CASE(readPositionWindow),
+  CASE(writePositionWindow),
+  CASE(readDemandVelocity),
+  CASE(readActualVelocity),
+  CASE(readTargetVelocity),
+  CASE(readActualCurrent),
+  CASE(setProfileVelocity),
+  CASE(setProfileAcceleration),
+  CASE(setProfileDeceleration),
+  CASE(setMotionProfileType),
+  CASE(setMaximalProfileVelocity),
+  CASE(setQuickStopDeceleration),
+  CASE(setGPIOProfile),
+  CASE(setEPOSHeartbeat),
+  CASE(checkEPOSHeartbeat),
+  CASE(readEPOSErrorHistory),
+  CASE(changeEPOSstate_shutdown),
+  CASE(changeEPOSstate_switchon),
+  CASE(changeEPOSstate_enableop),
+  CASE(moveAbsolute),
+  CASE(checkTarget),
+  CASE(moveRelative),
+  CASE(waitForTarget),
+  CASE(monitorStatus),
+  CASE(doHoming),
+  CASE(monitorHomingStatus),
+  CASE(setTargetVelocity),
+  CASE(moveWithVelocity),
+  CASE(haltVelocityMovement),
+  CASE(startVelocityMovement),
+  CASE(configEPOSRecorder),
+  CASE(armEPOSRecorder),
+  CASE(triggerEPOSRecorder),
+  CASE(pollEPOSRecorder),
+  CASE(uploadEPOSRecorder),
+  CASE(changeEPOSstate_disablevoltage),
+  CASE(startPDO),
+  CASE(bringUpEPOS),
+  CASE(PDOSwitchProfile),
+  CASE(PDOSetPosition),
+  CASE(PDOSetRelativePosition),
+  CASE(PDOSetVelocity),
+  CASE(PDOHalt),
+  CASE(PDODisableOp),
+  CASE(PDOShutDown),
+  CASE(PDOSwitchOn),
+  CASE(PDOEnableOp),
+  CASE(PDOQuickStop),
+  CASE(PDODisableVoltage),
+  CASE(PDOFaultReset),
+  CASE(PDOControl),
+  CASE(armEPOSQuickStop),
+  CASE(triggerEPOSQuickStop),
+  CASE(checkEPOSQuickStop),
+  CASE(cancelEPOSQuickStop),
+  CASE(receiveEPOSFrame),
+  CASE(processCANMsg),
+  CASE(processPDOMessage),
+  CASE(dispatchEPOSEvents),
+  CASE(getEPOSEmcy),
+  CASE(clearEPOSEmcy),
+  CASE(getEPOSStats),
+  CASE(resetEPOSStats),
+  CASE(getEPOSBusStats),
+  CASE(resetEPOSBusStats),
+  CASE(pollEPOSTransport),
+  CASE(getEPOSTimeUs),
+  CASE(stopPDO),
+};
+#define CASES (sizeof(cases) / sizeof(cases[0]))
+
+static int readGolden(const char *path) {
+  char line[256], name[64];
+  record_t *r = NULL;
+  size_t len = 0;
+  FILE *f;
+
+  if (!(f = fopen(path, "r"))) {
+    perror(path);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#' || line[0] == '\n') continue;
+    if (line[0] == ' ') {
+      if (!r) continue;
+      r->text = realloc(r->text, len + strlen(line) + 1);
+      strcpy(r->text + len, line);
+      len += strlen(line);
+      continue;
+    }
+    if (nGolden == MAX_CASES) break;
+    r = &golden[nGolden++];
+    if (sscanf(line, "%63s %u %u", name, &r->frames, &r->trips) != 3) {
+      fprintf(stderr, "%s: bad line: %s", path, line);
+      fclose(f);
+      return -1;
+    }
+    r->name = strdup(name);
+    r->text = strdup("");
+    len = 0;
+  }
+  fclose(f);
+  return 0;
+}
+
+static int writeGolden(const char *path) {
+  FILE *f;
+  int i;
+
+  if (!(f = fopen(path, "w"))) {
+    perror(path);
+    return -1;
+  }
+  fprintf(f, "# the frames of every public function of epos.h, see test_frames.c\n");
+  fprintf(f, "# function frames round_trips, then the frames: > from the driver, < from the node\n");
+  for (i = 0; i < nGot; i++)
+    fprintf(f, "%s %u %u\n%s", got[i].name, got[i].frames, got[i].trips, got[i].text);
+  fclose(f);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  bool update = argc == 3 && strcmp(argv[1], "-u") == 0;
+  const char *path = argv[argc - 1];
+  unsigned i, failed = 0, total = 0, totalTrips = 0;
+  record_t *g;
+  eposSim_t *sim;
+  int k;
+
+  if (argc != 2 && !update) {
+    fprintf(stderr, "usage: %s [-u] golden\n", argv[0]);
+    return 2;
+  }
+  if (!update && readGolden(path) < 0) return 2;
+
+  hostReset();
+  removeEPOSSims();
+  if (!(sim = addEPOSSim(1))) return 1;
+  sim->TPDOMask = EPOS_SIM_TPDO1;
+  hostAddFrameHook(hook, NULL);
+  hostAdvance(5000);
+
+  for (i = 0; i < CASES; i++) {
+    textLen = 0;
+    text[0] = '\0';
+    frames = trips = 0;
+    recording = true;
+    cases[i].fn();
+    hostAdvance(EPOS_FRAMES_TAIL_US);
+    recording = false;
+    hostAdvance(EPOS_FRAMES_GAP_US);
+    dispatchEPOSEvents();
+
+    got[nGot].name = cases[i].name;
+    got[nGot].frames = frames;
+    got[nGot].trips = trips;
+    got[nGot].text = strdup(text);
+    nGot++;
+    total += frames;
+    totalTrips += trips;
+  }
+
+  if (update) {
+    printf("%u functions, %u frames, %u round trips written to %s\n", nGot, total, totalTrips, path);
+    return writeGolden(path) < 0 ? 2 : 0;
+  }
+
+  for (k = 0; k < nGot; k++) {
+    for (g = NULL, i = 0; i < (unsigned)nGolden; i++)
+      if (strcmp(golden[i].name, got[k].name) == 0) g = &golden[i];
+    if (!g) {
+      fprintf(stderr, "%s: not in the golden file\n", got[k].name);
+      failed++;
+      continue;
+    }
+    if (got[k].frames > g->frames || got[k].trips > g->trips) {
+      fprintf(stderr, "%s: %u frames, %u round trips, the golden file has %u and %u\n",
+              got[k].name, got[k].frames, got[k].trips, g->frames, g->trips);
+      failed++;
+    } else if (got[k].frames != g->frames || got[k].trips != g->trips
+               || strcmp(got[k].text, g->text) != 0) {
+      fprintf(stderr, "%s: other frames than in the golden file:\n%s", got[k].name, got[k].text);
+      failed++;
+    }
+  }
+  for (i = 0; i < (unsigned)nGolden; i++) {
+    for (k = 0; k < nGot && strcmp(golden[i].name, got[k].name) != 0; k++)
+      ;
+    if (k == nGot) {
+      fprintf(stderr, "%s: in the golden file, but not called\n", golden[i].name);
+      failed++;
+    }
+  }
+
+  printf("%u functions, %u frames, %u round trips\n", nGot, total, totalTrips);
+  if (failed) fprintf(stderr, "%u function(s) differ, -u writes the golden file anew\n", failed);
+  free(epos[0]);
+  removeEPOSSims();
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,189 @@
+/*! \file test_host.c
+
+\brief the driver against the host CAN model
+
+A minimal node answers SDO uploads of the statusword. Checks that an
+SDO round trip, a TPDO and an SDO timeout go through the real driver
+code and take the time they take on a 1 Mbit/s bus, stuff bits
+included, and that a polled transport gets a refused quick stop frame
+again.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "epos.h"
+#include "main.h"
+#include "epos_host.h"
+#include "check.h"
+
+static WORD statusword = 0x0140;   // switch on disabled
+static bool answer = true;
+
+/* node 1: answer the upload of 0x6041 after 50 us */
+static void node(const CanRxMsgTypeDef *f, bool fromDriver, void *ctx) {
+  uint8_t d[8] = { 0x4B, 0x41, 0x60, 0x00, 0, 0, 0, 0 };
+
+  (void)ctx;
+  if (!fromDriver || !answer || f->StdId != 0x601 || f->Data[0] != 0x40) return;
+  d[4] = statusword & 0xFF;
+  d[5] = statusword >> 8;
+  hostCANSend(0x581, 8, d, 50);
+}
+
+/* a transport without a receive interrupt that refuses the next
+   'refuse' frames */
+static int refuse, sent, sentMasked;
+
+static int polledSend(void *ctx, CAN_HandleTypeDef *dev, const CanTxMsgTypeDef *msg) {
+  (void)ctx; (void)dev; (void)msg;
+  if (__get_PRIMASK()) sentMasked++;
+  if (refuse > 0) {
+    refuse--;
+    return 0;
+  }
+  sent++;
+  return 1;
+}
+
+static int polledPoll(void *ctx) {
+  (void)ctx;
+  return 0;
+}
+
+static const eposTransport_t polled = { "polled", polledSend, polledPoll, NULL, NULL, NULL };
+
+int main(void) {
+  uint8_t pdo[2] = { 0x37, 0x05 };   // operation enable
+  uint8_t alt[8] = { 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55 };
+  uint8_t zero[8] = { 0 };
+  hostCANStats_t s0, s1;
+  uint64_t t0;
+  uint32_t rpdo, us;
+  eposBusStats_t bs;
+  int i;
+  epos_t *e;
+  WORD w = 0;
+
+  hostReset();
+  hostAddFrameHook(node, NULL);
+  CHECK((e = openEPOS(&hcan1, 1)) != NULL);
+  if (!e) return 1;
+  epos[0] = NULL;                   // processCANMsg() has to skip holes
+  epos[1] = e;
+  epos_num = 2;
+
+  // SDO round trip: two frames of 8 bytes, 111 us each, plus 50 us
+  t0 = hostTimeUs();
+  CHECK(readStatusword(e, &w) >= 0);
+  CHECK(w == statusword);
+  CHECK(e->State == EPOS_SWITCHONDIS);
+  CHECK(e->Stats.SDOCount == 1);
+  CHECK(e->Stats.TxFrames[0x600 >> 7] == 1);
+  CHECK(hostTimeUs() - t0 >= 2 * 111 + 50);
+
+  // a TPDO is decoded in the receive interrupt
+  hostCANSend(0x181, 2, pdo, 0);
+  hostIdle();
+  CHECK(e->Statusword == 0x0537);
+  CHECK(e->State == EPOS_OPENABLE);
+
+  // the node is found again after it moved in the array
+  epos[0] = e;
+  epos[1] = NULL;
+  pdo[0] = 0x33;
+  hostCANSend(0x181, 2, pdo, 0);
+  hostIdle();
+  CHECK(e->Statusword == 0x0533);
+  epos[0] = NULL;
+  epos[1] = e;
+  pdo[0] = 0x37;
+  hostCANSend(0x181, 2, pdo, 0);
+  hostIdle();
+  CHECK(e->Statusword == 0x0537);
+
+  // an EMCY frame shorter than 8 bytes is ignored
+  hostCANSend(0x081, 3, alt, 0);
+  hostIdle();
+  CHECK(e->EmcyCount == 0 && !e->ErrFlag);
+  hostCANSend(0x081, 8, alt, 0);
+  hostIdle();
+  CHECK(e->EmcyCount == 1 && e->Dev_Err == 0x5555);
+
+  // a heartbeat without data is ignored, one with the NMT state is taken
+  hostCANSend(0x701, 0, alt, 0);
+  hostIdle();
+  CHECK(e->NMTState == EPOS_NMT_UNKNOWN);
+  hostCANSend(0x701, 1, zero, 0);
+  hostIdle();
+  CHECK(e->NMTState == EPOS_NMT_BOOTUP);
+
+  // the state from before a command does not confirm it, a TPDO after it does
+  CHECK(PDOControl(e, EPOS_CMD_ENABLEOP, 5) == -2);
+  hostCANSend(0x181, 2, pdo, 1000);
+  CHECK(PDOControl(e, EPOS_CMD_ENABLEOP, 5) == 0);
+
+  // a quick stop frame the transport refuses goes out from a later poll,
+  // Send() is never called with the interrupts masked
+  CHECK(setEPOSTransport(&polled) == 0);
+  CHECK(armEPOSQuickStop(&e, 1) == 0);
+  refuse = 2;
+  rpdo = e->Stats.TxFrames[0x200 >> 7];
+  CHECK(triggerEPOSQuickStop() == 0);
+  CHECK(sent == 0);
+  pollEPOSTransport();
+  CHECK(sent == 0);
+  pollEPOSTransport();
+  CHECK(sent == 1);
+  CHECK(e->Stats.TxFrames[0x200 >> 7] == rpdo + 1);
+  pollEPOSTransport();
+  CHECK(sent == 1);
+  CHECK(sentMasked == 0);
+  CHECK(cancelEPOSQuickStop() == 0);
+  CHECK(setEPOSTransport(NULL) == 0);
+
+  // getEPOSTimeUs() keeps the virtual time over gaps beyond the 4.3 s
+  // wrap of the ns cycle counter
+  us = getEPOSTimeUs();
+  hostAdvance(1000000);
+  CHECK(getEPOSTimeUs() - us - 1000000 < 100);
+  us = getEPOSTimeUs();
+  hostAdvance(6000000);
+  CHECK(getEPOSTimeUs() - us - 6000000 < 1000);
+
+  // stuff bits: none in alternating data, one per 4 bits in zeros
+  hostGetCANStats(&s0);
+  hostCANSend(0x0FF, 8, alt, 0);
+  hostIdle();
+  hostGetCANStats(&s1);
+  CHECK(s1.Bits - s0.Bits == 47 + 64);
+  CHECK(s1.StuffBits - s0.StuffBits < 8);
+  t0 = s1.BusyUs - s0.BusyUs;
+  hostCANSend(0x0FF, 8, zero, 0);
+  hostIdle();
+  hostGetCANStats(&s0);
+  CHECK(s0.StuffBits - s1.StuffBits >= 64 / 4);
+  CHECK(s0.BusyUs - s1.BusyUs >= t0 + 64 / 4 - 8);
+
+  // a saturated bus: the nominal load stays below 100 %, the worst case
+  // bound is cut at 100 %
+  resetEPOSBusStats();
+  for (i = 0; i < 50; i++) hostCANSend(0x0FF, 8, zero, 0);
+  hostIdle();
+  getEPOSBusStats(&bs);
+  CHECK(bs.RxFrames == 50);
+  CHECK(bs.Load > 800 && bs.Load < 1000);
+  CHECK(bs.LoadMax == 1000);
+
+  // no answer: NTRY requests, EPOS_SDO_TIMEOUT ms each
+  answer = false;
+  t0 = hostTimeUs();
+  CHECK(readStatusword(e, &w) < 0);
+  CHECK(e->E_error == 0x05040000);
+  CHECK(e->Stats.SDOTimeouts == NTRY);
+  CHECK(hostTimeUs() - t0 >= NTRY * EPOS_SDO_TIMEOUT * 1000ull);
+
+  free(e);
+  if (failed) fprintf(stderr, "%d check(s) failed\n", failed);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,176 @@
+/*! \file test_isr.c
+
+\brief worst case cost of the receive interrupt for 1, 6 and 32 nodes
+
+Every kind of frame the driver takes in HAL_CAN_RxCpltCallback() goes
+to the first and to the last of the open nodes: the four TPDOs with a
+state change, an SDO answer, an EMCY and a heartbeat with an NMT
+change, and a frame of no node, which runs the whole dispatch loop.
+The cost of a frame is the number of instructions the host CPU executes
+in the callback, counted by the performance counter of Linux; each
+frame is sent EPOS_ISR_RUNS times and the least count taken, so what
+is left is the path through the code and not the noise of the counter.
+
+The worst frame of every node count has to stay within
+EPOS_ISR_BUDGET_BASE + EPOS_ISR_BUDGET_NODE instructions per open node,
+or the test fails. Without a performance counter (a VM without a PMU,
+perf_event_paranoid 3) it is skipped.
+
+*/
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "epos.h"
+#include "main.h"
+#include "epos_host.h"
+
+/*! \brief instructions one frame may take besides the dispatch loop,
+   HAL_GetTick() and the interrupt mask of the host model included, which
+   getEPOSTimeUs() takes for the stamp; set for the default build without
+   optimization, about 25 % above what it takes now */
+#ifndef EPOS_ISR_BUDGET_BASE
+#define EPOS_ISR_BUDGET_BASE  4000
+#endif
+/*! \brief instructions one frame may take per open node */
+#ifndef EPOS_ISR_BUDGET_NODE
+#define EPOS_ISR_BUDGET_NODE  240
+#endif
+/*! \brief measurements per frame, the least count is taken */
+#ifndef EPOS_ISR_RUNS
+#define EPOS_ISR_RUNS  16
+#endif
+
+#define SKIP 77
+
+static const uint8_t nodeCounts[] = { 1, 6, 32 };
+#define CONFIGS (sizeof(nodeCounts) / sizeof(nodeCounts[0]))
+
+/* a frame of one kind, the data of even and odd runs differ so that
+   every run takes the path of a change */
+typedef struct {
+  const char *name;
+  uint16_t base;
+  uint8_t dlc;
+  uint8_t data[2][8];
+} frameKind_t;
+
+static const frameKind_t kinds[] = {
+  { "tpdo1",     0x180, 2, { { 0x40, 0x01 }, { 0x37, 0x01 } } },
+  { "tpdo2",     0x280, 4, { { 0x40, 0x01, 0x10 }, { 0x37, 0x01, 0x20 } } },
+  { "tpdo3",     0x380, 6, { { 0x40, 0x01, 1, 2, 3, 4 }, { 0x37, 0x01, 5, 6, 7, 8 } } },
+  { "tpdo4",     0x480, 6, { { 0x40, 0x01, 1, 2, 3, 4 }, { 0x37, 0x01, 5, 6, 7, 8 } } },
+  { "sdo",       0x580, 8, { { 0x4B, 0x41, 0x60, 0, 0x40, 0x01 }, { 0x4B, 0x41, 0x60, 0, 0x37, 0x01 } } },
+  { "emcy",      0x080, 8, { { 0x10, 0x23, 0x01 }, { 0x00, 0x00, 0x00 } } },
+  { "heartbeat", 0x700, 1, { { 0x05 }, { 0x7F } } },
+  { "unknown",   0x000, 8, { { 0x80 }, { 0x80 } } },   // SYNC, no node
+};
+#define KINDS (sizeof(kinds) / sizeof(kinds[0]))
+
+static int counter = -1;
+
+static int openCounter(void) {
+  struct perf_event_attr a;
+
+  memset(&a, 0, sizeof(a));
+  a.type = PERF_TYPE_HARDWARE;
+  a.size = sizeof(a);
+  a.config = PERF_COUNT_HW_INSTRUCTIONS;
+  a.disabled = 1;
+  a.exclude_kernel = 1;
+  a.exclude_hv = 1;
+  counter = syscall(SYS_perf_event_open, &a, 0, -1, -1, 0);
+  return counter;
+}
+
+/* instructions of one call of the receive interrupt, NULL for the cost
+   of the counting alone */
+static uint64_t count(const CanRxMsgTypeDef *msg) {
+  uint64_t n = 0;
+
+  ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+  ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+  if (msg) {
+    hcan1.pRxMsg = (CanRxMsgTypeDef *)msg;
+    HAL_CAN_RxCpltCallback(&hcan1);
+  }
+  ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+  if (read(counter, &n, sizeof(n)) != sizeof(n)) return 0;
+  return n;
+}
+
+static uint64_t least(const frameKind_t *k, uint8_t node, uint64_t overhead) {
+  CanRxMsgTypeDef msg;
+  uint64_t n, min = UINT64_MAX;
+  int r;
+
+  for (r = 0; r < EPOS_ISR_RUNS; r++) {
+    memset(&msg, 0, sizeof(msg));
+    msg.StdId = k->base ? k->base + node : 0x080;
+    msg.IDE = CAN_ID_STD;
+    msg.RTR = CAN_RTR_DATA;
+    msg.DLC = k->dlc;
+    memcpy(msg.Data, k->data[r & 1], 8);
+    n = count(&msg);
+    if (n < min) min = n;
+    dispatchEPOSEvents();   // a full event queue would take another path
+  }
+  return min > overhead ? min - overhead : 0;
+}
+
+int main(void) {
+  uint64_t overhead = UINT64_MAX, n, worst, budget;
+  const char *worstName;
+  unsigned c, k, i, nodes;
+  uint8_t worstNode;
+  int failed = 0;
+
+  if (openCounter() < 0) {
+    perror("perf_event_open, no instruction counter");
+    return SKIP;
+  }
+  for (i = 0; i < EPOS_ISR_RUNS; i++)
+    if ((n = count(NULL)) < overhead) overhead = n;
+
+  for (c = 0; c < CONFIGS; c++) {
+    nodes = nodeCounts[c];
+    hostReset();
+    for (i = 0; i < nodes; i++)
+      if (!(epos[i] = openEPOS(&hcan1, i + 1))) return 1;
+    epos_num = nodes;
+
+    worst = 0;
+    worstName = "";
+    worstNode = 0;
+    for (k = 0; k < KINDS; k++) {
+      for (i = 1; i <= nodes; i += (nodes > 1 ? nodes - 1 : 1)) {
+        n = least(&kinds[k], i, overhead);
+        if (n > worst) {
+          worst = n;
+          worstName = kinds[k].name;
+          worstNode = i;
+        }
+      }
+    }
+
+    budget = EPOS_ISR_BUDGET_BASE + (uint64_t)EPOS_ISR_BUDGET_NODE * nodes;
+    printf("%2u nodes: worst %llu instructions (%s, node %u), budget %llu\n",
+           nodes, (unsigned long long)worst, worstName, worstNode,
+           (unsigned long long)budget);
+    if (worst > budget) {
+      fprintf(stderr, "%u nodes: the receive interrupt is over budget\n", nodes);
+      failed++;
+    }
+
+    for (i = 0; i < nodes; i++) free(epos[i]);
+    epos_num = 0;
+  }
+
+  close(counter);
+  return failed ? 1 : 0;
+}
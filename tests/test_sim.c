@@ -0,0 +1,126 @@
+/*! \file test_sim.c
+
+\brief the driver against simulated EPOS2 nodes
+
+Brings three virtual nodes up in parallel, moves one of them with PDOs
+while its data recorder runs and uploads the samples by segmented SDO,
+raises a fault on another and reads it back by EMCY, TPDO and error
+history, and lets the third one go silent after switching its heartbeat
+on.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "epos.h"
+#include "main.h"
+#include "epos_host.h"
+#include "epos_sim.h"
+#include "check.h"
+
+#define NODES 3
+
+int main(void) {
+  eposRecorder_t rec = { 1, { { 0x6064, 0x00, 4, true } }, 10, 20, 0 };
+  int32_t samples[256], *data[1] = { samples };
+  eposErrHist_t hist[NODES];
+  eposEmcy_t emcy;
+  eposSim_t *sim[NODES];
+  int32_t pos = 0;
+  WORD w = 0;
+  int i, n;
+
+  hostReset();
+  removeEPOSSims();
+  for (i = 0; i < NODES; i++) {
+    CHECK((sim[i] = addEPOSSim(i + 1)) != NULL);
+    CHECK((epos[i] = openEPOS(&hcan1, i + 1)) != NULL);
+    if (!sim[i] || !epos[i]) return 1;
+  }
+  epos_num = NODES;
+  CHECK(addEPOSSim(1) == NULL);
+  hostAdvance(5000);
+
+  // NMT start and the state machine of all nodes in parallel
+  CHECK(bringUpEPOS(epos, NODES, 1000) == 0);
+  for (i = 0; i < NODES; i++) {
+    CHECK(epos[i]->State == EPOS_OPENABLE);
+    CHECK(sim[i]->State == EPOS_OPENABLE);
+    CHECK(sim[i]->NMTState == EPOS_NMT_OPERATIONAL);
+  }
+
+  // a move by RPDO3, recorded by the node and uploaded segmented
+  CHECK(configEPOSRecorder(epos[0], &rec) == 0);
+  CHECK(armEPOSRecorder(epos[0]) == 0);
+  hostAdvance(600000);                        // more than the ring holds
+  CHECK(triggerEPOSRecorder(epos[0]) == 0);
+  CHECK(PDOSetPosition(epos[0], 4000) > 0);
+  hostAdvance(1000000);
+  CHECK(readActualPosition(epos[0], &pos) == 0);
+  CHECK(pos == 4000);
+  CHECK(epos[0]->RxPosition == 4000);
+  CHECK(readStatusword(epos[0], &w) == 0);
+  CHECK(w & 0x0400);                          // target reached
+  CHECK(pollEPOSRecorder(epos[0], &w) == 1);
+  CHECK(w & EPOS_REC_AVAILABLE);
+  CHECK(sim[0]->RecStart != 0);               // the ring has wrapped
+  n = uploadEPOSRecorder(epos[0], &rec, data, 256);
+  CHECK(n > 256 && n <= EPOS_SIM_RECBUF / 4);
+  CHECK(samples[0] == 0 && samples[255] == 4000);
+  for (i = 1; i < 256; i++)
+    CHECK(samples[i] >= samples[i - 1]);
+
+  // an over temperature error on node 2
+  faultEPOSSim(sim[1], EP_OTERR, 0x08);
+  hostAdvance(10000);
+  CHECK(epos[1]->State == EPOS_FAULT);
+  CHECK(getEPOSEmcy(epos[1], &emcy, 1) == 1);
+  CHECK(emcy.Code == EP_OTERR && emcy.Register == 0x09);
+  CHECK(readEPOSErrorHistory(epos, NODES, hist, false, NULL) == 0);
+  CHECK(hist[0].Count == 0 && hist[2].Count == 0);
+  CHECK(hist[1].Count == 1 && hist[1].Rec[0].Code == EP_OTERR);
+
+  // unknown subindex: SDO abort
+  read_DevErr(epos[1], 6, &w);
+  CHECK(epos[1]->E_error == 0x06090011);
+
+  // the fault reset brings it back
+  CHECK(bringUpEPOS(epos, NODES, 1000) == 0);
+  CHECK(sim[1]->State == EPOS_OPENABLE);
+  CHECK(getEPOSEmcy(epos[1], &emcy, 1) == 1 && emcy.Code == EP_NOERR);
+
+  // heartbeat of node 3, then silence
+  CHECK(setEPOSHeartbeat(epos[2], 10, 0) == 0);
+  hostAdvance(50000);
+  CHECK(checkEPOSHeartbeat(epos, NODES) == 0);
+  sim[2]->Silent = true;
+  hostAdvance(50000);
+  CHECK(checkEPOSHeartbeat(epos, NODES) == 1);
+  CHECK(epos[2]->Lost);
+
+  // quick stop: a faulty axis counts as stopped, the silent one never
+  // confirms, so the stop ends unconfirmed and can be armed again
+  faultEPOSSim(sim[1], EP_OTERR, 0x08);
+  hostAdvance(10000);
+  CHECK(armEPOSQuickStop(epos, NODES) == 0);
+  CHECK(triggerEPOSQuickStop() == 0);
+  hostAdvance(20000);
+  CHECK(checkEPOSQuickStop(NULL) == 0);
+  CHECK(epos[0]->State == EPOS_SWITCHONDIS && epos[0]->StopTime != EPOS_NOT_STOPPED);
+  CHECK(epos[1]->StopTime == 0);
+  CHECK(armEPOSQuickStop(epos, NODES) < 0);
+  hostAdvance(EPOS_QUICKSTOP_TIMEOUT * 1000);
+  CHECK(checkEPOSQuickStop(NULL) == -2);
+  CHECK(epos[2]->StopTime == EPOS_NOT_STOPPED);
+  CHECK(readStatusword(epos[0], &w) == 0);
+  CHECK(armEPOSQuickStop(epos, NODES) == 0);
+  CHECK(triggerEPOSQuickStop() == 0);
+  CHECK(cancelEPOSQuickStop() == 0);
+  CHECK(checkEPOSQuickStop(NULL) == -2);
+  CHECK(armEPOSQuickStop(epos, NODES) == 0);
+
+  for (i = 0; i < NODES; i++) free(epos[i]);
+  removeEPOSSims();
+  if (failed) fprintf(stderr, "%d check(s) failed\n", failed);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,101 @@
+/*! \file test_socketcan.c
+
+\brief the driver on the SocketCAN transport, over vcan0
+
+A thread with a second socket answers the SDO uploads of node 1. Checks
+an SDO round trip, the receive timestamp and that the kernel filter
+keeps the frames of nodes that were not opened away. Skipped (77) when
+there is no vcan0.
+
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+#include "epos.h"
+#include "main.h"
+#include "epos_socketcan.h"
+#include "check.h"
+
+#define IFNAME "vcan0"
+
+extern CAN_HandleTypeDef hcan1;     // epos_linux.c
+
+static volatile bool done = false;
+
+/* node 1: statusword 'switch on disabled'; also sends a TPDO of node 2 */
+static void *node(void *arg) {
+  struct can_frame f, other = { .can_id = 0x182, .can_dlc = 2, .data = { 0x40, 0x01 } };
+  int s = *(int *)arg;
+
+  while (!done) {
+    if (read(s, &f, sizeof(f)) != sizeof(f)) {
+      usleep(100);
+      continue;
+    }
+    if (f.can_id != 0x601 || f.data[0] != 0x40) continue;
+    write(s, &other, sizeof(other));
+    f.can_id = 0x581;
+    f.data[0] = 0x4B;
+    f.data[4] = 0x40;
+    f.data[5] = 0x01;
+    f.data[6] = f.data[7] = 0;
+    write(s, &f, sizeof(f));
+  }
+  return NULL;
+}
+
+int main(void) {
+  const eposTransport_t *t;
+  struct sockaddr_can addr;
+  struct ifreq ifr;
+  eposBusStats_t bs;
+  pthread_t th;
+  WORD w = 0;
+  int s;
+
+  if (!(t = openEPOSSocketCAN(IFNAME))) {
+    fprintf(stderr, "no %s, skipped\n", IFNAME);
+    return 77;
+  }
+  s = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK, CAN_RAW);
+  memset(&ifr, 0, sizeof(ifr));
+  strcpy(ifr.ifr_name, IFNAME);
+  ioctl(s, SIOCGIFINDEX, &ifr);
+  memset(&addr, 0, sizeof(addr));
+  addr.can_family = AF_CAN;
+  addr.can_ifindex = ifr.ifr_ifindex;
+  CHECK(bind(s, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+  pthread_create(&th, NULL, node, &s);
+
+  CHECK(setEPOSTransport(t) == 0);
+  CHECK(getEPOSTransport() == t);
+  CHECK((epos[0] = openEPOS(&hcan1, 1)) != NULL);
+  epos_num = 1;
+  resetEPOSBusStats();
+
+  CHECK(readStatusword(epos[0], &w) == 0);
+  CHECK(w == 0x0140);
+  CHECK(epos[0]->State == EPOS_SWITCHONDIS);
+  CHECK(getEPOSTimeUs() - epos[0]->RxStamp < 1000000);   // the driver clock
+  HAL_Delay(10);
+  getEPOSBusStats(&bs);
+  CHECK(bs.RxFrames == 1);          // not the TPDO of node 2
+  CHECK(bs.RxUnknown == 0);
+
+  done = true;
+  pthread_join(th, NULL);
+  close(s);
+  closeEPOSSocketCAN();
+  CHECK(strcmp(getEPOSTransport()->Name, "bxCAN") == 0);
+  free(epos[0]);
+  if (failed) fprintf(stderr, "%d check(s) failed\n", failed);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+/*! \file test_state.c
+
+\brief decodeEPOSstate() against the state table of the firmware spec
+
+All 65536 statuswords, each against the patterns of firmware spec
+8.1.1 as they are printed there, x for a bit that does not matter. A
+statusword has to match exactly the pattern of the state it decodes to,
+or none if it decodes to EPOS_BADSTATE. Then the tracking in
+observeEPOSstatus() for a run of statuswords with transient values.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "epos.h"
+#include "main.h"
+#include "epos_host.h"
+#include "check.h"
+
+/* firmware spec 8.1.1, bit 15 first */
+static const struct {
+  int state;
+  const char *bits;
+} spec[] = {
+  { EPOS_START,         "x0xx xxx0 x000 0000" },
+  { EPOS_NOTREADY,      "x0xx xxx1 x000 0000" },
+  { EPOS_SWITCHONDIS,   "x0xx xxx1 x100 0000" },
+  { EPOS_READY,         "x0xx xxx1 x010 0001" },
+  { EPOS_SWITCHEDON,    "x0xx xxx1 x010 0011" },
+  { EPOS_REFRESH,       "x1xx xxx1 x010 0011" },
+  { EPOS_MEASUREINIT,   "x1xx xxx1 x011 0011" },
+  { EPOS_OPENABLE,      "x0xx xxx1 x011 0111" },
+  { EPOS_QUICKSTOP,     "x0xx xxx1 x001 0111" },
+  { EPOS_FAULTREACTDIS, "x0xx xxx1 x000 1111" },
+  { EPOS_FAULTREACTEN,  "x0xx xxx1 x001 1111" },
+  { EPOS_FAULT,         "x0xx xxx1 x000 1000" },
+};
+#define STATES (sizeof(spec) / sizeof(spec[0]))
+
+static int matches(const char *bits, unsigned w) {
+  int b = 15;
+
+  for (; *bits; bits++) {
+    if (*bits == ' ') continue;
+    if (*bits != 'x' && (unsigned)(*bits - '0') != ((w >> b) & 1)) return 0;
+    b--;
+  }
+  return 1;
+}
+
+int main(void) {
+  static const WORD run[] = { 0x0140, 0x0121, 0x0101, 0x0123, 0x0133, 0x0137, 0x0108 };
+  static const int states[] = { EPOS_SWITCHONDIS, EPOS_READY, EPOS_READY, EPOS_SWITCHEDON,
+                                EPOS_SWITCHEDON, EPOS_OPENABLE, EPOS_FAULT };
+  unsigned w, i, n, count[STATES] = { 0 }, bad = 0;
+  int s;
+  epos_t *e;
+
+  for (w = 0; w <= 0xFFFF; w++) {
+    s = decodeEPOSstate((WORD)w);
+    for (i = 0, n = 0; i < STATES; i++) {
+      if (!matches(spec[i].bits, w)) continue;
+      n++;
+      if (s != spec[i].state) {
+        fprintf(stderr, "statusword %#06x: state %d, spec has %d\n", w, s, spec[i].state);
+        failed++;
+      }
+    }
+    CHECK(n <= 1);
+    if (n == 0 && s != EPOS_BADSTATE) {
+      fprintf(stderr, "statusword %#06x: state %d, spec has none\n", w, s);
+      failed++;
+    }
+    if (s >= 0 && s < (int)STATES) count[s]++;
+    else bad++;
+  }
+
+  // every state has its share of the 2^7 don't care bits
+  for (i = 0; i < STATES; i++) CHECK(count[i] == 128);
+  CHECK(bad == 65536 - STATES * 128);
+
+  // a statusword between two states leaves the tracked state alone
+  hostReset();
+  if (!(e = openEPOS(&hcan1, 1))) return 1;
+  CHECK(e->State == EPOS_NOSTATE);
+  for (i = 0; i < sizeof(run) / sizeof(run[0]); i++) {
+    s = observeEPOSstatus(e, run[i]);
+    CHECK(s == decodeEPOSstate(run[i]));
+    CHECK(e->State == states[i]);
+    CHECK(e->Statusword == run[i]);
+  }
+  free(e);
+
+  if (failed) fprintf(stderr, "%d check(s) failed\n", failed);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,67 @@
+/*! \file epos_logdump.c
+
+\brief host decoder for the deferred log of libEPOS
+
+Reads the raw records of the EPOS log channel (e.g. written to a file
+by JLinkRTTLogger, or the bytes of readEPOSLog()) from a file or stdin
+and prints them as text:
+
+    epos_logdump rtt_channel1.bin
+
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "../epos_log.h"
+
+static const struct {
+    const char *name;
+    const char *level;
+    const char *format;
+} msg[] = {
+#define EPOS_LOGMSG(name, level, format) { #name, #level, format },
+#include "../epos_logmsg.h"
+#undef EPOS_LOGMSG
+};
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int main(int argc, char **argv) {
+    FILE *in = stdin;
+    uint8_t rec[8 + 4 * EPOS_LOG_MAXARGS];
+    uint32_t arg[EPOS_LOG_MAXARGS] = { 0 };
+    unsigned long skipped = 0;
+    unsigned int id, nargs, i;
+
+    if (argc > 1 && !(in = fopen(argv[1], "rb"))) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    while (fread(rec, 1, 4, in) == 4) {
+        // resynchronise byte by byte after garbage
+        while (rec[3] != EPOS_LOG_SYNC || rec[2] > EPOS_LOG_MAXARGS
+               || (rec[0] | (rec[1] << 8)) >= EPOS_LOGID_COUNT) {
+            int c = fgetc(in);
+            if (c == EOF) goto done;
+            rec[0] = rec[1]; rec[1] = rec[2]; rec[2] = rec[3]; rec[3] = c;
+            skipped++;
+        }
+        id = rec[0] | (rec[1] << 8);
+        nargs = rec[2];
+        if (fread(rec + 4, 1, 4 + 4 * nargs, in) != 4 + 4 * nargs) break;
+        for (i = 0; i < EPOS_LOG_MAXARGS; i++)
+            arg[i] = i < nargs ? get32(rec + 8 + 4 * i) : 0;
+
+        printf("%10lu ms  %-15s ", (unsigned long)get32(rec + 4), msg[id].name);
+        printf(msg[id].format, arg[0], arg[1], arg[2], arg[3]);
+        printf("\n");
+    }
+done:
+    if (skipped)
+        fprintf(stderr, "%lu bytes skipped\n", skipped);
+    return 0;
+}
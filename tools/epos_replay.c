@@ -0,0 +1,349 @@
+/*! \file epos_replay.c
+
+\brief replay a candump log into the driver
+
+Feeds the frames of a candump log into HAL_CAN_RxCpltCallback() of the
+host build, as fast as possible or, with -t, at their original times in
+virtual time. The per-axis state decoded at the end goes to stdout, one
+line per node, in the format of the expectations that -e checks:
+
+    # seconds after the first frame, or 'end'; node; field=value ...
+    0.045 1 statusword=0x0537 state=7
+    end   2 state=11 emcy=0x4210 nmt=0x0005
+
+Fields: statusword, state, position, velocity, current, nmt, emcy (the
+last EMCY code), emcys (EMCYs received) and rx (frames received). An
+expectation is checked when the replay has passed its time.
+
+    epos_replay machine.log > golden.txt
+    epos_replay -e golden.txt machine.log
+    epos_replay -r 100 machine.log          # throughput only
+
+Both the candump -l format, "(1436509052.249713) can0 181#3705", and the
+default one, "can0  181   [2]  37 05", with or without a leading
+timestamp, are read; extended and remote frames are skipped. The nodes
+are the ones the log has frames from, unless given with -n. The
+dispatch throughput in frames/s is reported as a comment line.
+
+\retval 0 all expectations met
+\retval 1 an expectation failed
+\retval 2 usage or input error
+
+*/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "epos.h"
+#include "main.h"
+#include "epos_host.h"
+
+typedef struct {
+    uint64_t us;            ///< after the first frame
+    CanRxMsgTypeDef msg;
+} frame_t;
+
+typedef struct {
+    uint64_t us;            ///< UINT64_MAX: at the end
+    uint8_t node;
+    char field[16];
+    int64_t value;
+    int line;
+} expect_t;
+
+static frame_t *frames;
+static size_t numFrames;
+static expect_t *expects;
+static size_t numExpects;
+static uint8_t nodeIds[EPOS_HOST_MAXNODES];
+static uint8_t numNodes;
+static int failures;
+
+/* room for element n of an array that grows by 256 */
+static void *grow(void *p, size_t n, size_t size) {
+    if (n % 256) return p;
+    p = realloc(p, (n + 256) * size);
+    if (!p) {
+        perror("realloc");
+        exit(2);
+    }
+    return p;
+}
+
+/* one line of a log, 1 if it is a standard data frame */
+static int parseFrame(char *s, uint64_t *us, CanRxMsgTypeDef *f) {
+    unsigned long sec, usec, id, b;
+    char *p, *end;
+    int n, i;
+
+    *us = 0;
+    memset(f, 0, sizeof(*f));
+    while (isspace((unsigned char)*s)) s++;
+    if (*s == '(') {
+        if (sscanf(s, "(%lu.%lu)%n", &sec, &usec, &n) != 2) return 0;
+        *us = sec * 1000000ull + usec;
+        s += n;
+    }
+    // interface
+    while (isspace((unsigned char)*s)) s++;
+    while (*s && !isspace((unsigned char)*s)) s++;
+    while (isspace((unsigned char)*s)) s++;
+
+    id = strtoul(s, &end, 16);
+    if (end == s || end - s > 3) return 0;          // extended or nonsense
+    f->StdId = id & 0x7FF;
+    f->IDE = CAN_ID_STD;
+    f->RTR = CAN_RTR_DATA;
+    p = end;
+    if (*p == '#') {
+        // candump -l: 181#3705
+        if (p[1] == 'R' || p[1] == 'r') return 0;
+        for (p++, i = 0; i < 8 && isxdigit((unsigned char)p[0]) && isxdigit((unsigned char)p[1]); i++, p += 2) {
+            sscanf(p, "%2lx", &b);
+            f->Data[i] = b;
+        }
+        f->DLC = i;
+        return 1;
+    }
+    // candump: 181   [2]  37 05
+    while (isspace((unsigned char)*p)) p++;
+    if (sscanf(p, "[%d]%n", &i, &n) != 1 || i < 0 || i > 8) return 0;
+    p += n;
+    f->DLC = i;
+    for (i = 0; i < (int)f->DLC; i++) {
+        b = strtoul(p, &end, 16);
+        if (end == p) return strstr(p, "remote") ? 0 : (f->DLC = i, 1);
+        f->Data[i] = b;
+        p = end;
+    }
+    return 1;
+}
+
+static int readLog(FILE *in) {
+    char line[256];
+    uint64_t us, first = 0;
+    CanRxMsgTypeDef f;
+    bool seen[128] = { false };
+    int id;
+
+    while (fgets(line, sizeof(line), in)) {
+        if (!parseFrame(line, &us, &f)) continue;
+        if (!numFrames) first = us;
+        frames = grow(frames, numFrames, sizeof(*frames));
+        frames[numFrames].us = us >= first ? us - first : 0;
+        frames[numFrames].msg = f;
+        numFrames++;
+        // what a node sends: EMCY, TPDOs, SDO answers, heartbeat
+        id = f.StdId & 0x7F;
+        switch (f.StdId >> 7) {
+        case 0x1: case 0x3: case 0x5: case 0x7: case 0x9: case 0xB: case 0xE:
+            if (id) seen[id] = true;
+        }
+    }
+    if (!numNodes)
+        for (id = 1; id < 128; id++)
+            if (seen[id]) nodeIds[numNodes++] = id;
+    return numFrames ? 0 : -1;
+}
+
+static int readExpects(const char *path) {
+    char line[256], when[32], *tok, *eq;
+    expect_t e;
+    FILE *f;
+    int lineNo = 0, node, n;
+
+    if (!(f = fopen(path, "r"))) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        lineNo++;
+        if ((tok = strchr(line, '#'))) *tok = '\0';
+        if (sscanf(line, "%31s %d%n", when, &node, &n) != 2) continue;
+        memset(&e, 0, sizeof(e));
+        e.us = strcmp(when, "end") ? (uint64_t)(atof(when) * 1e6 + 0.5) : UINT64_MAX;
+        e.node = node;
+        e.line = lineNo;
+        for (tok = strtok(line + n, " \t\n"); tok; tok = strtok(NULL, " \t\n")) {
+            if (!(eq = strchr(tok, '=')) || eq - tok >= (int)sizeof(e.field)) {
+                fprintf(stderr, "%s:%d: bad field '%s'\n", path, lineNo, tok);
+                fclose(f);
+                return -1;
+            }
+            memcpy(e.field, tok, eq - tok);
+            e.field[eq - tok] = '\0';
+            e.value = strtoll(eq + 1, NULL, 0);
+            expects = grow(expects, numExpects, sizeof(*expects));
+            expects[numExpects++] = e;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static epos_t *findNode(uint8_t id) {
+    int i;
+
+    for (i = 0; i < epos_num; i++)
+        if (epos[i] && epos[i]->Node_ID == id) return epos[i];
+    return NULL;
+}
+
+/* the value of a field of the decoded state, 0 if the field is unknown */
+static int getField(const epos_t *e, const char *field, int64_t *v) {
+    uint32_t rx = 0;
+    int i;
+
+    if (!strcmp(field, "statusword")) *v = e->Statusword;
+    else if (!strcmp(field, "state")) *v = e->State;
+    else if (!strcmp(field, "position")) *v = e->RxPosition;
+    else if (!strcmp(field, "velocity")) *v = e->RxVelocity;
+    else if (!strcmp(field, "current")) *v = e->RxCurrent;
+    else if (!strcmp(field, "nmt")) *v = e->NMTState;
+    else if (!strcmp(field, "emcy")) *v = e->Dev_Err;
+    else if (!strcmp(field, "emcys")) *v = e->EmcyCount;
+    else if (!strcmp(field, "rx")) {
+        for (i = 0; i < 16; i++) rx += e->Stats.RxFrames[i];
+        *v = rx;
+    } else return 0;
+    return 1;
+}
+
+static void check(const expect_t *x) {
+    epos_t *e = findNode(x->node);
+    int64_t v;
+
+    if (!e) {
+        fprintf(stderr, "expect:%d: node %d is not in the replay\n", x->line, x->node);
+        failures++;
+    } else if (!getField(e, x->field, &v)) {
+        fprintf(stderr, "expect:%d: unknown field '%s'\n", x->line, x->field);
+        failures++;
+    } else if (v != x->value) {
+        fprintf(stderr, "expect:%d: node %d %s is %lld (%#llx), expected %lld (%#llx)\n",
+                x->line, x->node, x->field, (long long)v, (unsigned long long)v,
+                (long long)x->value, (unsigned long long)x->value);
+        failures++;
+    }
+}
+
+/* the expectations up to 'us' that are not checked yet */
+static void checkUntil(uint64_t us, uint64_t *done) {
+    size_t i;
+
+    for (i = 0; i < numExpects; i++) {
+        if (expects[i].us > us || (done[i / 64] >> (i % 64)) & 1) continue;
+        check(&expects[i]);
+        done[i / 64] |= 1ull << (i % 64);
+    }
+}
+
+static void openNodes(void) {
+    int i;
+
+    for (i = 0; i < epos_num; i++) free(epos[i]);
+    hostReset();
+    for (i = 0; i < numNodes; i++) epos[i] = openEPOS(&hcan1, nodeIds[i]);
+    epos_num = numNodes;
+}
+
+/* one pass over the log, CPU time of the dispatch in ns */
+static uint64_t replay(bool timed, uint64_t *done) {
+    uint64_t t0, ns = 0, now = 0;
+    CanRxMsgTypeDef msg;
+    size_t k;
+
+    for (k = 0; k < numFrames; k++) {
+        if (done && frames[k].us > now) checkUntil(frames[k].us - 1, done);
+        if (timed && frames[k].us > now) hostAdvance(frames[k].us - now);
+        now = frames[k].us;
+        msg = frames[k].msg;
+        t0 = hostCPUNs();
+        hcan1.pRxMsg = &msg;
+        HAL_CAN_RxCpltCallback(&hcan1);
+        ns += hostCPUNs() - t0;
+    }
+    if (done) checkUntil(UINT64_MAX, done);
+    return ns;
+}
+
+static void printState(void) {
+    static const char *fields[] = { "statusword", "state", "position", "velocity",
+                                    "current", "nmt", "emcy", "emcys", "rx" };
+    unsigned i, k;
+    int64_t v;
+
+    for (i = 0; i < epos_num; i++) {
+        printf("end %3d", epos[i]->Node_ID);
+        for (k = 0; k < sizeof(fields) / sizeof(fields[0]); k++) {
+            getField(epos[i], fields[k], &v);
+            if (!strcmp(fields[k], "statusword") || !strcmp(fields[k], "emcy")
+                || !strcmp(fields[k], "nmt"))
+                printf(" %s=0x%04llx", fields[k], (unsigned long long)v);
+            else
+                printf(" %s=%lld", fields[k], (long long)v);
+        }
+        printf("\n");
+    }
+}
+
+static int usage(const char *name) {
+    fprintf(stderr, "usage: %s [-t] [-r repeat] [-n id,id,...] [-e expect] [candump.log]\n", name);
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    const char *expectPath = NULL;
+    bool timed = false;
+    FILE *in = stdin;
+    uint64_t ns = 0, *done;
+    unsigned long repeat = 1, r;
+    char *p;
+    int a, id;
+
+    for (a = 1; a < argc && argv[a][0] == '-' && argv[a][1]; a++) {
+        if (!strcmp(argv[a], "-t")) timed = true;
+        else if (!strcmp(argv[a], "-r") && a + 1 < argc) repeat = strtoul(argv[++a], NULL, 0);
+        else if (!strcmp(argv[a], "-e") && a + 1 < argc) expectPath = argv[++a];
+        else if (!strcmp(argv[a], "-n") && a + 1 < argc) {
+            for (p = argv[++a]; *p; p += *p == ',') {
+                id = strtol(p, &p, 0);
+                if (id < 1 || id > 127 || numNodes == EPOS_HOST_MAXNODES) return usage(argv[0]);
+                nodeIds[numNodes++] = id;
+            }
+        } else return usage(argv[0]);
+    }
+    if (a + 1 < argc || repeat == 0) return usage(argv[0]);
+    if (a < argc && !(in = fopen(argv[a], "r"))) {
+        perror(argv[a]);
+        return 2;
+    }
+    if (readLog(in) < 0) {
+        fprintf(stderr, "no frames\n");
+        return 2;
+    }
+    if (in != stdin) fclose(in);
+    if (expectPath && readExpects(expectPath) < 0) return 2;
+
+    // the first pass checks, the others only count time
+    done = calloc(numExpects / 64 + 1, sizeof(*done));
+    openNodes();
+    ns += replay(timed, done);
+    printState();
+    for (r = 1; r < repeat; r++) {
+        openNodes();
+        ns += replay(timed, NULL);
+    }
+
+    printf("# %zu frames x %lu, %u nodes: %.0f frames/s, %.1f ns/frame\n",
+           numFrames, repeat, numNodes, numFrames * repeat * 1e9 / (ns ? ns : 1),
+           (double)ns / (numFrames * repeat));
+    if (failures) fprintf(stderr, "%d expectation(s) failed\n", failures);
+
+    for (a = 0; a < epos_num; a++) free(epos[a]);
+    free(done);
+    free(frames);
+    free(expects);
+    return failures ? 1 : 0;
+}
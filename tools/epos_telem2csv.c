@@ -0,0 +1,105 @@
+/*! \file epos_telem2csv.c
+
+\brief host decoder for the libEPOS telemetry stream
+
+Reads the records of the telemetry channel (e.g. written to a file by
+JLinkRTTLogger) from a file or stdin and prints one CSV line per axis
+and sample:
+
+    epos_telem2csv rtt_channel3.bin > telemetry.csv
+
+Records with a bad checksum are skipped, gaps in the sequence numbers
+(records the target dropped) and the bandwidth are reported on stderr.
+
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "../epos_telem.h"
+
+/* bytes given back after a bad record, read before the file */
+static uint8_t back[EPOS_TELEM_RECSIZE(255)];
+static unsigned int nback = 0;
+
+static int getbyte(FILE *in) {
+    return nback ? back[--nback] : fgetc(in);
+}
+
+static unsigned int getbytes(FILE *in, uint8_t *p, unsigned int n) {
+    unsigned int i;
+    int c;
+
+    for (i = 0; i < n && (c = getbyte(in)) != EOF; i++) p[i] = c;
+    return i;
+}
+
+static uint32_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return get16(p) | (get16(p + 2) << 16);
+}
+
+int main(int argc, char **argv) {
+    FILE *in = stdin;
+    uint8_t rec[EPOS_TELEM_RECSIZE(255)];
+    unsigned long records = 0, lost = 0, bad = 0, bytes = 0;
+    uint32_t first = 0, last = 0, s1 = 0, s2 = 0;
+    uint16_t seq = 0;
+    unsigned int naxes, len, got, i;
+    const uint8_t *a;
+    int c;
+
+    if (argc > 1 && !(in = fopen(argv[1], "rb"))) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    printf("time_us,seq,node,state,statusword,position,velocity,current\n");
+    while ((c = getbyte(in)) != EOF) {
+        if (c != EPOS_TELEM_SYNC) continue;
+        rec[0] = c;
+        len = EPOS_TELEM_HDRSIZE;
+        got = getbytes(in, rec + 1, len - 1) + 1;
+        naxes = rec[1];
+        if (got == len && naxes > 0) {
+            len = EPOS_TELEM_RECSIZE(naxes);
+            got += getbytes(in, rec + got, len - got);
+        }
+        if (got == len && naxes > 0) {
+            for (s1 = s2 = 0, i = 0; i < len - 2; i++) {
+                s1 = (s1 + rec[i]) % 255;
+                s2 = (s2 + s1) % 255;
+            }
+        }
+        if (got != len || naxes == 0 || get16(rec + len - 2) != ((s2 << 8) | s1)) {
+            // not a record after all, look for the next sync byte behind it
+            bad++;
+            for (i = got - 1; i > 0; i--) back[nback++] = rec[i];
+            continue;
+        }
+
+        if (records == 0) first = get32(rec + 4);
+        else lost += (uint16_t)(get16(rec + 2) - seq - 1);
+        seq = get16(rec + 2);
+        last = get32(rec + 4);
+        records++;
+        bytes += len;
+
+        for (i = 0, a = rec + EPOS_TELEM_HDRSIZE; i < naxes; i++, a += EPOS_TELEM_AXISSIZE)
+            printf("%lu,%u,%u,%d,0x%04x,%ld,%ld,%d\n", (unsigned long)last, seq,
+                   a[0], (int8_t)a[1], get16(a + 2), (long)(int32_t)get32(a + 4),
+                   (long)(int32_t)get32(a + 8), (int16_t)get16(a + 12));
+    }
+
+    fprintf(stderr, "%lu records, %lu lost, %lu bad", records, lost, bad);
+    if (records > 1 && last != first)
+        fprintf(stderr, ", %.0f records/s, %.0f bytes/s",
+                (records - 1) * 1e6 / (uint32_t)(last - first),
+                bytes * 1e6 / (uint32_t)(last - first));
+    fprintf(stderr, "\n");
+    if (in != stdin) fclose(in);
+    return 0;
+}
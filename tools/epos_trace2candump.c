@@ -0,0 +1,82 @@
+/*! \file epos_trace2candump.c
+
+\brief convert a dump of the libEPOS frame trace to a candump log
+
+Reads what dumpEPOSTrace() wrote to the trace channel (e.g. saved by
+JLinkRTTLogger) from a file or stdin and prints it in the log format of
+candump -l, which canplayer, cansniffer or Wireshark read:
+
+    epos_trace2candump rtt_channel2.bin > epos.log
+    epos_trace2candump -i vcan0 rtt_channel2.bin
+
+The candump format has no direction, so sent and received frames look
+the same; the trigger frame is reported on stderr.
+
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "../epos_trace.h"
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int main(int argc, char **argv) {
+    FILE *in = stdin;
+    const char *iface = "can0";
+    uint8_t hdr[sizeof(eposTraceHdr_t)], rec[sizeof(eposTraceRec_t)];
+    unsigned int count, trigger, n, i, dlc, dumps = 0;
+    uint32_t t, last;
+    uint64_t us;
+    int arg = 1;
+
+    if (arg + 1 < argc && !strcmp(argv[arg], "-i")) {
+        iface = argv[arg + 1];
+        arg += 2;
+    }
+    if (arg < argc && !(in = fopen(argv[arg], "rb"))) {
+        perror(argv[arg]);
+        return 1;
+    }
+
+    // every dump starts with a header, several may follow each other
+    while (fread(hdr, 1, 4, in) == 4) {
+        while (get32(hdr) != EPOS_TRACE_MAGIC) {
+            int c = fgetc(in);
+            if (c == EOF) goto done;
+            memmove(hdr, hdr + 1, 3);
+            hdr[3] = c;
+        }
+        if (fread(hdr + 4, 1, sizeof(hdr) - 4, in) != sizeof(hdr) - 4) break;
+        count = hdr[4] | (hdr[5] << 8);
+        trigger = hdr[6] | (hdr[7] << 8);
+        dumps++;
+        us = 0;
+        last = 0;
+        for (n = 0; n < count; n++) {
+            if (fread(rec, 1, sizeof(rec), in) != sizeof(rec)) {
+                fprintf(stderr, "dump %u: only %u of %u frames\n", dumps, n, count);
+                goto done;
+            }
+            // the us timestamp of the target wraps after 71 minutes
+            t = get32(rec);
+            us = n ? us + (uint32_t)(t - last) : t;
+            last = t;
+            dlc = rec[6] > 8 ? 8 : rec[6];
+            printf("(%010llu.%06llu) %s %03X#", (unsigned long long)(us / 1000000),
+                   (unsigned long long)(us % 1000000), iface, get32(rec + 4) & 0x7FF);
+            for (i = 0; i < dlc; i++) printf("%02X", rec[8 + i]);
+            printf("\n");
+            if (rec[7] & EPOS_TRACE_TRIGGER)
+                fprintf(stderr, "dump %u: trigger at frame %u (%s %03X)\n", dumps, n,
+                        rec[7] & EPOS_TRACE_TX ? "TX" : "RX", get32(rec + 4) & 0x7FF);
+        }
+        if (trigger == 0xFFFF)
+            fprintf(stderr, "dump %u: %u frames, not triggered\n", dumps, count);
+    }
+ done:
+    if (in != stdin) fclose(in);
+    return 0;
+}